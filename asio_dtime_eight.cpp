@@ -0,0 +1,403 @@
+// asio_dtime_eight.cpp: An asynchronous TCP/UDP daytime load generator
+//
+// This program turns the synchronous clients of Daytime 1 (TCP) and
+// Daytime 4 (UDP) into a benchmark: it keeps thousands of connections
+// or datagrams in flight against a local daytime server and reports
+// the request rate and the p50/p99/p999 latency, so the servers of
+// Daytime 2, 3, 5, 6 and 7 can be compared without network access
+
+#include <iostream>
+#include <stdexcept>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Executor.h"
+#include "serial_port/Histogram.h"
+#include "serial_port/TimeProtocol.h"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+typedef boost::chrono::steady_clock clock_type;
+
+// The counters shared by all clients are only used for the per-second
+// progress report. Latencies are recorded by every client into its own
+// histogram, which is merged when the io_context has been stopped
+struct load_counters
+{
+	boost::atomic<boost::uint64_t> requests, errors, timeouts;
+	boost::atomic<boost::uint64_t> stale; // UDP replies to earlier requests, dropped
+	boost::atomic<bool> stopping;
+
+	load_counters() : requests(0), errors(0), timeouts(0), stale(0), stopping(false) {}
+};
+
+// Each client has at most one request in flight. The socket and
+// the timeout timer completions are serialised by a strand, because
+// the io_context is run by the thread pool of an Executor
+class tcp_client
+	: public boost::enable_shared_from_this<tcp_client>
+{
+public:
+	typedef boost::shared_ptr<tcp_client> pointer;
+
+	static pointer create(boost::asio::io_context& io_context,
+		const tcp::endpoint& endpoint, load_counters& counters,
+		boost::posix_time::time_duration timeout)
+	{
+		return pointer(new tcp_client(io_context, endpoint, counters, timeout));
+	}
+
+	void start()
+	{
+		start_ = clock_type::now();
+		timedOut_ = false;
+
+		timer_.expires_from_now(timeout_);
+		timer_.async_wait(boost::asio::bind_executor(strand_,
+			boost::bind(&tcp_client::handle_timeout, shared_from_this(),
+			boost::asio::placeholders::error)));
+
+		socket_.async_connect(endpoint_, boost::asio::bind_executor(strand_,
+			boost::bind(&tcp_client::handle_connect, shared_from_this(),
+			boost::asio::placeholders::error)));
+	}
+
+	const Histogram& latency() const { return latency_; }
+
+private:
+	tcp_client(boost::asio::io_context& io_context, const tcp::endpoint& endpoint,
+		load_counters& counters, boost::posix_time::time_duration timeout)
+		: strand_(io_context), socket_(io_context), timer_(io_context),
+		endpoint_(endpoint), counters_(counters), timeout_(timeout)
+	{
+	}
+
+	void handle_connect(const boost::system::error_code& error)
+	{
+		if (error) { complete(error); return; }
+
+		// The daytime server writes the string and closes the
+		// connection, so the response is complete on end of file
+		boost::asio::async_read(socket_, boost::asio::buffer(buf_),
+			boost::asio::bind_executor(strand_,
+			boost::bind(&tcp_client::handle_read, shared_from_this(),
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred)));
+	}
+
+	void handle_read(const boost::system::error_code& error,
+		size_t bytes_transferred)
+	{
+		if (error == boost::asio::error::eof && bytes_transferred > 0)
+			complete(boost::system::error_code());
+		else complete(error ? error : boost::asio::error::message_size);
+	}
+
+	void handle_timeout(const boost::system::error_code& error)
+	{
+		// The timer may have expired just before the request completed
+		// and the next one was started, so check the deadline again
+		if (error != boost::asio::error::operation_aborted &&
+			timer_.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+			timedOut_ = true; // the pending operation completes with an error
+			boost::system::error_code ignored_error;
+			socket_.close(ignored_error);
+		}
+	}
+
+	void complete(const boost::system::error_code& error)
+	{
+		boost::system::error_code ignored_error;
+		timer_.cancel(ignored_error);
+		socket_.close(ignored_error);
+
+		if (!error) {
+			latency_.Record(boost::chrono::duration_cast<boost::chrono::microseconds>(
+				clock_type::now() - start_).count());
+			++counters_.requests;
+		}
+		else if (timedOut_) ++counters_.timeouts;
+		else ++counters_.errors;
+
+		if (!counters_.stopping) start(); // the next request on a new connection
+	}
+
+	boost::asio::io_context::strand strand_;
+	tcp::socket socket_;
+	boost::asio::deadline_timer timer_;
+	tcp::endpoint endpoint_;
+	load_counters& counters_;
+	boost::posix_time::time_duration timeout_;
+
+	clock_type::time_point start_;
+	bool timedOut_;
+	boost::array<char, 128> buf_;
+	Histogram latency_;
+};
+
+// A UDP client owns a socket bound to its own ephemeral port. A reply
+// that comes after its request has timed out must not be taken for the
+// reply to the next one: in the binary mode (Daytime 5 and 6) the request
+// carries a sequence number in the originate time, which the server
+// echoes, and a reply with another number is dropped. The daytime string
+// carries nothing to match, so in the text mode the socket is replaced
+// after a timeout and a late reply goes to a port that is closed
+class udp_client
+	: public boost::enable_shared_from_this<udp_client>
+{
+public:
+	typedef boost::shared_ptr<udp_client> pointer;
+
+	static pointer create(boost::asio::io_context& io_context,
+		const udp::endpoint& endpoint, load_counters& counters,
+		boost::posix_time::time_duration timeout, bool binary)
+	{
+		return pointer(new udp_client(io_context, endpoint, counters, timeout, binary));
+	}
+
+	void start()
+	{
+		start_ = clock_type::now();
+		timedOut_ = false;
+		++sequence_;
+
+		timer_.expires_from_now(timeout_);
+		timer_.async_wait(boost::asio::bind_executor(strand_,
+			boost::bind(&udp_client::handle_timeout, shared_from_this(),
+			boost::asio::placeholders::error)));
+
+		std::size_t length = 1;
+		if (binary_) {
+			const TimeProtocol::Packet request = { TimeProtocol::Magic, 0, sequence_, 0, 0 };
+			TimeProtocol::Encode(request, send_buf_.data());
+			length = TimeProtocol::PacketSize;
+		}
+
+		// The send is not waited for: the reply (or the timeout) completes the request
+		boost::system::error_code error;
+		socket_.send_to(boost::asio::buffer(send_buf_, length), endpoint_, 0, error);
+		if (error) {
+			boost::asio::post(strand_, boost::bind(&udp_client::complete,
+				shared_from_this(), error));
+			return;
+		}
+
+		start_receive();
+	}
+
+	const Histogram& latency() const { return latency_; }
+
+private:
+	udp_client(boost::asio::io_context& io_context, const udp::endpoint& endpoint,
+		load_counters& counters, boost::posix_time::time_duration timeout, bool binary)
+		: strand_(io_context), socket_(io_context, udp::endpoint(udp::v4(), 0)),
+		timer_(io_context), endpoint_(endpoint), counters_(counters), timeout_(timeout),
+		binary_(binary), sequence_(0)
+	{
+		send_buf_[0] = 0;
+	}
+
+	void start_receive()
+	{
+		socket_.async_receive_from(boost::asio::buffer(recv_buf_), sender_,
+			boost::asio::bind_executor(strand_,
+			boost::bind(&udp_client::handle_receive, shared_from_this(),
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred)));
+	}
+
+	void handle_receive(const boost::system::error_code& error,
+		size_t bytes_transferred)
+	{
+		TimeProtocol::Packet reply;
+		if (!error && binary_ && (!TimeProtocol::Decode(recv_buf_.data(), bytes_transferred, reply)
+			|| reply.originate != sequence_)) {
+			++counters_.stale; // the reply to a request that has timed out
+			start_receive();
+			return;
+		}
+
+		complete((error || bytes_transferred > 0) ? error :
+			boost::system::error_code(boost::asio::error::message_size));
+	}
+
+	void handle_timeout(const boost::system::error_code& error)
+	{
+		if (error != boost::asio::error::operation_aborted &&
+			timer_.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+			timedOut_ = true; // the datagram or its reply has been lost
+			boost::system::error_code ignored_error;
+			socket_.cancel(ignored_error);
+		}
+	}
+
+	void complete(const boost::system::error_code& error)
+	{
+		boost::system::error_code ignored_error;
+		timer_.cancel(ignored_error);
+
+		if (!error) {
+			latency_.Record(boost::chrono::duration_cast<boost::chrono::microseconds>(
+				clock_type::now() - start_).count());
+			++counters_.requests;
+		}
+		else if (timedOut_) ++counters_.timeouts;
+		else ++counters_.errors;
+
+		if (timedOut_ && !binary_) {
+			// A new ephemeral port, the late reply can't be matched
+			boost::system::error_code ignored_error;
+			socket_.close(ignored_error);
+			socket_.open(udp::v4(), ignored_error);
+			socket_.bind(udp::endpoint(udp::v4(), 0), ignored_error);
+		}
+
+		if (!counters_.stopping) start();
+	}
+
+	boost::asio::io_context::strand strand_;
+	udp::socket socket_;
+	boost::asio::deadline_timer timer_;
+	udp::endpoint endpoint_, sender_;
+	load_counters& counters_;
+	boost::posix_time::time_duration timeout_;
+
+	clock_type::time_point start_;
+	bool timedOut_;
+	const bool binary_;
+	boost::uint64_t sequence_; // of the request in flight
+	boost::array<char, TimeProtocol::PacketSize> send_buf_;
+	boost::array<char, 128> recv_buf_;
+	Histogram latency_;
+};
+
+// Prints the request rate once per second and stops
+// the io_context when the test duration has elapsed
+class reporter
+{
+public:
+	reporter(boost::asio::io_context& io_context,
+		load_counters& counters, int duration)
+		: io_context_(io_context), timer_(io_context, boost::posix_time::seconds(1)),
+		counters_(counters), seconds_(0), duration_(duration), last_(0)
+	{
+		timer_.async_wait(boost::bind(&reporter::report, this));
+	}
+
+private:
+	void report()
+	{
+		const boost::uint64_t requests = counters_.requests;
+		std::cout << ++seconds_ << "s: " << (requests - last_) << " req/s, "
+			<< counters_.errors << " errors, " << counters_.timeouts << " timeouts, "
+			<< counters_.stale << " stale replies" << std::endl;
+		last_ = requests;
+
+		if (seconds_ >= duration_) {
+			counters_.stopping = true;
+			io_context_.stop(); // requests in flight are not counted
+			return;
+		}
+
+		timer_.expires_at(timer_.expires_at() + boost::posix_time::seconds(1));
+		timer_.async_wait(boost::bind(&reporter::report, this));
+	}
+
+	boost::asio::io_context& io_context_;
+	boost::asio::deadline_timer timer_;
+	load_counters& counters_;
+	int seconds_, duration_;
+	boost::uint64_t last_;
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::string host, port;
+		int connections, duration, timeout;
+		unsigned int threads;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("host", boost::program_options::value<std::string>(&host)->default_value("127.0.0.1"), "server host")
+			("port", boost::program_options::value<std::string>(&port)->default_value("daytime"), "server port")
+			("udp,u", "use UDP (Daytime 5, 6 and 7) instead of TCP")
+			("binary", "send binary requests with a sequence number (UDP, Daytime 5 and 6)")
+			("connections,c", boost::program_options::value<int>(&connections)->default_value(1000),
+				"concurrent connections (TCP) or datagrams in flight (UDP)")
+			("duration,d", boost::program_options::value<int>(&duration)->default_value(10), "test duration, seconds")
+			("timeout", boost::program_options::value<int>(&timeout)->default_value(1000), "request timeout, milliseconds")
+			("threads,t", boost::program_options::value<unsigned int>(&threads)->default_value(1), "threads to run the io_context");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		if (duration <= 0)
+			throw std::invalid_argument("the duration must be at least 1 second");
+
+		const bool useUdp = vm.count("udp") != 0;
+		const bool binary = vm.count("binary") != 0;
+		const boost::posix_time::time_duration requestTimeout = boost::posix_time::milliseconds(timeout);
+
+		Executor e;
+		load_counters counters;
+		reporter report(e.GetIOContext(), counters, duration);
+
+		// Thousands of TCP clients need as many file descriptors (ulimit -n)
+		std::vector<tcp_client::pointer> tcpClients;
+		std::vector<udp_client::pointer> udpClients;
+
+		if (useUdp) {
+			udp::resolver resolver(e.GetIOContext());
+			const udp::endpoint endpoint = *resolver.resolve(udp::v4(), host, port).begin();
+			for (int i = 0; i < connections; ++i)
+				udpClients.push_back(udp_client::create(e.GetIOContext(), endpoint, counters, requestTimeout, binary));
+		}
+		else {
+			tcp::resolver resolver(e.GetIOContext());
+			const tcp::endpoint endpoint = *resolver.resolve(tcp::v4(), host, port).begin();
+			for (int i = 0; i < connections; ++i)
+				tcpClients.push_back(tcp_client::create(e.GetIOContext(), endpoint, counters, requestTimeout));
+		}
+
+		e.OnRun = [&](boost::asio::io_context &) {
+			std::for_each(tcpClients.begin(), tcpClients.end(), [](const tcp_client::pointer &c) { c->start(); });
+			std::for_each(udpClients.begin(), udpClients.end(), [](const udp_client::pointer &c) { c->start(); });
+		};
+		e.Run(threads); // returns when the reporter stops the io_context
+
+		// All worker threads have been joined, so the histograms can be merged
+		Histogram latency;
+		std::for_each(tcpClients.begin(), tcpClients.end(), [&](const tcp_client::pointer &c) { latency.Merge(c->latency()); });
+		std::for_each(udpClients.begin(), udpClients.end(), [&](const udp_client::pointer &c) { latency.Merge(c->latency()); });
+
+		std::cout << (useUdp ? "UDP " : "TCP ") << host << ":" << port << ", "
+			<< connections << (useUdp ? " datagrams" : " connections") << " in flight" << std::endl
+			<< "requests: " << counters.requests << " (" << counters.requests / duration << " req/s), errors: "
+			<< counters.errors << ", timeouts: " << counters.timeouts << ", stale replies: " << counters.stale << std::endl
+			<< "latency, us: p50 " << latency.Percentile(50) << ", p99 " << latency.Percentile(99)
+			<< ", p999 " << latency.Percentile(99.9) << ", max " << latency.Max() << std::endl;
+	}
+	catch (std::exception& e)
+	{
+		// Handle any exceptions that may have been thrown
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
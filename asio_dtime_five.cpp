@@ -1,12 +1,16 @@
 // asio_dtime_five.cpp: A synchronous UDP daytime server
 //
 // This tutorial program shows how to use asio
-// to implement a server application with UDP
+// to implement a server application with UDP.
+// A 32-byte binary request is answered in the
+// high-precision format of TimeProtocol.h
 
 #include <iostream>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Logger.h"
+#include "serial_port/TimeProtocol.h"
 
 using boost::asio::ip::udp;
 
@@ -22,7 +26,7 @@ std::string make_daytime_string()
 	ss.imbue(std::locale(std::locale::classic(), facet));
 	ss << utc; // Thursday, March 22, 2018 13:00:53-UTC
 
-	std::cout << ss.str() << std::endl;
+	Log(Logger::Info, ss.str()); // queued, written by the logger thread
 	return ss.str();
 }
 
@@ -30,27 +34,51 @@ int main()
 {
 	try
 	{
+		Logger::Instance().Start(); // the requests are logged asynchronously
+
 		boost::asio::io_context io_context;		// All programs that use
 		// asio need to have at least one boost::asio::io_service object
 
 		// Create an ip::udp::socket object to receive requests on UDP port 13
 		udp::socket socket(io_context, udp::endpoint(udp::v4(), 13));
 
+		// The receive time of a binary request is taken by the kernel if possible
+		TimeProtocol::EnableRxTimestamps(socket);
+
 		for (;;)
 		{
-			boost::array<char, 1> recv_buf;
+			boost::array<char, TimeProtocol::PacketSize> recv_buf;
 			udp::endpoint remote_endpoint;
 			boost::system::error_code error;
+			boost::uint64_t rx_time;
+			bool kernel_time;
 
 			// Wait for a client to initiate contact with us.
 			// The remote_endpoint object will be populated
-			// by ip::udp::socket::receive_from()
-			socket.receive_from(boost::asio::buffer(recv_buf),
-				remote_endpoint, 0, error);
+			// by TimeProtocol::ReceiveFrom() (receive_from()
+			// which also returns the time of the datagram)
+			const std::size_t length = TimeProtocol::ReceiveFrom(socket,
+				boost::asio::buffer(recv_buf), remote_endpoint, rx_time, kernel_time, error);
 
 			if (error && error != boost::asio::error::message_size)
 				throw boost::system::system_error(error);
 
+			TimeProtocol::Packet packet;
+			if (!error && TimeProtocol::Decode(recv_buf.data(), length, packet))
+			{
+				// A binary request: echo the client's time and add ours
+				boost::array<char, TimeProtocol::PacketSize> reply;
+				packet.flags = kernel_time ? TimeProtocol::KernelRxTimestamp : 0;
+				packet.receive = rx_time;
+				packet.transmit = TimeProtocol::Now(); // as late as possible
+				TimeProtocol::Encode(packet, reply.data());
+
+				boost::system::error_code ignored_error;
+				socket.send_to(boost::asio::buffer(reply),
+					remote_endpoint, 0, ignored_error);
+				continue;
+			}
+
 			// Determine what we are going to send back to the client
 			std::string message = make_daytime_string();
 
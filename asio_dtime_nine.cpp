@@ -0,0 +1,126 @@
+// asio_dtime_nine.cpp: An asynchronous polling TCP daytime client
+//
+// Unlike Daytime 1, which resolves the host name, connects and reads
+// synchronously on every run, this program polls many time sources
+// concurrently through the DaytimeClient class. The resolved endpoints
+// are cached, connections to feed servers (Daytime 3 started with a feed
+// port) are kept warm between the rounds, and every query has a deadline
+
+#include <iostream>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/DaytimeClient.h"
+
+class poller
+{
+public:
+	poller(boost::asio::io_context& io_context, DaytimeClient& client,
+		const std::vector<std::string>& sources, int interval, int deadline,
+		int rounds, bool keep_alive)
+		: timer_(io_context), client_(client), sources_(sources),
+		interval_(boost::posix_time::seconds(interval)),
+		deadline_(boost::posix_time::milliseconds(deadline)),
+		rounds_(rounds), keep_alive_(keep_alive)
+	{
+		timer_.expires_from_now(boost::posix_time::seconds(0));
+		timer_.async_wait(boost::bind(&poller::poll, this));
+	}
+
+private:
+	void poll()
+	{
+		// All sources are queried at once, the client does not
+		// wait for one response before sending the next query
+		for (std::vector<std::string>::const_iterator i = sources_.begin(); i != sources_.end(); ++i)
+		{
+			const std::string::size_type colon = i->rfind(':');
+			const std::string host = i->substr(0, colon);
+			const std::string service = (colon == std::string::npos) ? "daytime" : i->substr(colon + 1);
+
+			client_.Query(host, service, deadline_,
+				boost::bind(&poller::handle_response, this, *i, _1, _2), keep_alive_);
+		}
+
+		// The next round is started relative to the previous one
+		if (--rounds_ > 0) {
+			timer_.expires_at(timer_.expires_at() + interval_);
+			timer_.async_wait(boost::bind(&poller::poll, this));
+		}
+	}
+
+	void handle_response(const std::string& source,
+		const boost::system::error_code& error, const std::string& response)
+	{
+		if (error) std::cout << source << ": " << error.message() << std::endl;
+		else std::cout << source << ": " << response << std::endl;
+	}
+
+	boost::asio::deadline_timer timer_;
+	DaytimeClient& client_;
+	std::vector<std::string> sources_;
+	boost::posix_time::time_duration interval_, deadline_;
+	int rounds_;
+	bool keep_alive_;
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::vector<std::string> sources;
+		int interval, deadline, rounds;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("source,s", boost::program_options::value<std::vector<std::string> >(&sources),
+				"time source as host[:port], may be repeated")
+			("interval,i", boost::program_options::value<int>(&interval)->default_value(1), "poll interval, seconds")
+			("deadline,d", boost::program_options::value<int>(&deadline)->default_value(500),
+				"query deadline, milliseconds (1500 with --keep-alive)")
+			("rounds,n", boost::program_options::value<int>(&rounds)->default_value(10), "number of poll rounds")
+			("keep-alive,k", "keep connections to feed servers open between the rounds");
+
+		boost::program_options::positional_options_description positional;
+		positional.add("source", -1);
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::command_line_parser(argc, argv)
+			.options(desc).positional(positional).run(), vm);
+		boost::program_options::notify(vm);
+
+		if (vm.count("help") || sources.empty()) {
+			std::cerr << "Usage: asio_dtime_nine [options] host[:port] ..." << std::endl
+				<< desc << std::endl;
+			return 0;
+		}
+
+		// A new connection to a feed server waits for the next tick of the
+		// feed, once a second, so the deadline has to be longer than that
+		const bool keep_alive = vm.count("keep-alive") != 0;
+		if (keep_alive && vm["deadline"].defaulted())
+			deadline = 1500;
+
+		boost::asio::io_context io_context;
+		DaytimeClient client(io_context);
+		poller p(io_context, client, sources, interval, deadline, rounds, keep_alive);
+
+		io_context.run(); // Returns when the last round has been answered
+
+		const DaytimeClient::Statistics s = client.GetStatistics();
+		std::cout << "queries: " << s.queries << ", failures: " << s.failures
+			<< ", timeouts: " << s.timeouts << std::endl
+			<< "resolver cache: " << s.cacheHits << " hits, " << s.cacheMisses << " misses" << std::endl
+			<< "connections: " << s.connects << " new, " << s.reuses << " reused, "
+			<< s.dropped << " dropped" << std::endl;
+	}
+	catch (std::exception& e)
+	{
+		// Handle any exceptions that may have been thrown
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
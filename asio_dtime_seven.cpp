@@ -7,9 +7,12 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/array.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Logger.h"
+#include "serial_port/RateLimiter.h"
 
 using boost::asio::ip::tcp;
 using boost::asio::ip::udp;
@@ -29,7 +32,7 @@ std::string make_daytime_string()
 	ss.imbue(std::locale(std::locale::classic(), facet));
 	ss << utc; // Thursday, March 22, 2018 13:00:53-UTC
 
-	std::cout << ss.str() << std::endl;
+	Log(Logger::Info, ss.str()); // queued, written by the logger thread
 	return ss.str();
 }
 
@@ -147,91 +150,169 @@ private:
 class udp_server
 {
 public:
-	// The constructor initialises a socket to listen on UDP port 13
-	udp_server(boost::asio::io_context& io_context)
-		: socket_(io_context, udp::endpoint(udp::v4(), 13))
+	// The constructor initialises a socket to listen on UDP port 13 and
+	// starts a receive on each of the slots, so up to that number of
+	// requests can be serviced at once by the threads running io_context.
+	// If a rate is given, every source may send up to rate requests per
+	// second (and a burst of that many at once), the requests above the
+	// rate are not answered; a rate of 0 (the default) admits everything
+	udp_server(boost::asio::io_context& io_context, std::size_t slots = 16,
+		double rate = 0, double burst = 20)
+		: socket_(io_context, udp::endpoint(udp::v4(), 13)),
+		strand_(io_context), slots_(slots), limiter_(rate, burst),
+		sweep_timer_(io_context), dropped_(0)
 	{
-		start_receive();
+		start_sweep();
+
+		for (std::size_t i = 0; i < slots_.size(); ++i)
+			start_receive(slots_[i]);
 	}
 
 private:
+	// A slot owns everything that one request needs: the remote endpoint,
+	// the receive buffer and a preallocated reply buffer. The slot is not
+	// reused until handle_send() has been called, so no per-datagram
+	// allocation is needed to keep the reply alive
+	struct slot
+	{
+		udp::endpoint remote_endpoint;
+		boost::array<char, 1> recv_buffer;
+		boost::array<char, 64> reply;
+		std::size_t reply_length;
+		boost::posix_time::ptime reply_time; // the second the reply was made for
+
+		slot() : reply_length(0) {}
+	};
+
 	// The function ip::udp::socket::async_receive_from() will cause
 	// the application to listen in the background for a new request.
 	// When such a request is received, the boost::asio::io_service
 	// object will invoke the handle_receive() function with two arguments:
 	// a value of type boost::system::error_code indicating whether the
 	// operation succeeded or failed, and a size_t value bytes_transferred
-	// specifying the number of bytes received
-	void start_receive()
+	// specifying the number of bytes received. The socket is shared by all
+	// slots, so the operations are started through the strand_
+	void start_receive(slot& s)
 	{
-		socket_.async_receive_from(
-			boost::asio::buffer(recv_buffer_), remote_endpoint_,
-			boost::bind(&udp_server::handle_receive, this,
-			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+		boost::asio::dispatch(strand_, [this, &s] {
+			socket_.async_receive_from(
+				boost::asio::buffer(s.recv_buffer), s.remote_endpoint,
+				boost::bind(&udp_server::handle_receive, this, boost::ref(s),
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
+		});
+	}
+
+	// The daytime string changes once per second, so it is formatted
+	// into the slot's reply buffer only when the second has changed
+	void make_reply(slot& s)
+	{
+		const boost::posix_time::ptime now =
+			boost::posix_time::second_clock::universal_time();
+
+		if (now != s.reply_time) {
+			const std::string message = make_daytime_string();
+			s.reply_length = message.copy(s.reply.data(), s.reply.size());
+			s.reply_time = now;
+		}
 	}
 
 	// The function handle_receive() will service the client request
-	void handle_receive(const boost::system::error_code& error,
+	void handle_receive(slot& s, const boost::system::error_code& error,
 		std::size_t /*bytes_transferred*/)
 	{
 		// The error parameter contains the result of the asynchronous
-		// operation. Since we only provide the 1-byte recv_buffer_ to
+		// operation. Since we only provide the 1-byte recv_buffer to
 		// contain the client's request, the boost::asio::io_service
 		// object would return an error if the client sent anything
 		// larger. We can ignore such an error if it comes up
 		if (!error || error == boost::asio::error::message_size)
 		{
+			// A source over its rate is dropped before any work is done
+			// for it, and the slot goes back to listening at once
+			if (!limiter_.Admit(s.remote_endpoint.address())) {
+				start_receive(s);
+				return;
+			}
+
 			// Determine what we are going to send
-			boost::shared_ptr<std::string> message(
-				new std::string(make_daytime_string()));
+			make_reply(s);
 
 			// We now call ip::udp::socket::async_send_to()
 			// to serve the data to the client
-			socket_.async_send_to(boost::asio::buffer(*message), remote_endpoint_,
-				boost::bind(&udp_server::handle_send, this, message,
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
+			boost::asio::dispatch(strand_, [this, &s] {
+				socket_.async_send_to(boost::asio::buffer(s.reply, s.reply_length),
+					s.remote_endpoint, boost::bind(&udp_server::handle_send, this,
+					boost::ref(s), boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred));
+			});
 
 			// Any further actions for this client request are
 			// now the responsibility of handle_send()
+		}
+		else if (error != boost::asio::error::operation_aborted)
+			start_receive(s); // the slot keeps listening after an error
+	}
 
-			// Start listening for the next client request
-			start_receive();
+	// Once per second the idle sources of one shard of the limiter
+	// are aged out and the number of dropped requests is reported
+	void start_sweep()
+	{
+		sweep_timer_.expires_from_now(boost::posix_time::seconds(1));
+		sweep_timer_.async_wait(boost::bind(&udp_server::handle_sweep, this,
+			boost::asio::placeholders::error));
+	}
+
+	void handle_sweep(const boost::system::error_code& error)
+	{
+		if (error) return;
+
+		limiter_.Sweep();
+		const RateLimiter::Counters counters = limiter_.GetCounters();
+		if (counters.dropped != dropped_) {
+			Log(Logger::Warning, "rate limit: " + boost::lexical_cast<std::string>(counters.dropped - dropped_) +
+				" requests dropped, " + boost::lexical_cast<std::string>(counters.admitted) + " admitted in total");
+			dropped_ = counters.dropped;
 		}
+
+		start_sweep();
 	}
 
-	// The function handle_send() is invoked
-	// after the service request has been completed
-	void handle_send(boost::shared_ptr<std::string> /*message*/,
-		const boost::system::error_code& /*error*/,
+	// The function handle_send() is invoked after the service request
+	// has been completed. The reply buffer is free again, so the slot
+	// starts listening for the next client request
+	void handle_send(slot& s, const boost::system::error_code& /*error*/,
 		std::size_t /*bytes_transferred*/)
 	{
-		// When initiating the asynchronous operation, and if using
-		// boost::bind(), you must specify only the arguments that
-		// match the handler's parameter list. In this program,
-		// both of the argument placeholders
-		// (boost::asio::placeholders::error and
-		// boost::asio::placeholders::bytes_transferred)
-		// could potentially have been removed
+		start_receive(s);
 	}
 
 	udp::socket socket_;
-	udp::endpoint remote_endpoint_;
-	boost::array<char, 1> recv_buffer_;
+	boost::asio::io_context::strand strand_;
+	std::vector<slot> slots_; // never resized, handlers refer to the slots
+	RateLimiter limiter_;
+	boost::asio::deadline_timer sweep_timer_;
+	boost::uint64_t dropped_; // reported so far
 };
 
-int main()
+int main(int argc, char* argv[])
 {
 	try
 	{
+		Logger::Instance().Start(); // the requests are logged asynchronously
+
+		// The per-source limit of the UDP server is off unless it is given on
+		// the command line: asio_dtime_seven [rate [burst]], e.g. 100 20
+		const double rate = argc > 1 ? boost::lexical_cast<double>(argv[1]) : 0;
+		const double burst = argc > 2 ? boost::lexical_cast<double>(argv[2]) : 20;
+
 		boost::asio::io_context io_context;
 
 		// We will begin by creating a server object to accept
 		// a TCP client connection. We also need a server object
 		// to accept a UDP client request
 		tcp_server server1(io_context);
-		udp_server server2(io_context);
+		udp_server server2(io_context, 16, rate, burst);
 
 		// We have created two lots of work for
 		// the boost::asio::io_service object to do
@@ -1,14 +1,20 @@
 // asio_dtime_six.cpp: An asynchronous UDP daytime server
 //
 // This tutorial program shows how to use asio
-// to implement a server application with UDP
+// to implement a server application with UDP.
+// A 32-byte binary request is answered in the
+// high-precision format of TimeProtocol.h
 
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/array.hpp>
-#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Logger.h"
+#include "serial_port/RateLimiter.h"
+#include "serial_port/Executor.h"
+#include "serial_port/TimeProtocol.h"
 
 using boost::asio::ip::udp;
 
@@ -27,98 +33,243 @@ std::string make_daytime_string()
 	ss.imbue(std::locale(std::locale::classic(), facet));
 	ss << utc; // Thursday, March 22, 2018 13:00:53-UTC
 
-	std::cout << ss.str() << std::endl;
+	Log(Logger::Info, ss.str()); // queued, written by the logger thread
 	return ss.str();
 }
 
 class udp_server
 {
 public:
-	// The constructor initialises a socket to listen on UDP port 13
-	udp_server(boost::asio::io_context& io_context)
-		: socket_(io_context, udp::endpoint(udp::v4(), 13))
+	// The constructor initialises a socket to listen on UDP port 13 and
+	// starts a receive on each of the slots, so up to that number of
+	// requests can be serviced at once by the threads running io_context.
+	// If a rate is given, every source may send up to rate requests per
+	// second (and a burst of that many at once), the requests above the
+	// rate are not answered; a rate of 0 (the default) admits everything
+	udp_server(boost::asio::io_context& io_context, std::size_t slots = 16,
+		double rate = 0, double burst = 20)
+		: socket_(io_context, udp::endpoint(udp::v4(), 13)),
+		strand_(io_context), slots_(slots), limiter_(rate, burst),
+		sweep_timer_(io_context), dropped_(0), waiting_(false)
 	{
-		start_receive();
+		start_sweep();
+
+		// The receive time of a binary request is taken by the kernel
+		// where it is supported. The datagrams are then read by recvmsg()
+		// once the socket is readable, by a single reader that hands them
+		// to the free slots (see handle_readable())
+		kernel_timestamps_ = TimeProtocol::EnableRxTimestamps(socket_);
+		socket_.non_blocking(true);
+		free_.reserve(slots_.size());
+
+		for (std::size_t i = 0; i < slots_.size(); ++i)
+			start_receive(slots_[i]);
 	}
 
 private:
+	// A slot owns everything that one request needs: the remote endpoint,
+	// the receive buffer and a preallocated reply buffer. The slot is not
+	// reused until handle_send() has been called, so no per-datagram
+	// allocation is needed to keep the reply alive
+	struct slot
+	{
+		udp::endpoint remote_endpoint;
+		boost::array<char, TimeProtocol::PacketSize> recv_buffer;
+		boost::uint64_t rx_time; // when the request was received
+		bool kernel_time;
+		boost::array<char, 64> reply;
+		std::size_t reply_length;
+		boost::posix_time::ptime reply_time; // the second the reply was made for
+
+		slot() : rx_time(0), kernel_time(false), reply_length(0) {}
+	};
+
 	// The function ip::udp::socket::async_receive_from() will cause
 	// the application to listen in the background for a new request.
 	// When such a request is received, the boost::asio::io_service
 	// object will invoke the handle_receive() function with two arguments:
 	// a value of type boost::system::error_code indicating whether the
 	// operation succeeded or failed, and a size_t value bytes_transferred
-	// specifying the number of bytes received
-	void start_receive()
+	// specifying the number of bytes received. The socket is shared by all
+	// slots, so the operations are started through the strand_
+	void start_receive(slot& s)
 	{
-		socket_.async_receive_from(
-			boost::asio::buffer(recv_buffer_), remote_endpoint_,
-			boost::bind(&udp_server::handle_receive, this,
-			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+		boost::asio::dispatch(strand_, [this, &s] {
+			if (kernel_timestamps_) {
+				// A readable socket completes every wait queued on it, so
+				// there is one wait for all the slots, not one per slot
+				free_.push_back(&s);
+				if (!waiting_) start_wait();
+			}
+			else
+				socket_.async_receive_from(
+					boost::asio::buffer(s.recv_buffer), s.remote_endpoint,
+					boost::bind(&udp_server::handle_receive, this, boost::ref(s),
+					boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred));
+		});
 	}
 
-	 // The function handle_receive() will service the client request
-	void handle_receive(const boost::system::error_code& error,
-		std::size_t /*bytes_transferred*/)
+	void start_wait()
+	{
+		waiting_ = true;
+		socket_.async_wait(udp::socket::wait_read, boost::asio::bind_executor(strand_,
+			boost::bind(&udp_server::handle_readable, this, boost::asio::placeholders::error)));
+	}
+
+	// The reader runs in the strand_. It reads the datagrams into the free
+	// slots until the socket has no more, and every slot is then serviced
+	// by any of the threads. With no free slot left the reader stops, the
+	// next slot to become free starts it again
+	void handle_readable(const boost::system::error_code& error)
+	{
+		waiting_ = false;
+		if (error == boost::asio::error::operation_aborted) return;
+
+		while (!error && !free_.empty()) {
+			slot& s = *free_.back();
+			boost::system::error_code ec;
+			const std::size_t length = TimeProtocol::ReceiveFrom(socket_,
+				boost::asio::buffer(s.recv_buffer), s.remote_endpoint, s.rx_time, s.kernel_time, ec);
+			if (ec == boost::asio::error::would_block) break;
+
+			free_.pop_back();
+			boost::asio::post(socket_.get_executor(), boost::bind(&udp_server::handle_receive,
+				this, boost::ref(s), ec, length));
+		}
+
+		if (!free_.empty()) start_wait();
+	}
+
+	// The daytime string changes once per second, so it is formatted
+	// into the slot's reply buffer only when the second has changed
+	void make_reply(slot& s)
+	{
+		const boost::posix_time::ptime now =
+			boost::posix_time::second_clock::universal_time();
+
+		if (now != s.reply_time) {
+			const std::string message = make_daytime_string();
+			s.reply_length = message.copy(s.reply.data(), s.reply.size());
+			s.reply_time = now;
+		}
+	}
+
+	// The function handle_receive() will service the client request
+	void handle_receive(slot& s, const boost::system::error_code& error,
+		std::size_t bytes_transferred)
 	{
 		// The error parameter contains the result of the asynchronous
-		// operation. Since we only provide the 1-byte recv_buffer_ to
+		// operation. Since we only provide a small recv_buffer to
 		// contain the client's request, the boost::asio::io_service
 		// object would return an error if the client sent anything
 		// larger. We can ignore such an error if it comes up
 		if (!error || error == boost::asio::error::message_size)
 		{
-			// Determine what we are going to send
-			boost::shared_ptr<std::string> message(
-				new std::string(make_daytime_string()));
+			// A source over its rate is dropped before any work is done
+			// for it, and the slot goes back to listening at once
+			if (!limiter_.Admit(s.remote_endpoint.address())) {
+				start_receive(s);
+				return;
+			}
+
+			TimeProtocol::Packet packet;
+			const bool binary = !error &&
+				TimeProtocol::Decode(s.recv_buffer.data(), bytes_transferred, packet);
+
+			if (binary) {
+				if (!kernel_timestamps_) s.rx_time = TimeProtocol::Now();
+				packet.flags = s.kernel_time ? TimeProtocol::KernelRxTimestamp : 0;
+				packet.receive = s.rx_time;
+				s.reply_time = boost::posix_time::not_a_date_time; // the reply is overwritten
+				s.reply_length = TimeProtocol::PacketSize;
+			}
+			else make_reply(s); // Determine what we are going to send
 
 			// We now call ip::udp::socket::async_send_to()
 			// to serve the data to the client
-			socket_.async_send_to(boost::asio::buffer(*message), remote_endpoint_,
-				boost::bind(&udp_server::handle_send, this, message,
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
+			boost::asio::dispatch(strand_, [this, &s, binary, packet]() mutable {
+				if (binary) { // the transmit time is taken just before the send
+					packet.transmit = TimeProtocol::Now();
+					TimeProtocol::Encode(packet, s.reply.data());
+				}
+
+				socket_.async_send_to(boost::asio::buffer(s.reply, s.reply_length),
+					s.remote_endpoint, boost::bind(&udp_server::handle_send, this,
+					boost::ref(s), boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred));
+			});
 
 			// Any further actions for this client request are
 			// now the responsibility of handle_send()
+		}
+		else if (error != boost::asio::error::operation_aborted)
+			start_receive(s); // the slot keeps listening after an error
+	}
 
-			// Start listening for the next client request
-			start_receive();
+	// Once per second the idle sources of one shard of the limiter
+	// are aged out and the number of dropped requests is reported
+	void start_sweep()
+	{
+		sweep_timer_.expires_from_now(boost::posix_time::seconds(1));
+		sweep_timer_.async_wait(boost::bind(&udp_server::handle_sweep, this,
+			boost::asio::placeholders::error));
+	}
+
+	void handle_sweep(const boost::system::error_code& error)
+	{
+		if (error) return;
+
+		limiter_.Sweep();
+		const RateLimiter::Counters counters = limiter_.GetCounters();
+		if (counters.dropped != dropped_) {
+			Log(Logger::Warning, "rate limit: " + boost::lexical_cast<std::string>(counters.dropped - dropped_) +
+				" requests dropped, " + boost::lexical_cast<std::string>(counters.admitted) + " admitted in total");
+			dropped_ = counters.dropped;
 		}
+
+		start_sweep();
 	}
 
-	// The function handle_send() is invoked
-	// after the service request has been completed
-	void handle_send(boost::shared_ptr<std::string> /*message*/,
-		const boost::system::error_code& /*error*/,
+	// The function handle_send() is invoked after the service request
+	// has been completed. The reply buffer is free again, so the slot
+	// starts listening for the next client request
+	void handle_send(slot& s, const boost::system::error_code& /*error*/,
 		std::size_t /*bytes_transferred*/)
 	{
-		// When initiating the asynchronous operation, and if using
-		// boost::bind(), you must specify only the arguments that
-		// match the handler's parameter list. In this program,
-		// both of the argument placeholders
-		// (boost::asio::placeholders::error and
-		// boost::asio::placeholders::bytes_transferred)
-		// could potentially have been removed
+		start_receive(s);
 	}
 
 	udp::socket socket_;
-	udp::endpoint remote_endpoint_;
-	boost::array<char, 1> recv_buffer_;
+	boost::asio::io_context::strand strand_;
+	std::vector<slot> slots_; // never resized, handlers refer to the slots
+	RateLimiter limiter_;
+	boost::asio::deadline_timer sweep_timer_;
+	boost::uint64_t dropped_; // reported so far
+	bool kernel_timestamps_;
+	std::vector<slot*> free_; // the slots waiting for a datagram, in the strand_
+	bool waiting_; // for the socket to become readable, in the strand_
 };
 
-int main()
+int main(int argc, char* argv[])
 {
 	try
 	{
-		boost::asio::io_context io_context;
-		udp_server server(io_context);
+		Logger::Instance().Start(); // the requests are logged asynchronously
+
+		// The per-source limit is off unless it is given on the command
+		// line: asio_dtime_six [rate [burst]], e.g. 100 20 requests per second
+		const double rate = argc > 1 ? boost::lexical_cast<double>(argv[1]) : 0;
+		const double burst = argc > 2 ? boost::lexical_cast<double>(argv[2]) : 20;
+
+		Executor e;
+		udp_server server(e.GetIOContext(), 16, rate, burst);
 
-		// Create a server object to accept
-		// incoming client requests, and run
-		// the boost::asio::io_service object
-		io_context.run();
+		// Create a server object to accept incoming client
+		// requests, and run the boost::asio::io_service object
+		// from a thread per core, each slot of the server can
+		// be serviced by any of the threads
+		e.Run();
 	}
 	catch (std::exception& e)
 	{
@@ -0,0 +1,192 @@
+// asio_dtime_ten.cpp: A high-precision UDP time client and benchmark
+//
+// This program uses the binary mode of the UDP daytime servers of
+// Daytime 5 and 6 (see TimeProtocol.h). Every request carries the
+// client's transmit time, the reply adds the server's receive and
+// transmit times, and the client's receive time is taken by the kernel.
+// The offset and the round-trip delay of every exchange are computed
+// as in NTP and summarised in microseconds, which shows the precision
+// achieved on the local host or network
+
+#include <cmath>
+#include <iostream>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Histogram.h"
+#include "serial_port/TimeProtocol.h"
+
+using boost::asio::ip::udp;
+
+class time_client
+{
+public:
+	time_client(boost::asio::io_context& io_context, const udp::endpoint& server,
+		int count, int interval, int timeout)
+		: socket_(io_context, udp::endpoint(udp::v4(), 0)), timer_(io_context),
+		server_(server), count_(count), interval_(boost::posix_time::microseconds(interval)),
+		timeout_(boost::posix_time::milliseconds(timeout)), waiting_(false),
+		lost_(0), kernel_server_(0), offset_sum_(0), offset_sum2_(0),
+		offset_min_(1e9), offset_max_(-1e9)
+	{
+		kernel_client_ = TimeProtocol::EnableRxTimestamps(socket_);
+		socket_.non_blocking(true);
+		send_request();
+	}
+
+	void report() const
+	{
+		const boost::uint64_t n = delay_.Count();
+		const double mean = n ? offset_sum_ / n : 0;
+		const double stddev = n ? std::sqrt(std::max(0.0, offset_sum2_ / n - mean * mean)) : 0;
+
+		std::cout << "exchanges: " << n << ", lost: " << lost_ << std::endl
+			<< "kernel receive timestamps: client " << (kernel_client_ ? "yes" : "no")
+			<< ", server " << kernel_server_ << " of " << n << std::endl
+			<< "delay, us: min " << delay_.Min() / 1000.0 << ", p50 " << delay_.Percentile(50) / 1000.0
+			<< ", p99 " << delay_.Percentile(99) / 1000.0 << ", max " << delay_.Max() / 1000.0 << std::endl
+			<< "offset, us: mean " << mean * 1e6 << ", stddev " << stddev * 1e6
+			<< ", min " << offset_min_ * 1e6 << ", max " << offset_max_ * 1e6 << std::endl;
+	}
+
+private:
+	void send_request()
+	{
+		if (count_-- <= 0) return; // no more work, run() returns
+
+		TimeProtocol::Packet packet = TimeProtocol::Packet();
+		packet.magic = TimeProtocol::Magic;
+		packet.originate = TimeProtocol::Now(); // t1, as late as possible
+		TimeProtocol::Encode(packet, request_.data());
+
+		boost::system::error_code error;
+		socket_.send_to(boost::asio::buffer(request_), server_, 0, error);
+
+		waiting_ = true;
+		timer_.expires_from_now(timeout_);
+		timer_.async_wait(boost::bind(&time_client::handle_timeout, this,
+			boost::asio::placeholders::error));
+
+		socket_.async_wait(udp::socket::wait_read, boost::bind(&time_client::handle_readable,
+			this, packet.originate, boost::asio::placeholders::error));
+	}
+
+	void handle_readable(boost::uint64_t t1, const boost::system::error_code& error)
+	{
+		// Cancelled by the timeout, or ready in the same pass as the timeout,
+		// which has counted the request lost and scheduled the next one
+		if (error || !waiting_) return;
+
+		udp::endpoint sender;
+		boost::uint64_t t4;
+		bool kernel_time;
+		boost::system::error_code ec;
+		const std::size_t length = TimeProtocol::ReceiveFrom(socket_,
+			boost::asio::buffer(reply_), sender, t4, kernel_time, ec);
+
+		TimeProtocol::Packet packet;
+		if (ec == boost::asio::error::would_block || (!ec &&
+			(!TimeProtocol::Decode(reply_.data(), length, packet) || packet.originate != t1))) {
+			// Nothing to read, or a late reply to a request that has timed out
+			socket_.async_wait(udp::socket::wait_read, boost::bind(&time_client::handle_readable,
+				this, t1, boost::asio::placeholders::error));
+			return;
+		}
+
+		waiting_ = false;
+		timer_.cancel();
+		if (!ec) {
+			const double delay = TimeProtocol::Delay(t1, packet.receive, packet.transmit, t4);
+			const double offset = TimeProtocol::Offset(t1, packet.receive, packet.transmit, t4);
+
+			delay_.Record(boost::uint64_t(std::max(0.0, delay) * 1e9)); // nanoseconds
+			offset_sum_ += offset; offset_sum2_ += offset * offset;
+			offset_min_ = std::min(offset_min_, offset);
+			offset_max_ = std::max(offset_max_, offset);
+			if (packet.flags & TimeProtocol::KernelRxTimestamp) ++kernel_server_;
+		}
+		else ++lost_;
+
+		schedule_next();
+	}
+
+	void handle_timeout(const boost::system::error_code& error)
+	{
+		if (error || !waiting_) return; // the reply has arrived in time
+
+		waiting_ = false;
+		++lost_;
+		socket_.cancel(); // the pending wait completes with operation_aborted
+		schedule_next();
+	}
+
+	void schedule_next()
+	{
+		timer_.expires_from_now(interval_);
+		timer_.async_wait(boost::bind(&time_client::handle_interval, this,
+			boost::asio::placeholders::error));
+	}
+
+	void handle_interval(const boost::system::error_code& error)
+	{
+		if (error) return; // the timer has been set again, by the other chain
+		send_request();
+	}
+
+	udp::socket socket_;
+	boost::asio::deadline_timer timer_;
+	udp::endpoint server_;
+	int count_;
+	boost::posix_time::time_duration interval_, timeout_;
+
+	boost::array<char, TimeProtocol::PacketSize> request_, reply_;
+	bool kernel_client_, waiting_;
+	unsigned long lost_, kernel_server_;
+
+	Histogram delay_; // nanoseconds
+	double offset_sum_, offset_sum2_, offset_min_, offset_max_; // seconds
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::string host, port;
+		int count, interval, timeout;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("host", boost::program_options::value<std::string>(&host)->default_value("127.0.0.1"), "server host")
+			("port", boost::program_options::value<std::string>(&port)->default_value("daytime"), "server port")
+			("count,n", boost::program_options::value<int>(&count)->default_value(1000), "number of exchanges")
+			("interval,i", boost::program_options::value<int>(&interval)->default_value(1000), "interval between exchanges, microseconds")
+			("timeout", boost::program_options::value<int>(&timeout)->default_value(1000), "reply timeout, milliseconds");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		boost::asio::io_context io_context;
+		udp::resolver resolver(io_context);
+		const udp::endpoint server = *resolver.resolve(udp::v4(), host, port).begin();
+
+		time_client client(io_context, server, count, interval, timeout);
+		io_context.run();
+		client.report();
+	}
+	catch (std::exception& e)
+	{
+		// Handle any exceptions that may have been thrown
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
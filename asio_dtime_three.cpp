@@ -1,14 +1,18 @@
 // asio_dtime_three.cpp: An asynchronous TCP daytime server
 //
 // This tutorial program shows how to use asio
-// to implement a server application with TCP
+// to implement a server application with TCP.
+// It can also push the time to subscribers once per second
 
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Logger.h"
 
 using boost::asio::ip::tcp;
 
@@ -27,7 +31,7 @@ std::string make_daytime_string()
 	ss.imbue(std::locale(std::locale::classic(), facet));
 	ss << utc; // Thursday, March 22, 2018 13:00:53-UTC
 
-	std::cout << ss.str() << std::endl;
+	Log(Logger::Info, ss.str()); // queued, written by the logger thread
 	return ss.str();
 }
 
@@ -138,16 +142,219 @@ private:
 	tcp::acceptor acceptor_;
 };
 
-int main()
+// In the feed mode a connection is not closed after the first string.
+// The subscribers stay connected and one server-wide timer pushes the
+// daytime string to all of them once per second. The string of a tick
+// is made once and shared by all writes, and a subscriber whose previous
+// write has not completed yet skips the tick instead of queueing it, so
+// the memory used per subscriber does not depend on how slow it reads
+
+class time_feed;
+
+class feed_subscriber
+	: public boost::enable_shared_from_this<feed_subscriber>
+{
+public:
+	typedef boost::shared_ptr<feed_subscriber> pointer;
+	typedef boost::shared_ptr<const std::string> tick_pointer;
+
+	static pointer create(boost::asio::io_context& io_context, time_feed& feed)
+	{
+		return pointer(new feed_subscriber(io_context, feed));
+	}
+
+	tcp::socket& socket()
+	{
+		return socket_;
+	}
+
+	void start();
+	bool deliver(const tick_pointer& tick); // false if the tick is skipped
+
+	std::size_t index; // the position in the subscriber list of time_feed
+
+private:
+	feed_subscriber(boost::asio::io_context& io_context, time_feed& feed)
+		: index(0), socket_(io_context), feed_(feed)
+	{
+	}
+
+	void handle_write(const boost::system::error_code& error);
+	void handle_read(const boost::system::error_code& error);
+	void stop();
+
+	tcp::socket socket_;
+	time_feed& feed_;
+	tick_pointer tick_; // the tick being written, empty if no write is in progress
+	char read_buffer_[1]; // only used to detect that the client has gone
+};
+
+class time_feed
+{
+public:
+	time_feed(boost::asio::io_context& io_context, std::size_t max_subscribers)
+		: timer_(io_context), max_subscribers_(max_subscribers)
+	{
+		// The ticks are aligned to the whole second
+		timer_.expires_at(boost::posix_time::second_clock::universal_time() +
+			boost::posix_time::seconds(1));
+		timer_.async_wait(boost::bind(&time_feed::tick, this,
+			boost::asio::placeholders::error));
+	}
+
+	bool subscribe(const feed_subscriber::pointer& subscriber)
+	{
+		if (subscribers_.size() >= max_subscribers_)
+			return false; // the memory used by the feed is bounded
+
+		subscriber->index = subscribers_.size();
+		subscribers_.push_back(subscriber);
+		return true;
+	}
+
+	void unsubscribe(feed_subscriber* subscriber)
+	{
+		// Swap with the last subscriber to remove in O(1)
+		const std::size_t i = subscriber->index;
+		if (i >= subscribers_.size() || subscribers_[i].get() != subscriber)
+			return; // already removed
+
+		subscribers_[i] = subscribers_.back();
+		subscribers_[i]->index = i;
+		subscribers_.pop_back();
+	}
+
+private:
+	void tick(const boost::system::error_code& error)
+	{
+		if (error) return;
+
+		const feed_subscriber::tick_pointer tick(
+			new std::string(make_daytime_string() + "\r\n"));
+
+		// The handlers of the writes are never called from
+		// deliver(), so the list can't change while iterating
+		std::size_t skipped = 0;
+		for (std::size_t i = 0; i < subscribers_.size(); ++i)
+			if (!subscribers_[i]->deliver(tick)) ++skipped;
+
+		if (skipped)
+			Log(Logger::Debug, "feed: " + boost::lexical_cast<std::string>(subscribers_.size()) +
+				" subscribers, " + boost::lexical_cast<std::string>(skipped) + " slow readers skipped");
+
+		// Calculate the new expiry time relative to the old one
+		// so the feed does not drift away from the whole second
+		timer_.expires_at(timer_.expires_at() + boost::posix_time::seconds(1));
+		timer_.async_wait(boost::bind(&time_feed::tick, this,
+			boost::asio::placeholders::error));
+	}
+
+	boost::asio::deadline_timer timer_;
+	std::vector<feed_subscriber::pointer> subscribers_;
+	std::size_t max_subscribers_;
+};
+
+void feed_subscriber::start()
+{
+	// Nothing is expected from the client, the read
+	// completes with an error when the connection is closed
+	socket_.async_read_some(boost::asio::buffer(read_buffer_),
+		boost::bind(&feed_subscriber::handle_read, shared_from_this(),
+		boost::asio::placeholders::error));
+}
+
+bool feed_subscriber::deliver(const tick_pointer& tick)
+{
+	if (tick_) return false; // a slow reader, the previous tick is still being written
+
+	tick_ = tick; // keeps the shared string alive until handle_write()
+	boost::asio::async_write(socket_, boost::asio::buffer(*tick_),
+		boost::bind(&feed_subscriber::handle_write, shared_from_this(),
+		boost::asio::placeholders::error));
+	return true;
+}
+
+void feed_subscriber::handle_write(const boost::system::error_code& error)
+{
+	tick_.reset();
+	if (error) stop();
+}
+
+void feed_subscriber::handle_read(const boost::system::error_code& error)
+{
+	if (error) stop(); // the client has closed the connection
+	else start();
+}
+
+void feed_subscriber::stop()
+{
+	boost::system::error_code ignored_error;
+	socket_.close(ignored_error);
+	feed_.unsubscribe(this);
+}
+
+// The feed_server accepts subscribers in the same way as
+// tcp_server accepts connections, but hands them to the feed
+class feed_server
+{
+public:
+	feed_server(boost::asio::io_context& io_context,
+		unsigned short port, std::size_t max_subscribers)
+		: acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
+		feed_(io_context, max_subscribers)
+	{
+		start_accept();
+	}
+
+private:
+	void start_accept()
+	{
+		feed_subscriber::pointer new_subscriber =
+			feed_subscriber::create(acceptor_.get_executor().context(), feed_);
+
+		acceptor_.async_accept(new_subscriber->socket(),
+			boost::bind(&feed_server::handle_accept, this, new_subscriber,
+			boost::asio::placeholders::error));
+	}
+
+	void handle_accept(feed_subscriber::pointer new_subscriber,
+		const boost::system::error_code& error)
+	{
+		if (!error)
+		{
+			if (feed_.subscribe(new_subscriber))
+				new_subscriber->start();
+			// else the subscriber is released and the connection closed
+		}
+
+		start_accept();
+	}
+
+	tcp::acceptor acceptor_;
+	time_feed feed_;
+};
+
+int main(int argc, char* argv[])
 {
 	try
 	{
+		Logger::Instance().Start(); // the requests are logged asynchronously
+
 		// We need to create a server object to accept incoming client
 		// connections. The boost::asio::io_context object provides I/O
 		// services, such as sockets, that the server object will use
 		boost::asio::io_context io_context;
 		tcp_server server(io_context);
 
+		// The feed mode is enabled by the port to accept the subscribers
+		// on, the second argument limits the number of subscribers
+		boost::scoped_ptr<feed_server> feed;
+		if (argc > 1)
+			feed.reset(new feed_server(io_context,
+				boost::lexical_cast<unsigned short>(argv[1]),
+				argc > 2 ? boost::lexical_cast<std::size_t>(argv[2]) : 200000));
+		else std::cerr << "Usage: asio_dtime_three [feed port [max subscribers]]" << std::endl;
+
 		io_context.run(); // Run the boost::asio::io_service object so
 		// that it will perform asynchronous operations on your behalf
 	}
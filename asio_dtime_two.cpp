@@ -6,6 +6,7 @@
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Logger.h"
 
 using boost::asio::ip::tcp;
 
@@ -24,7 +25,7 @@ std::string make_daytime_string()
 	ss.imbue(std::locale(std::locale::classic(), facet));
 	ss << utc; // Thursday, March 22, 2018 13:00:53-UTC
 
-	std::cout << ss.str() << std::endl;
+	Log(Logger::Info, ss.str()); // queued, written by the logger thread
 	return ss.str();
 }
 
@@ -32,6 +33,8 @@ int main()
 {
 	try
 	{
+		Logger::Instance().Start(); // the requests are logged asynchronously
+
 		boost::asio::io_context io_context;		// All programs that use
 		// asio need to have at least one boost::asio::io_service object
 
@@ -0,0 +1,245 @@
+// asio_timer_eight.cpp: When does a strand become the bottleneck?
+//
+// The printer of Timer 5 runs the handlers of its two timers through one
+// strand, so they can share a counter safely while two threads call run().
+// This program scales that pattern to N timers and M threads and compares
+// three ways to update the shared state from the handlers:
+//
+//   strand  - every handler goes through one strand, as in Timer 5
+//   mutex   - the handlers run free and lock a mutex around the update
+//   sharded - the handlers run free and add to a ShardedCounter, which
+//             keeps a shard per thread and sums the shards on read
+//
+// For every mode and number of threads it reports the handlers run per
+// second, how late they ran, and for the strand the time a handler waited
+// in the strand's queue between the completion of its timer and its run
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Executor.h"
+#include "serial_port/Histogram.h"
+#include "serial_port/ShardedCounter.h"
+
+typedef boost::chrono::steady_clock clock_type;
+
+enum mode { strand_mode, mutex_mode, sharded_mode };
+
+boost::int64_t microseconds_since(clock_type::time_point t)
+{
+	return boost::chrono::duration_cast<boost::chrono::microseconds>(clock_type::now() - t).count();
+}
+
+// The histograms are filled by every thread into its own copy, so the
+// measurement itself is neither serialised nor shared between threads
+class thread_histograms
+{
+public:
+	struct histograms { Histogram late, wait; };
+
+	thread_histograms() : local_(&thread_histograms::keep) {}
+
+	histograms& local()
+	{
+		histograms* h = local_.get();
+		if (!h) {
+			boost::mutex::scoped_lock lock(mutex_);
+			all_.push_back(boost::shared_ptr<histograms>(new histograms));
+			h = all_.back().get();
+			local_.reset(h);
+		}
+		return *h;
+	}
+
+	histograms merged()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		histograms result;
+		for (std::size_t i = 0; i < all_.size(); ++i) {
+			result.late.Merge(all_[i]->late);
+			result.wait.Merge(all_[i]->wait);
+		}
+		return result;
+	}
+
+private:
+	static void keep(histograms*) {} // owned by all_, not by the thread
+
+	boost::thread_specific_ptr<histograms> local_;
+	boost::mutex mutex_;
+	std::vector<boost::shared_ptr<histograms> > all_;
+};
+
+// The state shared by all the timers of a run, the update is a counter
+// and some work done with it, as the handlers of a real program would do
+struct shared_state
+{
+	shared_state(boost::asio::io_context& io, mode m, int work)
+		: strand(io), how(m), work(work), count(0) {}
+
+	boost::asio::io_context::strand strand;
+	const mode how;
+	const int work; // iterations of the update
+
+	boost::mutex mutex;
+	boost::uint64_t count; // the strand and the mutex modes
+	ShardedCounter sharded; // the sharded mode
+
+	thread_histograms stats;
+	clock_type::time_point end;
+
+	void update()
+	{
+		volatile boost::uint64_t x = 0;
+		for (int i = 0; i < work; ++i) x = x + i;
+	}
+
+	boost::uint64_t total()
+	{
+		if (how == sharded_mode) return sharded.Load();
+		boost::mutex::scoped_lock lock(mutex);
+		return count;
+	}
+};
+
+class ticker
+{
+public:
+	ticker(boost::asio::io_context& io, shared_state& state, boost::posix_time::time_duration period)
+		: timer_(io), state_(state), period_(period)
+	{
+		timer_.expires_from_now(period_);
+		expiry_ = clock_type::now() + boost::chrono::microseconds(period_.total_microseconds());
+		start_wait();
+	}
+
+private:
+	void start_wait()
+	{
+		// The completion is not bound to the strand, it dispatches the handler
+		// to the strand itself, so the time spent in the queue can be measured
+		timer_.async_wait(boost::bind(&ticker::completed, this, boost::asio::placeholders::error));
+	}
+
+	void completed(const boost::system::error_code& error)
+	{
+		if (error) return;
+
+		if (state_.how == strand_mode)
+			state_.strand.dispatch(boost::bind(&ticker::handle, this, clock_type::now()));
+		else
+			handle(clock_type::now());
+	}
+
+	void handle(clock_type::time_point completed)
+	{
+		thread_histograms::histograms& h = state_.stats.local();
+		h.wait.Record(microseconds_since(completed));
+		h.late.Record(std::max<boost::int64_t>(0, microseconds_since(expiry_)));
+
+		switch (state_.how)
+		{
+		case strand_mode: // serialised by the strand
+			++state_.count;
+			state_.update();
+			break;
+		case mutex_mode: {
+			boost::mutex::scoped_lock lock(state_.mutex);
+			++state_.count;
+			state_.update();
+			break; }
+		case sharded_mode: // each thread on its own shard
+			state_.sharded.Add();
+			state_.update();
+			break;
+		}
+
+		if (clock_type::now() >= state_.end) return;
+
+		// Drift free, as in Timer 5; a late handler is followed at once by the next one
+		timer_.expires_at(timer_.expires_at() + period_);
+		expiry_ += boost::chrono::microseconds(period_.total_microseconds());
+		start_wait();
+	}
+
+	boost::asio::deadline_timer timer_;
+	shared_state& state_;
+	const boost::posix_time::time_duration period_;
+	clock_type::time_point expiry_;
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::vector<int> threads;
+		int timers, period_us, work, seconds;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("timers,n", boost::program_options::value<int>(&timers)->default_value(1000), "number of timers")
+			("threads,t", boost::program_options::value<std::vector<int> >(&threads)->multitoken(),
+				"numbers of threads to try (1 2 4 ... up to twice the number of CPUs by default)")
+			("period,p", boost::program_options::value<int>(&period_us)->default_value(1000), "period of every timer, microseconds")
+			("work,w", boost::program_options::value<int>(&work)->default_value(100), "iterations of the update of the shared state")
+			("seconds,s", boost::program_options::value<int>(&seconds)->default_value(3), "duration of every run");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		if (threads.empty())
+			for (unsigned int t = 1; t <= 2 * std::max(1U, boost::thread::hardware_concurrency()); t *= 2)
+				threads.push_back(t);
+
+		std::cout << timers << " timers, period " << period_us << " us, demand "
+			<< 1e6 / period_us * timers << " handlers/s, work " << work << std::endl << std::endl
+			<< "   mode  threads  handlers/s   late p50    p99 us   wait p50    p99 us" << std::endl;
+
+		const char* names[] = { "strand", "mutex", "sharded" };
+		for (int m = strand_mode; m <= sharded_mode; ++m)
+			for (std::size_t t = 0; t < threads.size(); ++t)
+			{
+				Executor e;
+				shared_state state(e.GetIOContext(), static_cast<mode>(m), work);
+				state.end = clock_type::now() + boost::chrono::seconds(seconds);
+
+				std::vector<boost::shared_ptr<ticker> > tickers;
+				for (int i = 0; i < timers; ++i)
+					tickers.push_back(boost::shared_ptr<ticker>(new ticker(e.GetIOContext(),
+						state, boost::posix_time::microseconds(period_us))));
+
+				const clock_type::time_point start = clock_type::now();
+				e.Run(threads[t]);
+				const double elapsed = boost::chrono::duration<double>(clock_type::now() - start).count();
+
+				const thread_histograms::histograms h = state.stats.merged();
+				std::cout << std::setw(7) << names[m] << std::setw(9) << threads[t]
+					<< std::setw(12) << static_cast<boost::uint64_t>(state.total() / elapsed)
+					<< std::setw(11) << h.late.Percentile(50) << std::setw(10) << h.late.Percentile(99)
+					<< std::setw(11) << h.wait.Percentile(50) << std::setw(10) << h.wait.Percentile(99)
+					<< std::endl;
+			}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
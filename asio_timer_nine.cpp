@@ -0,0 +1,144 @@
+// asio_timer_nine.cpp: Coalescing periodic jobs with slack
+//
+// Status polls and statistics flushes don't have to run on the exact
+// microsecond. This program runs a number of such periodic jobs with the
+// CoalescingTimer of CoalescingTimer.h: every job asks for its period and
+// tolerates a slack of some percent of it, and the coalescer runs the jobs
+// whose windows overlap in one wake-up. Every second it prints the jobs
+// run, the wake-ups of the reactor and the wake-ups saved. A wake-up runs
+// every job that is due by then, even with --slack 0, as the reactor does
+// for the deadline_timers that have expired, so the savings with --slack 0
+// are the baseline that the slack is measured against
+
+#include <iostream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/CoalescingTimer.h"
+
+class periodic_job
+{
+public:
+	periodic_job(TimerCoalescer& coalescer, boost::posix_time::time_duration period,
+		boost::posix_time::time_duration slack)
+		: timer_(coalescer), period_(period), slack_(slack)
+	{
+		schedule();
+	}
+
+	void stop() { timer_.cancel(); }
+
+private:
+	void schedule()
+	{
+		timer_.expires_from_now(period_, slack_);
+		timer_.async_wait(boost::bind(&periodic_job::run, this, boost::asio::placeholders::error));
+	}
+
+	void run(const boost::system::error_code& error)
+	{
+		if (error) return; // stopped
+
+		// The work of a poll or a flush would be done here
+		schedule();
+	}
+
+	CoalescingTimer timer_;
+	const boost::posix_time::time_duration period_, slack_;
+};
+
+class reporter
+{
+public:
+	reporter(boost::asio::io_context& io, TimerCoalescer& coalescer,
+		std::vector<boost::shared_ptr<periodic_job> >& jobs, int seconds)
+		: timer_(io, boost::posix_time::seconds(1)), coalescer_(coalescer),
+		jobs_(jobs), seconds_(seconds), elapsed_(0)
+	{
+		timer_.async_wait(boost::bind(&reporter::report, this));
+	}
+
+private:
+	void report()
+	{
+		const TimerCoalescer::Counters counters = coalescer_.GetCounters();
+		std::cout << "jobs run: " << counters.fired - last_.fired
+			<< ", wake-ups: " << counters.wakeups - last_.wakeups
+			<< ", wake-ups saved: " << counters.WakeupsSaved() - last_.WakeupsSaved()
+			<< " per second" << std::endl;
+		last_ = counters;
+
+		if (++elapsed_ < seconds_) {
+			timer_.expires_at(timer_.expires_at() + boost::posix_time::seconds(1));
+			timer_.async_wait(boost::bind(&reporter::report, this));
+		}
+		else // run() returns when the jobs are stopped
+			for (std::size_t i = 0; i < jobs_.size(); ++i) jobs_[i]->stop();
+	}
+
+	boost::asio::deadline_timer timer_;
+	TimerCoalescer& coalescer_;
+	std::vector<boost::shared_ptr<periodic_job> >& jobs_;
+	const int seconds_;
+	int elapsed_;
+	TimerCoalescer::Counters last_;
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		int jobs, min_ms, max_ms, seconds;
+		double slack;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("jobs,n", boost::program_options::value<int>(&jobs)->default_value(200), "number of periodic jobs")
+			("min", boost::program_options::value<int>(&min_ms)->default_value(50), "shortest period, milliseconds")
+			("max", boost::program_options::value<int>(&max_ms)->default_value(1000), "longest period, milliseconds")
+			("slack", boost::program_options::value<double>(&slack)->default_value(10), "slack, percent of the period")
+			("seconds,s", boost::program_options::value<int>(&seconds)->default_value(5), "duration");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		boost::asio::io_context io;
+		TimerCoalescer coalescer(io);
+
+		boost::random::mt19937 random(1);
+		boost::random::uniform_int_distribution<int> period(min_ms, max_ms);
+
+		std::vector<boost::shared_ptr<periodic_job> > periodic;
+		for (int i = 0; i < jobs; ++i)
+		{
+			const int ms = period(random);
+			periodic.push_back(boost::shared_ptr<periodic_job>(new periodic_job(coalescer,
+				boost::posix_time::milliseconds(ms), boost::posix_time::microseconds(
+				static_cast<boost::int64_t>(ms * slack * 10))))); // ms * 1000 * slack / 100
+		}
+
+		reporter r(io, coalescer, periodic, seconds);
+		io.run();
+
+		const TimerCoalescer::Counters counters = coalescer.GetCounters();
+		std::cout << "total: " << counters.fired << " jobs run, " << counters.wakeups
+			<< " wake-ups, " << counters.WakeupsSaved() << " saved" << std::endl;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
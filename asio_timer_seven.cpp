@@ -0,0 +1,212 @@
+// asio_timer_seven.cpp: Measuring the jitter and the drift of periodic timers
+//
+// The timers of the earlier tutorials re-arm themselves with
+// expires_at(expires_at() + period), so the errors don't add up. This
+// program measures how late the handlers of such periodic timers really
+// are, at rates from 1 Hz to 10 kHz, while the io_context is run by the
+// thread pool of an Executor. Load can be added: busy threads competing
+// for the CPU, and work done inside every handler. For every rate it
+// reports the lateness histogram, the periods missed because a handler
+// was later than one period, and the drift accumulated over the run,
+// which is what the replay of a capture depends on
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Executor.h"
+#include "serial_port/Histogram.h"
+
+typedef boost::chrono::steady_clock clock_type;
+
+// Spin for the given time, the work of a handler or of a load thread
+void burn(boost::chrono::microseconds duration)
+{
+	const clock_type::time_point end = clock_type::now() + duration;
+	while (clock_type::now() < end) {}
+}
+
+// One periodic timer. Its handlers never run concurrently, as there is only
+// one wait at a time, so the statistics need no lock and are merged at the end
+class periodic_timer
+{
+public:
+	periodic_timer(boost::asio::io_context& io, boost::posix_time::time_duration period,
+		boost::posix_time::time_duration duration, bool absolute, boost::chrono::microseconds work)
+		: timer_(io), period_(period), absolute_(absolute), work_(work),
+		fired_(0), missed_(0)
+	{
+		// The deadline_timer runs on the wall clock, so does the measurement
+		start_ = boost::posix_time::microsec_clock::universal_time();
+		end_ = start_ + duration;
+		scheduled_ = start_ + period_;
+
+		timer_.expires_at(scheduled_);
+		timer_.async_wait(boost::bind(&periodic_timer::tick, this, boost::asio::placeholders::error));
+	}
+
+	const Histogram& lateness() const { return lateness_; } // microseconds
+	unsigned long fired() const { return fired_; }
+	unsigned long missed() const { return missed_; }
+
+	// How far the last handler was from the ideal schedule of
+	// start + n * period, where n is the number of periods run
+	double drift_us() const
+	{
+		return double((last_ - start_).total_microseconds()) -
+			double((fired_ + missed_) * period_.total_microseconds());
+	}
+
+	double elapsed_us() const { return double((last_ - start_).total_microseconds()); }
+
+private:
+	void tick(const boost::system::error_code& error)
+	{
+		if (error) return;
+
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		const boost::int64_t late = (now - scheduled_).total_microseconds();
+		lateness_.Record(late > 0 ? late : 0);
+
+		++fired_;
+		last_ = now;
+
+		if (work_.count() > 0)
+			burn(work_);
+
+		if (now >= end_) return; // the run is over
+
+		if (absolute_) {
+			// The next period starts where this one should have ended. A handler
+			// later than a whole period skips the periods already gone, instead
+			// of firing a burst of handlers to catch up
+			scheduled_ += period_;
+			const boost::posix_time::ptime after = boost::posix_time::microsec_clock::universal_time();
+			if (scheduled_ <= after) {
+				const boost::int64_t behind = (after - scheduled_).total_microseconds() / period_.total_microseconds() + 1;
+				missed_ += static_cast<unsigned long>(behind);
+				scheduled_ += period_ * static_cast<int>(behind);
+			}
+			timer_.expires_at(scheduled_);
+		}
+		else {
+			// The naive way: every error is added to the next period
+			timer_.expires_from_now(period_);
+			scheduled_ = timer_.expires_at();
+		}
+
+		timer_.async_wait(boost::bind(&periodic_timer::tick, this, boost::asio::placeholders::error));
+	}
+
+	boost::asio::deadline_timer timer_;
+	const boost::posix_time::time_duration period_;
+	const bool absolute_;
+	const boost::chrono::microseconds work_;
+
+	boost::posix_time::ptime start_, end_, scheduled_, last_;
+	Histogram lateness_;
+	unsigned long fired_, missed_;
+};
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::vector<double> rates;
+		int timers, seconds, threads, load_threads, work_us;
+		bool relative;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("rate,r", boost::program_options::value<std::vector<double> >(&rates)->multitoken(),
+				"rates to measure, Hz (1 10 100 1000 10000 by default)")
+			("timers,n", boost::program_options::value<int>(&timers)->default_value(1), "timers per rate, run in parallel")
+			("seconds,s", boost::program_options::value<int>(&seconds)->default_value(5), "duration of every rate")
+			("threads,t", boost::program_options::value<int>(&threads)->default_value(-1), "threads of the Executor (-1 == number of CPUs)")
+			("load", boost::program_options::value<int>(&load_threads)->default_value(0), "busy threads competing for the CPU")
+			("work", boost::program_options::value<int>(&work_us)->default_value(0), "work done by every handler, microseconds")
+			("relative", boost::program_options::bool_switch(&relative), "re-arm with expires_from_now(period) instead of expires_at() + period");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		if (rates.empty()) {
+			const double defaults[] = { 1, 10, 100, 1000, 10000 };
+			rates.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+		}
+
+		// The load threads spin until the end of the program
+		boost::atomic<bool> stop(false);
+		boost::thread_group load;
+		for (int i = 0; i < load_threads; ++i)
+			load.create_thread([&stop] { while (!stop) burn(boost::chrono::microseconds(1000)); });
+
+		std::cout << (relative ? "expires_from_now(period)" : "expires_at() + period") << ", "
+			<< timers << " timer(s) per rate, " << load_threads << " load thread(s), "
+			<< work_us << " us of work per handler" << std::endl << std::endl
+			<< "    rate Hz     fired  missed   late p50    p99   p999    max us    drift us  drift ppm" << std::endl;
+
+		for (std::size_t r = 0; r < rates.size(); ++r)
+		{
+			const boost::posix_time::time_duration period =
+				boost::posix_time::microseconds(static_cast<boost::int64_t>(1e6 / rates[r]));
+
+			// A new Executor for every rate, its Run() returns when the timers are over
+			Executor e;
+			std::vector<boost::shared_ptr<periodic_timer> > periodic;
+			for (int i = 0; i < timers; ++i)
+				periodic.push_back(boost::shared_ptr<periodic_timer>(new periodic_timer(e.GetIOContext(),
+					period, boost::posix_time::seconds(seconds), !relative, boost::chrono::microseconds(work_us))));
+
+			e.Run(threads);
+
+			Histogram lateness;
+			unsigned long fired = 0, missed = 0;
+			double drift = 0, elapsed = 0;
+			for (std::size_t i = 0; i < periodic.size(); ++i)
+			{
+				lateness.Merge(periodic[i]->lateness());
+				fired += periodic[i]->fired();
+				missed += periodic[i]->missed();
+
+				// The worst drift of the timers is reported
+				if (std::abs(periodic[i]->drift_us()) >= std::abs(drift)) {
+					drift = periodic[i]->drift_us();
+					elapsed = periodic[i]->elapsed_us();
+				}
+			}
+
+			std::cout.unsetf(std::ios::floatfield);
+			std::cout << std::setprecision(6) << std::setw(11) << rates[r] << std::setw(10) << fired << std::setw(8) << missed
+				<< std::setw(11) << lateness.Percentile(50) << std::setw(7) << lateness.Percentile(99)
+				<< std::setw(7) << lateness.Percentile(99.9) << std::setw(10) << lateness.Max()
+				<< std::fixed << std::setprecision(0) << std::setw(12) << drift
+				<< std::setw(11) << std::setprecision(1) << (elapsed > 0 ? drift / elapsed * 1e6 : 0)
+				<< std::endl;
+		}
+
+		stop = true;
+		load.join_all();
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+// asio_timer_six.cpp: A timer wheel against deadline_timer
+//
+// This program arms a large number of timers, re-arms every one of them
+// several times (as a server does with the deadline of a connection on
+// every request) and waits for all of them to expire. The same work is
+// done with boost::asio::deadline_timer, whose queue is a heap with
+// O(log n) insertion and removal, and with the WheelTimer of TimerWheel.h,
+// where both are O(1). The time per operation and the lateness of the
+// expired handlers are reported for both
+
+#include <iostream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "serial_port/Histogram.h"
+#include "serial_port/TimerWheel.h"
+
+typedef boost::chrono::steady_clock clock_type;
+
+// The expiry time of every timer is remembered, the handler
+// records how late it was called, or counts the cancellation
+struct timer_stats
+{
+	std::vector<clock_type::time_point> expiry;
+	clock_type::time_point armed; // the end of the arming, nothing runs on time before it
+	Histogram lateness; // microseconds
+	unsigned long fired, aborted;
+
+	explicit timer_stats(std::size_t count)
+		: expiry(count), armed(clock_type::time_point::max()), fired(0), aborted(0) {}
+
+	void on_timer(std::size_t index, const boost::system::error_code& error)
+	{
+		if (error == boost::asio::error::operation_aborted) { ++aborted; return; }
+
+		++fired;
+		if (expiry[index] < armed) return; // expired while the timers were being armed
+
+		const clock_type::duration late = clock_type::now() - expiry[index];
+		lateness.Record(std::max<boost::int64_t>(0,
+			boost::chrono::duration_cast<boost::chrono::microseconds>(late).count()));
+	}
+};
+
+// The timers of both kinds are created from the object they
+// belong to: an io_context for deadline_timer, a TimerWheel for
+// WheelTimer. The rest of the code does not see the difference
+template <typename Timer, typename Owner>
+void benchmark(const char* name, boost::asio::io_context& io, Owner& owner,
+	std::size_t count, int resets, int max_ms, unsigned int seed)
+{
+	boost::random::mt19937 random(seed);
+	boost::random::uniform_int_distribution<int> timeout(1, max_ms);
+
+	std::vector<boost::shared_ptr<Timer> > timers;
+	timers.reserve(count);
+	for (std::size_t i = 0; i < count; ++i)
+		timers.push_back(boost::shared_ptr<Timer>(new Timer(owner)));
+
+	timer_stats stats(count);
+	const clock_type::time_point start = clock_type::now();
+
+	// Every round re-arms all the timers, the previous waits are cancelled
+	// and their handlers are run by poll() before the next round
+	for (int round = 0; round <= resets; ++round)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const int ms = timeout(random);
+			stats.expiry[i] = clock_type::now() + boost::chrono::milliseconds(ms);
+			timers[i]->expires_from_now(boost::posix_time::milliseconds(ms));
+			timers[i]->async_wait(boost::bind(&timer_stats::on_timer, &stats,
+				i, boost::asio::placeholders::error));
+		}
+
+		io.poll();
+	}
+
+	const clock_type::time_point armed = stats.armed = clock_type::now();
+	io.run(); // until all the handlers have been called
+	io.restart();
+	const clock_type::time_point done = clock_type::now();
+
+	const double arm_ns = boost::chrono::duration<double, boost::nano>(armed - start).count() / (count * (resets + 1));
+
+	std::cout << name << ": " << arm_ns << " ns per expires_from_now + async_wait, "
+		<< boost::chrono::duration<double>(done - start).count() << " s in total" << std::endl
+		<< "  fired " << stats.fired << ", cancelled " << stats.aborted
+		<< ", late by, us (of " << stats.lateness.Count() << " due after the arming): p50 " << stats.lateness.Percentile(50)
+		<< ", p99 " << stats.lateness.Percentile(99)
+		<< ", max " << stats.lateness.Max() << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::size_t count;
+		int resets, max_ms, resolution;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("count,n", boost::program_options::value<std::size_t>(&count)->default_value(200000), "number of timers")
+			("resets,r", boost::program_options::value<int>(&resets)->default_value(4), "re-arms of every timer before it expires")
+			("max", boost::program_options::value<int>(&max_ms)->default_value(2000), "longest timeout, milliseconds")
+			("resolution", boost::program_options::value<int>(&resolution)->default_value(1000), "tick of the wheel, microseconds");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		boost::asio::io_context io;
+
+		benchmark<boost::asio::deadline_timer>("deadline_timer", io, io, count, resets, max_ms, 1);
+
+		TimerWheel wheel(io, boost::posix_time::microseconds(resolution));
+		benchmark<WheelTimer>("WheelTimer", io, wheel, count, resets, max_ms, 1);
+
+		const TimerWheel::Counters counters = wheel.GetCounters();
+		std::cout << "  wheel: " << counters.ticks << " ticks, "
+			<< counters.cascaded << " timers moved between wheels" << std::endl;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,790 @@
+#include "Capture.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/bind.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#if defined(BOOST_WINDOWS)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char *const Signature = "SERCAP"; // the first word of the file
+	const unsigned int Version = 1;
+
+	const boost::uint32_t BlockMagic = 0x43424C31; // "CBL1"
+	enum BlockFlags { Zlib = 1 };
+
+	// Block header: magic, flags, stored and raw size of the data, records,
+	// reserved, first and last time; big-endian, as the other binary formats
+	enum { BlockHeaderSize = 40, IndexEntrySize = 16 };
+
+	struct BlockHeader
+	{
+		boost::uint32_t flags, stored, raw, records;
+		boost::uint64_t first, last;
+	};
+
+	void Put(unsigned char *p, boost::uint64_t v, int bytes)
+	{
+		for (int i = bytes - 1; i >= 0; --i, v >>= 8) p[i] = static_cast<unsigned char>(v);
+	}
+
+	boost::uint64_t Get(const unsigned char *p, int bytes)
+	{
+		boost::uint64_t v = 0;
+		for (int i = 0; i < bytes; ++i) v = (v << 8) | p[i];
+		return v;
+	}
+
+	void EncodeHeader(const BlockHeader &h, unsigned char *p)
+	{
+		Put(p, BlockMagic, 4); Put(p + 4, h.flags, 4); Put(p + 8, h.stored, 4); Put(p + 12, h.raw, 4);
+		Put(p + 16, h.records, 4); Put(p + 20, 0, 4); Put(p + 24, h.first, 8); Put(p + 32, h.last, 8);
+	}
+
+	bool ReadHeader(std::istream &in, BlockHeader &h)
+	{
+		unsigned char p[BlockHeaderSize];
+		if (!in.read(reinterpret_cast<char *>(p), BlockHeaderSize) || Get(p, 4) != BlockMagic)
+			return false; // the end of the file, or a block cut short by a crash
+
+		h.flags = boost::uint32_t(Get(p + 4, 4)); h.stored = boost::uint32_t(Get(p + 8, 4));
+		h.raw = boost::uint32_t(Get(p + 12, 4)); h.records = boost::uint32_t(Get(p + 16, 4));
+		h.first = Get(p + 24, 8); h.last = Get(p + 32, 8);
+		return true;
+	}
+
+	std::string IndexName(const std::string &fileName) { return fileName + ".idx"; }
+
+	std::string Compress(const std::string &data)
+	{
+		std::string result;
+		boost::iostreams::filtering_ostream out;
+		out.push(boost::iostreams::zlib_compressor());
+		out.push(boost::iostreams::back_inserter(result));
+		out.write(data.data(), data.size());
+		out.reset(); // flushes the compressor
+		return result;
+	}
+
+	std::string Decompress(const std::string &data, std::size_t size)
+	{
+		std::string result;
+		result.reserve(size);
+		boost::iostreams::filtering_istream in;
+		in.push(boost::iostreams::zlib_decompressor());
+		in.push(boost::iostreams::array_source(data.data(), data.size()));
+		boost::iostreams::copy(in, boost::iostreams::back_inserter(result));
+
+		if (result.size() != size)
+			throw std::runtime_error("Corrupt capture block");
+		return result;
+	}
+}
+
+// The data file of a segment, written through an aligned buffer with
+// positioned writes. The direct I/O needs the offsets, the sizes and the
+// memory of the writes aligned to sectors: a tail shorter than a sector is
+// padded with zeros and written again, with the data that follows it, by
+// the next write. The padding is cut off when the file is closed; after a
+// crash the readers take the zeros for the end of the capture
+class CaptureFile : private boost::noncopyable
+{
+	public:
+		CaptureFile(const std::string &fileName, bool direct, boost::uint64_t preallocate)
+			: direct_(direct), extended_(false), storage_(BufferSize + Alignment),
+			used_(0), bufferOffset_(0), size_(0)
+		{
+			buffer_ = &storage_[0] + (Alignment - reinterpret_cast<std::size_t>(&storage_[0]) % Alignment) % Alignment;
+
+#if defined(BOOST_WINDOWS)
+			handle_ = ::CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL | (direct_ ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0), 0);
+			if (handle_ == INVALID_HANDLE_VALUE)
+				Fail("Can't create the capture " + fileName, ::GetLastError());
+
+			if (preallocate > 0) { // the end of the file is moved back by Close()
+				LARGE_INTEGER end;
+				end.QuadPart = static_cast<LONGLONG>(preallocate);
+				extended_ = ::SetFilePointerEx(handle_, end, 0, FILE_BEGIN) && ::SetEndOfFile(handle_);
+			}
+#else
+			int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+			if (direct_) flags |= O_DIRECT;
+#else
+			direct_ = false;
+#endif
+			fd_ = ::open(fileName.c_str(), flags, 0644);
+#if defined(O_DIRECT)
+			if (fd_ < 0 && direct_ && errno == EINVAL) { // tmpfs and the like don't have it
+				direct_ = false;
+				fd_ = ::open(fileName.c_str(), flags & ~O_DIRECT, 0644);
+			}
+#endif
+			if (fd_ < 0)
+				Fail("Can't create the capture " + fileName, errno);
+
+#if defined(__linux__)
+			// The size of the file doesn't change, but the blocks past it stay
+			// allocated until Close() truncates them; only a hint, a failure
+			// doesn't matter
+			if (preallocate > 0)
+				extended_ = ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(preallocate)) == 0;
+#endif
+#endif
+		}
+
+		~CaptureFile()
+		{
+			try { Close(); }
+			catch (const std::exception &) {}
+		}
+
+		void Write(const void *data, std::size_t size)
+		{
+			const char *p = static_cast<const char *>(data);
+			while (size > 0) {
+				const std::size_t n = std::min(size, std::size_t(BufferSize) - used_);
+				std::memcpy(buffer_ + used_, p, n);
+				used_ += n; size_ += n;
+				p += n; size -= n;
+
+				if (used_ == BufferSize) Flush();
+			}
+		}
+
+		void Flush() // to the file system, not to the disk
+		{
+			if (used_ == 0) return;
+
+			if (!direct_) {
+				WriteAt(bufferOffset_, buffer_, used_);
+				bufferOffset_ += used_;
+				used_ = 0;
+				return;
+			}
+
+			const std::size_t padded = (used_ + Alignment - 1) / Alignment * Alignment;
+			std::memset(buffer_ + used_, 0, padded - used_);
+			WriteAt(bufferOffset_, buffer_, padded);
+
+			const std::size_t whole = used_ / Alignment * Alignment; // the tail is kept
+			std::memmove(buffer_, buffer_ + whole, used_ - whole);
+			bufferOffset_ += whole;
+			used_ -= whole;
+		}
+
+		void Close()
+		{
+			if (!IsOpen()) return;
+
+			Flush();
+			if (direct_ || extended_)
+				Truncate(size_);
+
+#if defined(BOOST_WINDOWS)
+			::CloseHandle(handle_);
+			handle_ = INVALID_HANDLE_VALUE;
+#else
+			::close(fd_);
+			fd_ = -1;
+#endif
+		}
+
+		boost::uint64_t Size() const { return size_; }
+
+	private:
+		enum { Alignment = 4096, BufferSize = 256 * 1024 };
+
+		static void Fail(const std::string &what, int error)
+		{
+			throw std::runtime_error(what + ": " + boost::system::error_code(error, boost::system::system_category()).message());
+		}
+
+#if defined(BOOST_WINDOWS)
+		bool IsOpen() const { return handle_ != INVALID_HANDLE_VALUE; }
+
+		void WriteAt(boost::uint64_t offset, const char *data, std::size_t size)
+		{
+			OVERLAPPED position = OVERLAPPED(); // the offset of a synchronous write
+			position.Offset = static_cast<DWORD>(offset);
+			position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD written = 0;
+			if (!::WriteFile(handle_, data, static_cast<DWORD>(size), &written, &position) || written != size)
+				Fail("Can't write the capture", ::GetLastError());
+		}
+
+		void Truncate(boost::uint64_t size)
+		{
+			LARGE_INTEGER end;
+			end.QuadPart = static_cast<LONGLONG>(size);
+			if (!::SetFilePointerEx(handle_, end, 0, FILE_BEGIN) || !::SetEndOfFile(handle_))
+				Fail("Can't truncate the capture", ::GetLastError());
+		}
+
+		HANDLE handle_;
+#else
+		bool IsOpen() const { return fd_ >= 0; }
+
+		void WriteAt(boost::uint64_t offset, const char *data, std::size_t size)
+		{
+			while (size > 0) {
+				const ssize_t n = ::pwrite(fd_, data, size, static_cast<off_t>(offset));
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) Fail("Can't write the capture", errno);
+				data += n; size -= n; offset += n;
+			}
+		}
+
+		void Truncate(boost::uint64_t size)
+		{
+			if (::ftruncate(fd_, static_cast<off_t>(size)) != 0)
+				Fail("Can't truncate the capture", errno);
+		}
+
+		int fd_;
+#endif
+
+		bool direct_, extended_; // extended_: preallocated past the data
+		std::vector<char> storage_;
+		char *buffer_; // aligned, inside storage_
+		std::size_t used_;
+		boost::uint64_t bufferOffset_, size_; // the offset of buffer_[0] in the file is aligned
+};
+
+CaptureWriter::CaptureWriter(const std::string &fileName, const Options &options)
+	: fileName_(fileName), options_(options), blockTicks_(boost::uint64_t(options.blockSeconds) * options.ticksPerSecond),
+	openSegment_(0), records_(0), first_(0), last_(0), segment_(0), base_(0),
+	queued_(0), written_(0), writtenSegment_(0), segmentBytes_(0), stop_(false)
+{
+	if (options_.ticksPerSecond == 0)
+		throw std::runtime_error("The capture needs the ticks per second");
+
+	start_ = boost::posix_time::microsec_clock::universal_time();
+	clockStart_ = Clock::now();
+	OpenSegment(0, 0); // the errors of the first one go to the caller at once
+
+	compressor_.reset(new boost::thread(boost::bind(&CaptureWriter::CompressorThread, this)));
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	try { Flush(); }
+	catch (const std::exception &) {} // nothing to be done about it here
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stop_ = true;
+		changed_.notify_all();
+	}
+	compressor_->join();
+
+	try { out_->Close(); }
+	catch (const std::exception &) {}
+}
+
+boost::uint64_t CaptureWriter::Ticks(Clock::time_point time) const
+{
+	if (time <= clockStart_)
+		return 0;
+
+	const boost::uint64_t ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(time - clockStart_).count();
+	return ConvertTicks(ns, 1000000000, options_.ticksPerSecond);
+}
+
+void CaptureWriter::Write(boost::uint64_t time, const std::vector<unsigned char> &data)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	CheckError();
+
+	if (time < last_) time = last_;
+
+	const boost::uint64_t rotateTicks = boost::uint64_t(options_.rotateSeconds) * options_.ticksPerSecond;
+	const bool rotateByTime = rotateTicks > 0 && time - base_ >= rotateTicks;
+
+	if (records_ > 0 && (records_ >= options_.blockRecords || time - first_ >= blockTicks_ || rotateByTime))
+		CloseBlock(lock);
+
+	if (records_ == 0) {
+		// A segment starts with a block. The size is the one written by the
+		// compressor, which can be some blocks behind
+		if (rotateByTime || (options_.rotateBytes > 0 && writtenSegment_ == segment_ && segmentBytes_ >= options_.rotateBytes)) {
+			++segment_;
+			base_ = time;
+		}
+
+		block_.str(std::string());
+		archive_.reset(new boost::archive::text_oarchive(block_));
+		first_ = last_ = time;
+	}
+
+	// The record is the one of the older captures: the time since the
+	// previous record and the data. The first one of a block gets its
+	// time from the block header
+	const boost::uint64_t offset = time - last_;
+	*archive_ << offset << data;
+
+	last_ = time;
+	++records_;
+}
+
+void CaptureWriter::Flush()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if (records_ > 0) CloseBlock(lock);
+
+	while (written_ < queued_ && error_.empty())
+		changed_.wait(lock);
+	CheckError();
+}
+
+void CaptureWriter::CloseBlock()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	CheckError();
+
+	// The compressor is busy, the block is closed by a later call or record
+	if (records_ > 0 && queue_.size() < MaxQueuedBlocks)
+		CloseBlock(lock);
+}
+
+void CaptureWriter::CheckError()
+{
+	if (!error_.empty())
+		throw std::runtime_error(error_);
+}
+
+void CaptureWriter::CloseBlock(boost::mutex::scoped_lock &lock)
+{
+	archive_.reset();
+
+	const boost::shared_ptr<Block> block(new Block);
+	block->data = block_.str();
+	block->records = records_;
+	block->first = first_ - base_;
+	block->last = last_ - base_;
+	block->segment = segment_;
+	block->base = base_;
+	records_ = 0;
+
+	// The writer waits for the compressor rather than letting the queue grow
+	while (queue_.size() >= MaxQueuedBlocks && error_.empty())
+		changed_.wait(lock);
+
+	queue_.push_back(block);
+	++queued_;
+	changed_.notify_all();
+}
+
+void CaptureWriter::CompressorThread()
+{
+	while (true)
+	{
+		boost::shared_ptr<Block> block;
+		bool failed;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while (queue_.empty() && !stop_)
+				changed_.wait(lock);
+			if (queue_.empty())
+				return; // stopped, and everything is written
+
+			block = queue_.front();
+			queue_.pop_front();
+			failed = !error_.empty();
+		}
+
+		// After a failure the blocks are dropped, the error is reported to the caller
+		std::string error;
+		if (!failed)
+			try { WriteBlock(*block); }
+			catch (const std::exception &e) { error = e.what(); }
+
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!error.empty()) error_ = error;
+		++written_;
+		writtenSegment_ = openSegment_;
+		segmentBytes_ = out_->Size();
+		changed_.notify_all();
+	}
+}
+
+void CaptureWriter::OpenSegment(unsigned int segment, boost::uint64_t base)
+{
+	std::string name = fileName_;
+	if (options_.rotateBytes > 0 || options_.rotateSeconds > 0) {
+		char number[16];
+		std::sprintf(number, ".%04u", segment + 1);
+		name += number;
+	}
+
+	if (out_) {
+		out_->Close();
+		index_.close();
+	}
+
+	out_.reset(new CaptureFile(name, options_.direct, options_.preallocateBytes));
+	index_.clear();
+	index_.open(IndexName(name).c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!index_)
+		throw std::runtime_error("Can't create the capture index of " + name);
+
+	// Every segment is a capture that starts with its first block
+	std::ostringstream header;
+	header << Signature << ' ' << Version << ' ' << options_.ticksPerSecond << ' '
+		<< boost::posix_time::to_iso_string(start_ + boost::posix_time::microseconds(
+			static_cast<boost::int64_t>(ConvertTicks(base, options_.ticksPerSecond, 1000000)))) << '\n';
+	out_->Write(header.str().data(), header.str().size());
+	out_->Flush();
+
+	openSegment_ = segment;
+}
+
+void CaptureWriter::WriteBlock(const Block &block)
+{
+	if (block.segment != openSegment_)
+		OpenSegment(block.segment, block.base);
+
+	const std::string data = options_.compress ? Compress(block.data) : block.data;
+
+	BlockHeader h;
+	h.flags = options_.compress ? Zlib : 0;
+	h.stored = boost::uint32_t(data.size());
+	h.raw = boost::uint32_t(block.data.size());
+	h.records = boost::uint32_t(block.records);
+	h.first = block.first; h.last = block.last;
+
+	unsigned char header[BlockHeaderSize];
+	EncodeHeader(h, header);
+
+	const boost::uint64_t offset = out_->Size();
+	out_->Write(header, BlockHeaderSize);
+	out_->Write(data.data(), data.size());
+	out_->Flush();
+
+	// The entry follows its block, an index cut short by a crash only
+	// misses the last blocks, which the reader finds after the indexed ones
+	unsigned char entry[IndexEntrySize];
+	Put(entry, block.first, 8); Put(entry + 8, offset, 8);
+	index_.write(reinterpret_cast<const char *>(entry), IndexEntrySize);
+	index_.flush();
+
+	if (!index_)
+		throw std::runtime_error("Can't write the capture index");
+}
+
+CaptureReader::CaptureReader(const std::string &fileName)
+	: fileName_(fileName), legacy_(false), ticksPerSecond_(1000), dataOffset_(0),
+	indexEntries_(0), scanned_(false), left_(0), blockStart_(false), blockTime_(0), time_(0), pending_(false),
+	nextBlock_(0), stop_(false), end_(false)
+{
+	in_.open(fileName.c_str(), std::ios::in | std::ios::binary);
+	if (!in_)
+		throw std::runtime_error("Can't open the capture " + fileName);
+
+	std::string signature;
+	in_ >> signature;
+
+	if (signature == Signature) {
+		unsigned int version;
+		std::string start;
+		in_ >> version >> ticksPerSecond_ >> start;
+		in_.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		if (!in_ || version != Version || ticksPerSecond_ == 0)
+			throw std::runtime_error("Unsupported capture " + fileName);
+
+		start_ = boost::posix_time::from_iso_string(start);
+		dataOffset_ = in_.tellg();
+
+		index_.open(IndexName(fileName).c_str(), std::ios::in | std::ios::binary);
+		if (index_) {
+			index_.seekg(0, std::ios::end);
+			indexEntries_ = std::size_t(boost::uint64_t(index_.tellg()) / IndexEntrySize);
+		}
+		else {
+			scanned_ = true; // no sidecar, the headers are read instead
+			ScanBlocks();
+		}
+	}
+	else legacy_ = true; // a text_oarchive, checked by its constructor
+
+	Rewind();
+}
+
+CaptureReader::~CaptureReader()
+{
+	StopReadAhead();
+}
+
+void CaptureReader::Rewind()
+{
+	StopReadAhead();
+
+	archive_.reset();
+	pending_ = false;
+	left_ = 0;
+	time_ = 0;
+	nextBlock_ = dataOffset_;
+
+	in_.clear();
+	in_.seekg(dataOffset_);
+	if (legacy_)
+		archive_.reset(new boost::archive::text_iarchive(in_));
+}
+
+void CaptureReader::StopReadAhead()
+{
+	if (!readAhead_) return;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stop_ = true;
+		changed_.notify_all();
+	}
+	readAhead_->join();
+	readAhead_.reset();
+
+	ahead_.clear();
+	stop_ = end_ = false;
+}
+
+void CaptureReader::ReadAheadThread(std::streamoff offset)
+{
+	std::ifstream in(fileName_.c_str(), std::ios::in | std::ios::binary);
+	in.seekg(offset);
+
+	while (true)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while (ahead_.size() >= MaxAheadBlocks && !stop_)
+				changed_.wait(lock);
+			if (stop_) return;
+		}
+
+		// Read and decompressed without the lock, Read() goes on with the blocks ahead
+		const boost::shared_ptr<Block> block(new Block);
+		BlockHeader h;
+		bool ok = ReadHeader(in, h);
+		if (ok) {
+			std::string data(h.stored, '\0');
+			ok = (h.flags & ~Zlib) == 0 && in.read(&data[0], data.size()); // unknown encoding, or cut short
+			if (ok)
+				try {
+					block->data = (h.flags & Zlib) ? Decompress(data, h.raw) : data;
+					block->records = h.records;
+					block->first = h.first;
+				}
+				catch (const std::exception &) { ok = false; }
+		}
+
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!ok) {
+			end_ = true;
+			changed_.notify_all();
+			return;
+		}
+		ahead_.push_back(block);
+		changed_.notify_all();
+	}
+}
+
+bool CaptureReader::ReadIndex(std::size_t i, IndexEntry &entry)
+{
+	if (scanned_) {
+		entry = scan_[i];
+		return true;
+	}
+
+	unsigned char p[IndexEntrySize];
+	index_.clear();
+	index_.seekg(std::streamoff(i) * IndexEntrySize);
+	if (!index_.read(reinterpret_cast<char *>(p), IndexEntrySize))
+		return false;
+
+	entry.time = Get(p, 8);
+	entry.offset = Get(p + 8, 8);
+	return true;
+}
+
+void CaptureReader::ScanBlocks()
+{
+	scan_.clear();
+	in_.clear();
+	in_.seekg(dataOffset_);
+
+	BlockHeader h;
+	IndexEntry entry;
+	for (entry.offset = boost::uint64_t(in_.tellg()); ReadHeader(in_, h); entry.offset = boost::uint64_t(in_.tellg())) {
+		entry.time = h.first;
+		scan_.push_back(entry);
+		if (!in_.seekg(h.stored, std::ios::cur))
+			break;
+	}
+}
+
+bool CaptureReader::FindBlock(boost::uint64_t time, boost::uint64_t &offset)
+{
+	const std::size_t n = scanned_ ? scan_.size() : indexEntries_;
+	IndexEntry entry;
+
+	// The last block starting before the time, the one before it may end
+	// with records of the same time; before the first block, the first one
+	std::size_t lo = 0, hi = n;
+	while (hi - lo > 1) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		if (!ReadIndex(mid, entry)) return false;
+		if (entry.time < time) lo = mid;
+		else hi = mid;
+	}
+
+	if (n == 0 || !ReadIndex(lo, entry))
+		return false;
+
+	// The index must be the one of this file: its entry points to a block
+	// header with the same time
+	BlockHeader h;
+	in_.clear();
+	in_.seekg(std::streamoff(entry.offset));
+	if (!ReadHeader(in_, h) || h.first != entry.time)
+		return false;
+
+	offset = entry.offset;
+	return true;
+}
+
+std::vector<boost::uint64_t> CaptureReader::BlockTimes()
+{
+	std::vector<boost::uint64_t> times;
+	if (legacy_) return times;
+
+	// The times of an index that doesn't belong to the file could go back,
+	// the last entry is checked as FindBlock() checks the one it finds
+	IndexEntry entry;
+	BlockHeader h;
+	const std::size_t n = scanned_ ? scan_.size() : indexEntries_;
+	for (std::size_t i = 0; i < n && ReadIndex(i, entry); ++i)
+		times.push_back(entry.time);
+
+	in_.clear();
+	if (!scanned_ && n > 0 && (times.size() != n || !in_.seekg(std::streamoff(entry.offset)) ||
+		!ReadHeader(in_, h) || h.first != entry.time))
+	{
+		scanned_ = true;
+		ScanBlocks();
+		times.clear();
+		for (std::size_t i = 0; i < scan_.size(); ++i)
+			times.push_back(scan_[i].time);
+	}
+
+	return times;
+}
+
+void CaptureReader::Seek(boost::uint64_t time)
+{
+	Rewind();
+
+	if (!legacy_) {
+		boost::uint64_t offset;
+		if (!FindBlock(time, offset)) {
+			if (scanned_) return; // an empty capture
+			scanned_ = true; // the sidecar belongs to another capture
+			ScanBlocks();
+			Rewind();
+			if (!FindBlock(time, offset)) return;
+		}
+
+		nextBlock_ = std::streamoff(offset);
+	}
+
+	// The records of the block before the time are skipped, the legacy
+	// captures have only one block
+	while (Read(next_))
+		if (next_.time >= time) {
+			pending_ = true;
+			break;
+		}
+}
+
+bool CaptureReader::LoadBlock()
+{
+	if (!readAhead_)
+		readAhead_.reset(new boost::thread(boost::bind(&CaptureReader::ReadAheadThread, this, nextBlock_)));
+
+	boost::shared_ptr<Block> block;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		while (ahead_.empty() && !end_)
+			changed_.wait(lock);
+		if (ahead_.empty())
+			return false;
+
+		block = ahead_.front();
+		ahead_.pop_front();
+		changed_.notify_all(); // room for the next one
+	}
+
+	archive_.reset();
+	block_.clear();
+	block_.str(block->data);
+	archive_.reset(new boost::archive::text_iarchive(block_));
+
+	left_ = block->records;
+	blockTime_ = block->first;
+	blockStart_ = true;
+	return true;
+}
+
+bool CaptureReader::Read(CaptureRecord &record)
+{
+	if (pending_) {
+		pending_ = false;
+		record = next_;
+		return true;
+	}
+
+	boost::uint64_t offset;
+
+	if (legacy_) {
+		try { *archive_ >> offset >> record.data; }
+		catch (const std::exception &) { return false; } // the end of the archive
+
+		time_ += offset;
+		record.time = time_;
+		return true;
+	}
+
+	while (left_ == 0)
+		if (!LoadBlock()) return false;
+
+	*archive_ >> offset >> record.data;
+	--left_;
+
+	time_ = blockStart_ ? blockTime_ : time_ + offset;
+	blockStart_ = false;
+	record.time = time_;
+	return true;
+}
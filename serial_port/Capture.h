@@ -0,0 +1,242 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace boost { namespace archive { class text_oarchive; class text_iarchive; } }
+
+// Capture files of the serial port. The records are written in blocks,
+// every block is a text_oarchive of its own behind a fixed binary header,
+// so a reader can start at any of them. The time of the first record of
+// every block and the offset of the block are appended to a sparse index,
+// a sidecar file of fixed size entries (<file>.idx), which Seek() binary
+// searches. Times are ticks since the start of the capture, the ticks per
+// second and the start are kept in the first line of the file. The ticks
+// are counted by a monotonic clock, microseconds by default, so they don't
+// jump with the wall clock; only the start is a wall clock time.
+//
+// The blocks are compressed with zlib, each one on its own, so the index
+// still points to a place a reader can start from. The writer compresses
+// and writes the blocks on a background thread, the reader reads and
+// decompresses the next blocks on its own thread, ahead of Read().
+//
+// The captures of the older versions, one text_oarchive of (milliseconds
+// since the previous record, data) pairs, are still read, front to back
+
+struct CaptureRecord
+{
+	boost::uint64_t time; // ticks since the start of the capture
+	std::vector<unsigned char> data;
+
+	CaptureRecord() : time(0) {}
+};
+
+// Converts a time between two tick rates, without the overflow of ticks * to
+// at nanoseconds
+inline boost::uint64_t ConvertTicks(boost::uint64_t ticks, unsigned int from, unsigned int to)
+{
+	return ticks / from * to + ticks % from * to / from;
+}
+
+class CaptureFile;
+
+class CaptureWriter : private boost::noncopyable
+{
+	public:
+		typedef boost::chrono::steady_clock Clock;
+
+		struct Options
+		{
+			unsigned int ticksPerSecond; // 1000000 == microseconds, 1000000000 == nanoseconds
+
+			// A block is closed after blockRecords records or blockSeconds
+			// of capture time, this is the most a Seek() has to skip
+			std::size_t blockRecords;
+			unsigned int blockSeconds;
+			bool compress;
+
+			// A new segment is started when the current one has reached
+			// rotateBytes or rotateSeconds (0 == never). The segments are
+			// named <file>.0001, <file>.0002 and so on, each one is a
+			// capture of its own with its own index and start time
+			boost::uint64_t rotateBytes;
+			unsigned int rotateSeconds;
+
+			// The space of a segment is allocated when it is created, so
+			// the file system doesn't allocate it block by block as it grows
+			boost::uint64_t preallocateBytes;
+
+			// The data is written past the page cache (O_DIRECT, or
+			// FILE_FLAG_NO_BUFFERING on Windows) from an aligned buffer, so a
+			// long capture doesn't evict the pages of the other programs
+			bool direct;
+
+			Options() : ticksPerSecond(1000000), blockRecords(256), blockSeconds(10), compress(true),
+				rotateBytes(0), rotateSeconds(0), preallocateBytes(0), direct(false) {}
+		};
+
+		// Throws std::runtime_error if the files can't be created
+		explicit CaptureWriter(const std::string &fileName, const Options &options = Options());
+		~CaptureWriter(); // the last block is written, the compressor is stopped
+
+		unsigned int TicksPerSecond() const { return options_.ticksPerSecond; }
+		boost::posix_time::ptime StartTime() const { return start_; }
+
+		// Ticks since the start, 0 for a time before it. A time taken as
+		// the data arrives, Clock::now() in the read handler, is closer to
+		// the arrival than the time Write() is called at
+		boost::uint64_t Ticks(Clock::time_point time) const;
+		boost::uint64_t Now() const { return Ticks(Clock::now()); }
+
+		// The times must not go back, an earlier time is taken as the last one.
+		// Blocks only if the compressor is MaxQueuedBlocks behind. Throws
+		// std::runtime_error if the compressor has failed to write
+		void Write(boost::uint64_t time, const std::vector<unsigned char> &data);
+		void Write(const std::vector<unsigned char> &data) { Write(Now(), data); }
+
+		// Closes the current block and waits until all the blocks are
+		// written, so that they survive a crash
+		void Flush();
+
+		// Closes the current block and hands it to the compressor without
+		// waiting for anything, for a writer on a thread that mustn't block;
+		// the block is left open if the compressor is MaxQueuedBlocks behind.
+		// Throws std::runtime_error if the compressor has failed to write
+		void CloseBlock();
+
+	private:
+		enum { MaxQueuedBlocks = 16 };
+
+		struct Block
+		{
+			std::string data;
+			std::size_t records;
+			boost::uint64_t first, last; // since the start of the segment
+			unsigned int segment;
+			boost::uint64_t base; // the start of the segment, since the start of the capture
+		};
+
+		// Called with the mutex locked
+		void CloseBlock(boost::mutex::scoped_lock &lock);
+		void CheckError();
+
+		// By the compressor thread only, once it runs
+		void CompressorThread();
+		void OpenSegment(unsigned int segment, boost::uint64_t base);
+		void WriteBlock(const Block &block);
+
+		const std::string fileName_;
+		const Options options_;
+		const boost::uint64_t blockTicks_;
+		boost::posix_time::ptime start_;
+		Clock::time_point clockStart_; // the same moment as start_
+		boost::scoped_ptr<CaptureFile> out_; // of the open segment, owned by the compressor thread
+		std::ofstream index_;
+		unsigned int openSegment_;
+
+		boost::mutex mutex_; // everything below
+		boost::condition_variable changed_; // of the queue and the counters
+		std::ostringstream block_;
+		boost::scoped_ptr<boost::archive::text_oarchive> archive_;
+		std::size_t records_; // in the current block
+		boost::uint64_t first_, last_; // times of the current block
+		unsigned int segment_; // of the current block
+		boost::uint64_t base_; // the start of the segment_
+
+		std::deque<boost::shared_ptr<Block> > queue_;
+		boost::uint64_t queued_, written_; // blocks
+		unsigned int writtenSegment_; // the one the compressor writes to
+		boost::uint64_t segmentBytes_; // written to it
+		bool stop_;
+		std::string error_; // of the compressor thread
+		boost::scoped_ptr<boost::thread> compressor_;
+};
+
+class CaptureReader : private boost::noncopyable
+{
+	public:
+		// Throws if the file can't be opened or isn't a capture
+		explicit CaptureReader(const std::string &fileName);
+		~CaptureReader(); // the read-ahead thread is stopped
+
+		bool IsLegacy() const { return legacy_; } // no index, Seek() reads from the start
+		unsigned int TicksPerSecond() const { return ticksPerSecond_; }
+		boost::posix_time::ptime StartTime() const { return start_; } // not_a_date_time if legacy
+
+		// Positions the reader at the first record at or after the time. The
+		// block is found in the index in O(log n), without reading the file;
+		// if the index is missing or doesn't match, the block headers are
+		// scanned once, which skips the data of the blocks
+		void Seek(boost::uint64_t time);
+
+		// The times of the first records of the blocks, from the index, in
+		// the order of the file; empty for a legacy capture
+		std::vector<boost::uint64_t> BlockTimes();
+
+		// False at the end of the capture. A block that is cut short or
+		// fails to decompress ends the capture as well
+		bool Read(CaptureRecord &record);
+
+	private:
+		enum { MaxAheadBlocks = 4 };
+
+		struct IndexEntry { boost::uint64_t time, offset; };
+
+		struct Block
+		{
+			std::string data; // decompressed
+			std::size_t records;
+			boost::uint64_t first;
+		};
+
+		bool FindBlock(boost::uint64_t time, boost::uint64_t &offset);
+		bool ReadIndex(std::size_t i, IndexEntry &entry);
+		void ScanBlocks();
+		bool LoadBlock(); // the next block from the read-ahead thread
+		void Rewind();
+
+		void StopReadAhead();
+		void ReadAheadThread(std::streamoff offset);
+
+		const std::string fileName_;
+		std::ifstream in_, index_; // the read-ahead thread opens the file again
+		bool legacy_;
+		unsigned int ticksPerSecond_;
+		boost::posix_time::ptime start_;
+		std::streamoff dataOffset_; // of the first block
+
+		std::size_t indexEntries_; // in the sidecar file
+		bool scanned_; // the headers were scanned, scan_ replaces the sidecar
+		std::vector<IndexEntry> scan_;
+
+		std::istringstream block_;
+		boost::scoped_ptr<boost::archive::text_iarchive> archive_;
+		std::size_t left_; // records left in the current block
+		bool blockStart_; // the next record is the first of its block
+		boost::uint64_t blockTime_, time_;
+
+		bool pending_; // Seek() has read the next record already
+		CaptureRecord next_;
+
+		std::streamoff nextBlock_; // where the read-ahead thread is to start
+		boost::mutex mutex_; // everything below
+		boost::condition_variable changed_;
+		std::deque<boost::shared_ptr<Block> > ahead_;
+		bool stop_, end_; // end_ == the read-ahead thread has reached the end
+		boost::scoped_ptr<boost::thread> readAhead_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "CoalescingTimer.h"
+#include <vector>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+TimerCoalescer::TimerCoalescer(boost::asio::io_context &ioc)
+	: ioc_(ioc), wakeup_(ioc), waiting_(false), generation_(0)
+{
+}
+
+TimerCoalescer::~TimerCoalescer()
+{
+	std::vector<CoalescingTimer::handler_type> handlers;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		while (!byDeadline_.empty()) {
+			handlers.push_back(CoalescingTimer::handler_type());
+			Unarm(*byDeadline_.begin()->second, handlers.back());
+		}
+
+		boost::system::error_code ec;
+		wakeup_.cancel(ec);
+	}
+
+	for (std::size_t i = 0; i < handlers.size(); ++i)
+		ioc_.post(boost::bind(handlers[i], boost::asio::error::operation_aborted));
+}
+
+bool TimerCoalescer::Unarm(CoalescingTimer &timer, CoalescingTimer::handler_type &handler)
+{
+	if (!timer.armed_)
+		return false; // not waiting, or the handler is already running
+
+	byDeadline_.erase(timer.byDeadline_);
+	byLatest_.erase(timer.byLatest_);
+	timer.armed_ = false;
+	handler.swap(timer.handler_);
+	++counters_.cancelled;
+	return true;
+}
+
+void TimerCoalescer::Schedule()
+{
+	if (byLatest_.empty())
+		return; // a planned wake-up finds nothing to do and is not renewed
+
+	// The wake-up must come by the end of the earliest window. A wake-up
+	// already planned before that serves the new timer as well
+	const clock_type::time_point at = byLatest_.begin()->first;
+	if (waiting_ && wakeupAt_ <= at)
+		return;
+
+	waiting_ = true;
+	wakeupAt_ = at;
+	++generation_;
+
+	// Rounded up, a wake-up a little early would find the window still closed
+	const boost::int64_t ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(at - clock_type::now()).count();
+	const boost::int64_t us = (ns + 999) / 1000;
+	wakeup_.expires_from_now(boost::posix_time::microseconds(us > 0 ? us : 0));
+	wakeup_.async_wait(boost::bind(&TimerCoalescer::HandleWakeup, this, generation_, boost::asio::placeholders::error));
+}
+
+void TimerCoalescer::Arm(CoalescingTimer &timer, CoalescingTimer::handler_type &handler)
+{
+	CoalescingTimer::handler_type previous;
+	bool cancelled;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		cancelled = Unarm(timer, previous); // one wait at a time
+
+		timer.handler_.swap(handler);
+		timer.byDeadline_ = byDeadline_.insert(std::make_pair(timer.deadline_, &timer));
+		timer.byLatest_ = byLatest_.insert(std::make_pair(timer.latest_, &timer));
+		timer.armed_ = true;
+		++counters_.armed;
+
+		Schedule();
+	}
+
+	if (cancelled)
+		ioc_.post(boost::bind(previous, boost::asio::error::operation_aborted));
+}
+
+bool TimerCoalescer::Cancel(CoalescingTimer &timer)
+{
+	CoalescingTimer::handler_type handler;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!Unarm(timer, handler))
+			return false;
+	}
+
+	ioc_.post(boost::bind(handler, boost::asio::error::operation_aborted));
+	return true;
+}
+
+void TimerCoalescer::HandleWakeup(boost::uint64_t generation, const boost::system::error_code &ec)
+{
+	if (ec == boost::asio::error::operation_aborted)
+		return; // moved to an earlier time, or the coalescer is being destroyed
+
+	std::vector<CoalescingTimer::handler_type> batch;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (generation != generation_)
+			return; // it had completed before it was moved, the current one is still planned
+
+		waiting_ = false;
+		++counters_.wakeups;
+
+		// Every timer whose window has opened goes into the batch,
+		// not only the one whose window closes now
+		const clock_type::time_point now = clock_type::now();
+		while (!byDeadline_.empty() && byDeadline_.begin()->first <= now) {
+			CoalescingTimer &timer = *byDeadline_.begin()->second;
+			byDeadline_.erase(timer.byDeadline_);
+			byLatest_.erase(timer.byLatest_);
+			timer.armed_ = false;
+
+			batch.push_back(CoalescingTimer::handler_type());
+			batch.back().swap(timer.handler_);
+		}
+
+		counters_.fired += batch.size();
+		Schedule();
+	}
+
+	// The batch is dispatched from this wake-up, the handlers may arm their timers again
+	for (std::size_t i = 0; i < batch.size(); ++i)
+		batch[i](boost::system::error_code());
+}
+
+TimerCoalescer::Counters TimerCoalescer::GetCounters()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return counters_;
+}
+
+std::size_t CoalescingTimer::expires_from_now(const boost::posix_time::time_duration &deadline,
+	const boost::posix_time::time_duration &slack)
+{
+	const std::size_t cancelled = cancel();
+
+	deadline_ = TimerCoalescer::clock_type::now() + boost::chrono::microseconds(deadline.total_microseconds());
+	latest_ = deadline_ + boost::chrono::microseconds(std::max<boost::int64_t>(0, slack.total_microseconds()));
+	return cancelled;
+}
+
+void CoalescingTimer::async_wait(handler_type handler)
+{
+	coalescer_.Arm(*this, handler);
+}
+
+std::size_t CoalescingTimer::cancel()
+{
+	return coalescer_.Cancel(*this) ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+#ifndef __COALESCINGTIMER_H__
+#define __COALESCINGTIMER_H__
+
+#include <map>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Timers for jobs that may run anywhere within a window: the caller gives
+// a deadline and the slack it tolerates after it. The coalescer wakes up
+// once, at the end of the earliest window, and runs the handlers of every
+// timer whose deadline has passed by then in one batch, so the timers
+// whose windows overlap cost one wake-up of the reactor instead of one each.
+// A timer armed while a wake-up is already planned inside its window adds
+// nothing. One TimerCoalescer is created per io_context
+
+class CoalescingTimer;
+
+class TimerCoalescer : private boost::noncopyable
+{
+	public:
+		explicit TimerCoalescer(boost::asio::io_context &ioc);
+		~TimerCoalescer(); // the timers still armed are cancelled
+
+		boost::asio::io_context &GetIOContext() { return ioc_; }
+
+		struct Counters
+		{
+			boost::uint64_t armed, fired, cancelled, wakeups;
+			Counters() : armed(0), fired(0), cancelled(0), wakeups(0) {}
+
+			// Every handler but one of a batch would have been a wake-up of its own
+			boost::uint64_t WakeupsSaved() const { return fired > wakeups ? fired - wakeups : 0; }
+		};
+
+		Counters GetCounters();
+
+	private:
+		friend class CoalescingTimer;
+
+		typedef boost::chrono::steady_clock clock_type;
+		typedef std::multimap<clock_type::time_point, CoalescingTimer *> Queue;
+
+		// Called with the mutex locked
+		bool Unarm(CoalescingTimer &timer, boost::function<void(const boost::system::error_code &)> &handler);
+		void Schedule();
+
+		void Arm(CoalescingTimer &timer, boost::function<void(const boost::system::error_code &)> &handler);
+		bool Cancel(CoalescingTimer &timer);
+		void HandleWakeup(boost::uint64_t generation, const boost::system::error_code &ec);
+
+		boost::asio::io_context &ioc_;
+		boost::asio::deadline_timer wakeup_; // the only kernel timer
+
+		boost::mutex mutex_; // everything below
+		Queue byDeadline_, byLatest_; // the earliest and the latest time of every window
+		clock_type::time_point wakeupAt_;
+		bool waiting_;
+		boost::uint64_t generation_; // tells a stale wake-up from the current one
+		Counters counters_;
+};
+
+// The interface of deadline_timer with the slack added to expires_from_now()
+class CoalescingTimer : private boost::noncopyable
+{
+	public:
+		typedef boost::function<void(const boost::system::error_code &)> handler_type;
+
+		explicit CoalescingTimer(TimerCoalescer &coalescer) : coalescer_(coalescer), armed_(false) {}
+		~CoalescingTimer() { cancel(); }
+
+		// The handler runs no earlier than now + deadline and, unless the
+		// io_context is late, no later than now + deadline + slack. Any
+		// pending wait is cancelled, the number of waits cancelled is returned
+		std::size_t expires_from_now(const boost::posix_time::time_duration &deadline,
+			const boost::posix_time::time_duration &slack = boost::posix_time::time_duration());
+
+		void async_wait(handler_type handler); // cancels a pending wait
+		std::size_t cancel(); // the handler is called with operation_aborted
+
+	private:
+		friend class TimerCoalescer;
+
+		TimerCoalescer &coalescer_;
+		TimerCoalescer::clock_type::time_point deadline_, latest_;
+		TimerCoalescer::Queue::iterator byDeadline_, byLatest_; // valid while armed
+		bool armed_;
+		handler_type handler_;
+};
+
+#endif
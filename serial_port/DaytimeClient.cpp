@@ -0,0 +1,259 @@
+#include "DaytimeClient.h"
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using boost::asio::ip::tcp;
+
+// A query in flight. All members are accessed on the strand only
+struct DaytimeClient::Operation
+{
+	std::string host, service, key;
+	bool keepAlive, reused, done;
+	bool reading, parked; // parked: timed out, the read of the warm connection is still pending
+	connection_ptr connection;
+	boost::asio::deadline_timer timer;
+	query_handler handler;
+
+	Operation(boost::asio::io_context &ioc)
+		: keepAlive(false), reused(false), done(false), reading(false), parked(false), timer(ioc) {}
+};
+
+DaytimeClient::DaytimeClient(boost::asio::io_context &ioc, boost::posix_time::time_duration resolveTtl,
+	boost::posix_time::time_duration idleTtl)
+	: ioc_(ioc), strand_(ioc), resolver_(ioc), resolveTtl_(resolveTtl), idleTtl_(idleTtl)
+{
+}
+
+DaytimeClient::Statistics DaytimeClient::GetStatistics()
+{
+	boost::mutex::scoped_lock lock(statisticsMutex_);
+	return statistics_;
+}
+
+void DaytimeClient::Query(const std::string &host, const std::string &service,
+	boost::posix_time::time_duration deadline, const query_handler &handler, bool keepAlive)
+{
+	const operation_ptr op(new Operation(ioc_));
+	op->host = host; op->service = service;
+	op->key = host + ":" + service;
+	op->keepAlive = keepAlive;
+	op->handler = handler;
+
+	// The deadline covers the resolving, the connecting and the reading
+	op->timer.expires_from_now(deadline);
+	op->timer.async_wait(boost::asio::bind_executor(strand_,
+		boost::bind(&DaytimeClient::Timeout, this, op, boost::asio::placeholders::error)));
+
+	boost::asio::dispatch(strand_, boost::bind(&DaytimeClient::Start, this, op));
+}
+
+void DaytimeClient::Start(operation_ptr op)
+{
+	{
+		boost::mutex::scoped_lock lock(statisticsMutex_);
+		++statistics_.queries;
+	}
+
+	if (op->keepAlive) { // the newest connection first, the ones that can't be reused are dropped
+		std::vector<connection_ptr> &idle = idle_[op->key];
+		while (!op->connection && !idle.empty()) {
+			const connection_ptr c = idle.back(); idle.pop_back();
+			const bool reusable = Refresh(*c);
+			if (reusable) {
+				op->connection = c;
+				op->reused = true;
+			}
+
+			boost::mutex::scoped_lock lock(statisticsMutex_);
+			++(reusable ? statistics_.reuses : statistics_.dropped);
+		}
+	}
+
+	if (op->connection) ReadLine(op);
+	else Resolve(op);
+}
+
+bool DaytimeClient::Refresh(Connection &c)
+{
+	if (!c.socket.is_open() || boost::posix_time::microsec_clock::universal_time() - c.idleSince > idleTtl_)
+		return false;
+
+	// What the server has pushed while the connection was idle, without
+	// blocking; a connection closed or reset by the server is found here
+	boost::system::error_code ec;
+	c.socket.non_blocking(true, ec);
+	while (!ec)
+		c.buffer.commit(c.socket.read_some(c.buffer.prepare(512), ec));
+	if (ec != boost::asio::error::would_block)
+		return false;
+
+	// Only the newest complete line is kept, and what follows it, so the
+	// query is answered at once with a string at most one feed period old
+	const std::string pending(boost::asio::buffers_begin(c.buffer.data()), boost::asio::buffers_end(c.buffer.data()));
+	const std::string::size_type eol = pending.rfind('\n');
+	if (eol != std::string::npos && eol > 0) {
+		const std::string::size_type previous = pending.rfind('\n', eol - 1);
+		if (previous != std::string::npos) c.buffer.consume(previous + 1);
+	}
+	return true;
+}
+
+void DaytimeClient::Resolve(operation_ptr op)
+{
+	CacheEntry &entry = cache_[op->key];
+
+	if (!entry.resolving && !entry.expires.is_special() &&
+		entry.expires > boost::posix_time::microsec_clock::universal_time()) {
+		{
+			boost::mutex::scoped_lock lock(statisticsMutex_);
+			++statistics_.cacheHits;
+		}
+		Connect(op, entry.endpoints);
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lock(statisticsMutex_);
+		++statistics_.cacheMisses;
+	}
+
+	// Queries for a source that is being resolved wait for the result
+	entry.waiters.push_back(op);
+	if (entry.resolving) return;
+
+	entry.resolving = true;
+	resolver_.async_resolve(op->host, op->service, boost::asio::bind_executor(strand_,
+		boost::bind(&DaytimeClient::ResolveComplete, this, op->key,
+		boost::asio::placeholders::error, boost::asio::placeholders::results)));
+}
+
+void DaytimeClient::ResolveComplete(const std::string &key, const boost::system::error_code &ec,
+	tcp::resolver::results_type results)
+{
+	CacheEntry &entry = cache_[key];
+	entry.resolving = false;
+
+	std::vector<operation_ptr> waiters;
+	waiters.swap(entry.waiters);
+
+	if (!ec) { // failures are not cached
+		entry.endpoints = results;
+		entry.expires = boost::posix_time::microsec_clock::universal_time() + resolveTtl_;
+	}
+
+	for (std::vector<operation_ptr>::iterator i = waiters.begin(); i != waiters.end(); ++i)
+		if (ec) Finish(*i, ec, std::string());
+		else if (!(*i)->done) Connect(*i, results);
+}
+
+void DaytimeClient::Connect(operation_ptr op, const tcp::resolver::results_type &endpoints)
+{
+	if (op->done) return; // the deadline has expired while resolving
+
+	op->connection.reset(new Connection(ioc_));
+	op->reused = false;
+	{
+		boost::mutex::scoped_lock lock(statisticsMutex_);
+		++statistics_.connects;
+	}
+
+	// Try each endpoint until one works, like boost::asio::connect() in Daytime 1
+	boost::asio::async_connect(op->connection->socket, endpoints, boost::asio::bind_executor(strand_,
+		[this, op](const boost::system::error_code &ec, const tcp::endpoint &) {
+			if (ec) Finish(op, ec, std::string());
+			else ReadLine(op);
+		}));
+}
+
+void DaytimeClient::ReadLine(operation_ptr op)
+{
+	op->reading = true;
+	boost::asio::async_read_until(op->connection->socket, op->connection->buffer, '\n',
+		boost::asio::bind_executor(strand_, boost::bind(&DaytimeClient::ReadComplete, this, op,
+		boost::asio::placeholders::error)));
+}
+
+void DaytimeClient::ReadComplete(operation_ptr op, const boost::system::error_code &ec)
+{
+	Connection &c = *op->connection;
+
+	if (op->done) {
+		// A line has come for a query that has timed out, the connection
+		// is warm again and its line is kept for the next query
+		if (op->parked && !ec) {
+			boost::system::error_code ignored;
+			op->timer.cancel(ignored);
+			c.idleSince = boost::posix_time::microsec_clock::universal_time();
+			idle_[op->key].push_back(op->connection);
+		}
+		return;
+	}
+
+	std::string data(boost::asio::buffers_begin(c.buffer.data()), boost::asio::buffers_end(c.buffer.data()));
+
+	if (!ec) { // a complete line, the server may keep the connection open
+		const std::string::size_type eol = data.find('\n');
+		c.buffer.consume(eol + 1);
+		data.erase(eol);
+		if (!data.empty() && data[data.size() - 1] == '\r') data.erase(data.size() - 1);
+
+		if (op->keepAlive) {
+			c.idleSince = boost::posix_time::microsec_clock::universal_time();
+			idle_[op->key].push_back(op->connection);
+		}
+		Finish(op, ec, data);
+	}
+	else if (ec == boost::asio::error::eof && !data.empty())
+		Finish(op, boost::system::error_code(), data); // the classic daytime server closes
+	else if (op->reused) {
+		// The warm connection has been closed by the server
+		// while idle, so the query is retried once on a new one
+		op->connection.reset();
+		Resolve(op);
+	}
+	else Finish(op, ec, std::string());
+}
+
+void DaytimeClient::Timeout(operation_ptr op, const boost::system::error_code &ec)
+{
+	if (ec == boost::asio::error::operation_aborted || (op->done && !op->parked))
+		return;
+
+	// A warm connection that is only waiting for the next line of the feed
+	// isn't closed at once: the query times out, the read goes on for as
+	// long as an idle connection is kept and ReadComplete() keeps the
+	// connection if it succeeds
+	if (op->keepAlive && op->reading && !op->parked) {
+		Finish(op, boost::asio::error::timed_out, std::string());
+		op->parked = true;
+		op->timer.expires_from_now(idleTtl_);
+		op->timer.async_wait(boost::asio::bind_executor(strand_,
+			boost::bind(&DaytimeClient::Timeout, this, op, boost::asio::placeholders::error)));
+		return;
+	}
+
+	if (op->connection) { // the pending operation completes with an error
+		boost::system::error_code ignored;
+		op->connection->socket.close(ignored);
+	}
+
+	Finish(op, boost::asio::error::timed_out, std::string());
+}
+
+void DaytimeClient::Finish(operation_ptr op, const boost::system::error_code &ec, const std::string &response)
+{
+	if (op->done) return;
+	op->done = true;
+
+	boost::system::error_code ignored;
+	op->timer.cancel(ignored);
+
+	{
+		boost::mutex::scoped_lock lock(statisticsMutex_);
+		if (ec == boost::asio::error::timed_out) ++statistics_.timeouts;
+		else if (ec) ++statistics_.failures;
+	}
+
+	// The handler is called outside of the strand, it may start another query
+	boost::asio::post(ioc_, boost::bind(op->handler, ec, response));
+}
@@ -0,0 +1,102 @@
+#ifndef __DAYTIMECLIENT_H__
+#define __DAYTIMECLIENT_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Asynchronous daytime client for polling many time sources. Resolved
+// endpoints are cached for a configurable time to live, and connections
+// to servers that keep them open (the feed mode of Daytime 3) are kept
+// warm and reused by the next query to the same source. A reused
+// connection answers with the newest line the server has pushed, so it
+// doesn't wait for the next one. Any number of queries can be in flight,
+// each one with its own deadline. The internal state is serialised by a
+// strand, so Query() may be called from any thread
+
+class DaytimeClient : private boost::noncopyable
+{
+	public:
+		typedef boost::function<void(const boost::system::error_code &, const std::string &)> query_handler;
+
+		// A warm connection idle for longer than idleTtl is closed, not reused
+		DaytimeClient(boost::asio::io_context &ioc,
+			boost::posix_time::time_duration resolveTtl = boost::posix_time::minutes(5),
+			boost::posix_time::time_duration idleTtl = boost::posix_time::minutes(1));
+
+		// The handler is called once, with the daytime string (without the line
+		// break) or with an error; boost::asio::error::timed_out is reported when
+		// the deadline expires. With keepAlive the connection is kept open after
+		// the response if the server has not closed it; a query that times out
+		// while reading leaves its read pending, and the connection is kept if
+		// the line comes within the idle time to live
+		void Query(const std::string &host, const std::string &service,
+			boost::posix_time::time_duration deadline, const query_handler &handler,
+			bool keepAlive = false);
+
+		struct Statistics
+		{
+			unsigned long queries, failures, timeouts;
+			unsigned long cacheHits, cacheMisses; // resolver cache
+			unsigned long connects, reuses; // new and warm connections
+			unsigned long dropped; // warm connections found closed or idle for too long
+
+			Statistics() : queries(0), failures(0), timeouts(0),
+				cacheHits(0), cacheMisses(0), connects(0), reuses(0), dropped(0) {}
+		};
+
+		Statistics GetStatistics();
+
+	private:
+		struct Connection
+		{
+			boost::asio::ip::tcp::socket socket;
+			boost::asio::streambuf buffer;
+			boost::posix_time::ptime idleSince;
+
+			explicit Connection(boost::asio::io_context &ioc) : socket(ioc) {}
+		};
+		typedef boost::shared_ptr<Connection> connection_ptr;
+
+		struct Operation;
+		typedef boost::shared_ptr<Operation> operation_ptr;
+
+		struct CacheEntry
+		{
+			boost::asio::ip::tcp::resolver::results_type endpoints;
+			boost::posix_time::ptime expires;
+			bool resolving;
+			std::vector<operation_ptr> waiters; // queries waiting for the resolver
+
+			CacheEntry() : resolving(false) {}
+		};
+
+		void Start(operation_ptr op);
+		bool Refresh(Connection &c); // of an idle connection, false if it can't be reused
+		void Resolve(operation_ptr op);
+		void ResolveComplete(const std::string &key, const boost::system::error_code &ec,
+			boost::asio::ip::tcp::resolver::results_type results);
+		void Connect(operation_ptr op, const boost::asio::ip::tcp::resolver::results_type &endpoints);
+		void ReadLine(operation_ptr op);
+		void ReadComplete(operation_ptr op, const boost::system::error_code &ec);
+		void Timeout(operation_ptr op, const boost::system::error_code &ec);
+		void Finish(operation_ptr op, const boost::system::error_code &ec, const std::string &response);
+
+		boost::asio::io_context &ioc_;
+		boost::asio::io_context::strand strand_;
+		boost::asio::ip::tcp::resolver resolver_;
+		boost::posix_time::time_duration resolveTtl_, idleTtl_;
+
+		std::map<std::string, CacheEntry> cache_; // "host:service" => endpoints
+		std::map<std::string, std::vector<connection_ptr> > idle_; // warm connections
+
+		boost::mutex statisticsMutex_;
+		Statistics statistics_;
+};
+
+#endif
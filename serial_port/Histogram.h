@@ -0,0 +1,98 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <vector>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+
+// Log-linear histogram of unsigned values (latencies in microseconds, sizes
+// in bytes and so on). Values below 64 are counted exactly, larger values
+// fall into 32 buckets per power of two, so any percentile is reported with
+// an error of less than 3%. Recording is O(1) and allocation free; the class
+// is not synchronised, so every thread fills its own copy and Merge() is
+// called when the results are collected
+
+class Histogram
+{
+	public:
+		Histogram() : counts_(BucketCount, 0) { Reset(); }
+
+		void Record(boost::uint64_t value, boost::uint64_t count = 1)
+		{
+			counts_[Index(value)] += count;
+			count_ += count; sum_ += double(value) * count;
+			if (value < min_) min_ = value;
+			if (value > max_) max_ = value;
+		}
+
+		void Merge(const Histogram &other)
+		{
+			for (unsigned int i = 0; i < BucketCount; ++i)
+				counts_[i] += other.counts_[i];
+
+			count_ += other.count_; sum_ += other.sum_;
+			if (other.min_ < min_) min_ = other.min_;
+			if (other.max_ > max_) max_ = other.max_;
+		}
+
+		void Reset()
+		{
+			std::fill(counts_.begin(), counts_.end(), 0);
+			count_ = 0; sum_ = 0; max_ = 0; min_ = ~boost::uint64_t(0);
+		}
+
+		boost::uint64_t Count() const { return count_; }
+		boost::uint64_t Min() const { return count_ ? min_ : 0; }
+		boost::uint64_t Max() const { return max_; }
+		double Mean() const { return count_ ? sum_ / count_ : 0; }
+
+		// The value below which the given percent (0..100) of values fall
+		boost::uint64_t Percentile(double percent) const
+		{
+			if (count_ == 0) return 0;
+
+			boost::uint64_t rank = boost::uint64_t(percent / 100 * count_ + 0.5);
+			if (rank < 1) rank = 1;
+			if (rank > count_) rank = count_;
+
+			boost::uint64_t seen = 0;
+			for (unsigned int i = 0; i < BucketCount; ++i)
+				if ((seen += counts_[i]) >= rank) {
+					// the highest value of the bucket, so it is never underestimated
+					const boost::uint64_t value = (i + 1 < BucketCount) ? Value(i + 1) - 1 : max_;
+					return value > max_ ? max_ : (value < min_ ? min_ : value);
+				}
+
+			return max_;
+		}
+
+	private:
+		enum { LinearBits = 6, SubBuckets = 32, BucketCount = 64 + 58 * SubBuckets };
+
+		static unsigned int Index(boost::uint64_t value)
+		{
+			if (value < (1U << LinearBits))
+				return static_cast<unsigned int>(value);
+
+			unsigned int msb = LinearBits;
+			while (msb < 63 && (value >> (msb + 1))) ++msb;
+
+			const unsigned int shift = msb - 5; // keep the 6 most significant bits
+			return shift * SubBuckets + static_cast<unsigned int>(value >> shift);
+		}
+
+		static boost::uint64_t Value(unsigned int index) // the lowest value of a bucket
+		{
+			if (index < (1U << LinearBits))
+				return index;
+
+			const unsigned int shift = index / SubBuckets - 1;
+			return boost::uint64_t(index % SubBuckets + SubBuckets) << shift;
+		}
+
+		std::vector<boost::uint64_t> counts_;
+		boost::uint64_t count_, min_, max_;
+		double sum_;
+};
+
+#endif
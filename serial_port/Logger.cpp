@@ -0,0 +1,175 @@
+#include "Logger.h"
+#include <iostream>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+Logger Logger::instance_;
+
+Logger &Logger::Instance() { return instance_; }
+
+Logger::Level Logger::ParseLevel(const std::string &name)
+{
+	static const char *const names[] = { "trace", "debug", "info", "warning", "error", "off" };
+
+	for (int level = Trace; level <= Off; ++level)
+		if (name == names[level]) return static_cast<Level>(level);
+
+	throw std::invalid_argument("unknown log level: " + name);
+}
+
+Logger::Logger() : level_(Info), running_(false), flushIntervalMs_(10),
+	localRing_(&Logger::RetireRing), pendingDropped_(0)
+{
+}
+
+Logger::~Logger()
+{
+	Stop();
+
+	localRing_.release(); // the rings are deleted here, not by the cleanup function
+	for (std::vector<Ring *>::iterator i = rings_.begin(); i != rings_.end(); ++i)
+		delete *i;
+}
+
+void Logger::Start(Level level, unsigned int flushIntervalMs)
+{
+	SetLevel(level);
+	if (running_.exchange(true))
+		return;  // the flusher is already running
+
+	flushIntervalMs_ = flushIntervalMs;
+	lastDropReport_ = boost::posix_time::microsec_clock::universal_time();
+	flusher_.reset(new boost::thread(boost::bind(&Logger::FlusherThread, this)));
+}
+
+void Logger::Stop()
+{
+	if (running_.exchange(false) && flusher_) {
+		flusher_->join();
+		flusher_.reset();
+	}
+}
+
+Logger::Ring *Logger::LocalRing()
+{
+	Ring *ring = localRing_.get();
+	if (!ring) {
+		ring = new Ring;
+		localRing_.reset(ring);
+
+		boost::mutex::scoped_lock lock(ringsMutex_);
+		rings_.push_back(ring);
+	}
+
+	return ring;
+}
+
+void Logger::Push(Level level, bool raw, const char *text, size_t length)
+{
+	Ring *ring = LocalRing();
+
+	Record record;
+	record.time = boost::posix_time::microsec_clock::universal_time();
+	record.thread = boost::this_thread::get_id();
+	record.level = static_cast<unsigned char>(level);
+	record.raw = raw;
+
+	record.first = true;
+	do { // split a long text into several records
+		const size_t part = (std::min)(length, size_t(RecordTextSize));
+		std::copy(text, text + part, record.text);
+		record.length = static_cast<unsigned short>(part);
+		record.last = (part == length);
+
+		if (!ring->queue.push(record)) {
+			// the flusher can't keep up, count it; the rest of a line is
+			// dropped with it, the next line starts on a line of its own
+			const size_t parts = (length + RecordTextSize - 1) / RecordTextSize;
+			ring->dropped += raw ? 1 : static_cast<unsigned long>(parts);
+			if (!raw) break;
+		}
+
+		record.first = false;
+		text += part; length -= part;
+	} while (length > 0);
+}
+
+void Logger::Write(Level level, const char *text, size_t length)
+{
+	if (IsEnabled(level))
+		Push(level, false, text, length);
+}
+
+void Logger::WriteRaw(Level level, const void *data, size_t length)
+{
+	if (IsEnabled(level) && length > 0)
+		Push(level, true, static_cast<const char *>(data), length);
+}
+
+void Logger::FlusherThread()
+{
+	while (running_) {
+		boost::this_thread::sleep(boost::posix_time::milliseconds(flushIntervalMs_));
+		Drain(false);
+	}
+
+	Drain(true); // write out what was logged before Stop()
+}
+
+void Logger::Drain(bool final)
+{
+	static const char *const names[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "OFF  " };
+
+	std::vector<Ring *> rings;
+	{
+		boost::mutex::scoped_lock lock(ringsMutex_);
+		rings = rings_;
+	}
+
+	bool written = false;
+	for (std::vector<Ring *>::iterator i = rings.begin(); i != rings.end(); ++i)
+	{
+		Ring &ring = **i;
+		pendingDropped_ += ring.dropped.exchange(0);
+
+		Record record;
+		while (ring.queue.pop(record))
+		{
+			if (!record.raw && record.first && !ring.lineStart)
+				std::cout << '\n'; // the end of the previous line was dropped
+
+			if (!record.raw && record.first)
+				std::cout << boost::posix_time::to_simple_string(record.time).substr(12)
+					<< ' ' << names[record.level] << " [" << record.thread << "] ";
+
+			std::cout.write(record.text, record.length);
+			if (!record.raw && record.last) std::cout << '\n';
+
+			ring.lineStart = record.raw || record.last;
+			written = true;
+		}
+	}
+
+	const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if (pendingDropped_ && (final || (now - lastDropReport_) >= boost::posix_time::seconds(1))) {
+		// The counter is reported at most once per second
+		std::cout << "[logger] " << pendingDropped_ << " records dropped\n";
+		pendingDropped_ = 0; lastDropReport_ = now;
+		written = true;
+	}
+
+	if (written) std::cout.flush(); // once per batch, not once per line
+
+	{ // the rings of exited threads are freed when they are empty
+		boost::mutex::scoped_lock lock(ringsMutex_);
+		for (std::vector<Ring *>::iterator i = rings_.begin(); i != rings_.end();)
+		{
+			if ((*i)->retired && (*i)->queue.read_available() == 0) {
+				pendingDropped_ += (*i)->dropped;
+				delete *i; i = rings_.erase(i);
+			}
+			else ++i;
+		}
+	}
+}
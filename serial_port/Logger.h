@@ -0,0 +1,102 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Asynchronous logger shared by all binaries. Every thread that logs
+// gets its own lock-free single-producer ring, so Write() never takes
+// a lock and never touches std::cout. A background thread drains all
+// rings and flushes the console once per batch instead of once per line.
+// When a ring is full the record is dropped and counted; the counters are
+// reported by the flusher at most once per second
+
+class Logger : private boost::noncopyable
+{
+	public:
+		enum Level { Trace, Debug, Info, Warning, Error, Off };
+
+		static Logger &Instance();
+		static Level ParseLevel(const std::string &name); // "info" => Info, throws on unknown
+
+		// Start the background flusher thread, records written before
+		// Start() are kept in the rings (up to their capacity)
+		void Start(Level level = Info, unsigned int flushIntervalMs = 10);
+		void Stop(); // drain all rings and join the flusher thread
+
+		void SetLevel(Level level) { level_ = level; }
+		bool IsEnabled(Level level) const { return level < Off && level >= level_.load(boost::memory_order_relaxed); }
+
+		// A line with a timestamp, level and thread id prefix. Longer text is
+		// split across several records, so nothing is lost except on overflow
+		void Write(Level level, const char *text, size_t length);
+		void Write(Level level, const std::string &text) { Write(level, text.data(), text.size()); }
+
+		// Raw data (received bytes, for example) is written as is,
+		// without a prefix or a line break
+		void WriteRaw(Level level, const void *data, size_t length);
+
+		~Logger();
+
+	private:
+		Logger();
+		static Logger instance_; // drained and stopped at the program exit
+
+		enum { RecordTextSize = 232, RingCapacity = 1024 };
+
+		struct Record
+		{
+			boost::posix_time::ptime time;
+			boost::thread::id thread;
+			unsigned char level;
+			bool raw, first, last; // the first and the final part of a split line
+			unsigned short length;
+			char text[RecordTextSize];
+		};
+
+		struct Ring
+		{
+			boost::lockfree::spsc_queue<Record, boost::lockfree::capacity<RingCapacity> > queue;
+			boost::atomic<unsigned long> dropped;
+			boost::atomic<bool> retired; // the owner thread has exited
+			bool lineStart; // owned by the flusher, false inside a split line
+
+			Ring() : dropped(0), retired(false), lineStart(true) {}
+		};
+
+		static void RetireRing(Ring *ring) { ring->retired = true; }
+		Ring *LocalRing(); // the calling thread's ring, registered on first use
+		void Push(Level level, bool raw, const char *text, size_t length);
+
+		void FlusherThread();
+		void Drain(bool final); // called by the flusher thread only
+
+		boost::atomic<int> level_;
+		boost::atomic<bool> running_;
+		unsigned int flushIntervalMs_;
+		boost::scoped_ptr<boost::thread> flusher_;
+
+		boost::mutex ringsMutex_; // taken only to register a new ring and by the flusher
+		std::vector<Ring *> rings_;
+		boost::thread_specific_ptr<Ring> localRing_;
+
+		unsigned long pendingDropped_; // owned by the flusher thread
+		boost::posix_time::ptime lastDropReport_;
+};
+
+// Shorthand used by the servers and the serial tools
+inline void Log(Logger::Level level, const std::string &msg)
+{
+	Logger &logger = Logger::Instance();
+	if (logger.IsEnabled(level)) logger.Write(level, msg);
+}
+
+#endif
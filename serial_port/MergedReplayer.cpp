@@ -0,0 +1,121 @@
+#include "MergedReplayer.h"
+#include <stdexcept>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+MergedReplayer::MergedReplayer(boost::asio::io_context &ioc, const std::vector<Source> &sources, const Options &options)
+	: ReplayBase(ioc, options.speed, options.report, "Merged replay"), options_(options),
+	first_(0), last_(std::numeric_limits<boost::int64_t>::max()), late_(0)
+{
+	if (options_.speed <= 0)
+		throw std::invalid_argument("the replay speed must be positive");
+	if (sources.empty())
+		throw std::invalid_argument("nothing to replay");
+
+	for (std::size_t i = 0; i < sources.size(); ++i) {
+		Stream stream;
+		stream.reader.reset(new CaptureReader(sources[i].file));
+		stream.port = sources[i].port;
+		stream.offset = 0;
+
+		if (stream.reader->IsLegacy())
+			throw std::runtime_error(sources[i].file + " has no start time, it can't be merged");
+		streams_.push_back(stream);
+	}
+
+	// The time line starts at the earliest start of the captures
+	boost::posix_time::ptime earliest = streams_[0].reader->StartTime();
+	for (std::size_t i = 1; i < streams_.size(); ++i)
+		earliest = std::min(earliest, streams_[i].reader->StartTime());
+	for (std::size_t i = 0; i < streams_.size(); ++i)
+		streams_[i].offset = (streams_[i].reader->StartTime() - earliest).total_microseconds() * 1000;
+
+	first_ = static_cast<boost::int64_t>(std::max(0.0, options_.from) * 1e9);
+	if (options_.to * 1e9 < double(last_))
+		last_ = static_cast<boost::int64_t>(std::max(0.0, options_.to) * 1e9);
+
+	// Every capture is sought to the start of the range on its own
+	for (std::size_t i = 0; i < streams_.size(); ++i) {
+		const boost::int64_t from = std::max<boost::int64_t>(0, first_ - streams_[i].offset);
+		streams_[i].reader->Seek(ConvertTicks(from, 1000000000, streams_[i].reader->TicksPerSecond()));
+		Push(i);
+	}
+}
+
+void MergedReplayer::Begin()
+{
+	Next(boost::system::error_code());
+}
+
+void MergedReplayer::Push(std::size_t stream)
+{
+	Stream &s = streams_[stream];
+	Entry entry = { 0, stream };
+	do {
+		if (!s.reader->Read(s.record))
+			return;
+		entry.time = s.offset + boost::int64_t(ConvertTicks(s.record.time, s.reader->TicksPerSecond(), 1000000000));
+	} while (entry.time < first_); // Seek() is to the ticks of the capture, rounded down
+
+	if (entry.time >= last_)
+		return;
+
+	heap_.push_back(entry);
+	std::push_heap(heap_.begin(), heap_.end());
+}
+
+MergedReplayer::Clock::time_point MergedReplayer::Due(boost::int64_t time) const
+{
+	return start_ + boost::chrono::nanoseconds(static_cast<boost::int64_t>((time - first_) / options_.speed));
+}
+
+void MergedReplayer::Next(const boost::system::error_code &ec)
+{
+	if (ec || stopped_)
+		return;
+
+	// Everything due up to the tolerance from now is written in the
+	// order of the time line, a port at a time is never waited for
+	const Clock::time_point now = Clock::now();
+	const Clock::time_point horizon = now + boost::chrono::microseconds(options_.tolerance);
+	while (!heap_.empty() && Due(heap_.front().time) <= horizon) {
+		const Entry next = heap_.front();
+		std::pop_heap(heap_.begin(), heap_.end());
+		heap_.pop_back();
+
+		const Clock::time_point due = Due(next.time);
+		const boost::int64_t late = due < now ? boost::chrono::duration_cast<boost::chrono::microseconds>(now - due).count() : 0;
+		lag_.Record(late);
+		if (late > boost::int64_t(options_.tolerance)) ++late_;
+
+		Stream &s = streams_[next.stream];
+		if (!s.record.data.empty())
+			s.port->Write(s.record.data, SerialPort::Bulk);
+
+		Written(s.record.data.size(), (next.time - first_) / 1e9);
+
+		Push(next.stream);
+	}
+
+	if (heap_.empty()) {
+		Finish();
+		return;
+	}
+
+	timer_.expires_at(Due(heap_.front().time));
+	timer_.async_wait(strand_.wrap(boost::bind(&MergedReplayer::Next, Self<MergedReplayer>(), boost::asio::placeholders::error)));
+}
+
+MergedReplayer::Statistics MergedReplayer::GetStatistics()
+{
+	Statistics statistics;
+	static_cast<ReplayBase::Statistics &>(statistics) = ReplayBase::GetStatistics();
+	statistics.late = late_;
+	return statistics;
+}
+
+void MergedReplayer::Describe(std::ostream &out)
+{
+	out << ", " << late_ << " later than " << options_.tolerance << " us, " << streams_.size() << " captures";
+}
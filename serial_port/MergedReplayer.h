@@ -0,0 +1,89 @@
+#ifndef __MERGEDREPLAYER_H__
+#define __MERGEDREPLAYER_H__
+
+#include "ReplayBase.h"
+#include "SerialPort.h"
+#include "Capture.h"
+#include <limits>
+
+// Replays several captures, each one to its own serial port, with the
+// timing between them kept. Every capture keeps the wall clock time of its
+// start, the records are put on one time line by it, counted from the
+// earliest start, and merged in the order of that time with a heap of the
+// next record of every capture (a k-way merge, O(log k) a record). One
+// timer on one strand writes to all the ports, so the writes to different
+// ports are issued in the order of the captures. When the timer fires, the
+// records due within Options::tolerance microseconds are written with the
+// one that is due, in their order, rather than waiting for the timer again;
+// a record written later than the tolerance is counted as late. As in
+// Replayer, the times are counted from the start of the replay and the
+// captures are read as they are replayed
+
+class MergedReplayer : public ReplayBase
+{
+	public:
+		struct Source
+		{
+			std::string file;
+			boost::shared_ptr<SerialPort> port; // several captures may go to one port
+		};
+
+		struct Options
+		{
+			double from, to; // seconds since the earliest start of the captures
+			double speed;
+			unsigned int tolerance; // microseconds
+			int report; // seconds
+
+			Options() : from(0), to(std::numeric_limits<double>::infinity()),
+				speed(1), tolerance(1000), report(5) {}
+		};
+
+		struct Statistics : ReplayBase::Statistics
+		{
+			boost::uint64_t late; // written later than the tolerance
+		};
+
+		// The captures are opened at once. Throws if one can't be read, or
+		// is of an older version, which has no start time to merge on
+		MergedReplayer(boost::asio::io_context &ioc, const std::vector<Source> &sources, const Options &options);
+
+		Statistics GetStatistics(); // from a handler of the strand only, or after the io_context is stopped
+
+	private:
+		struct Stream
+		{
+			boost::shared_ptr<CaptureReader> reader;
+			boost::shared_ptr<SerialPort> port;
+			boost::int64_t offset; // nanoseconds from the earliest start to the start of this capture
+			CaptureRecord record; // the next one to write
+		};
+
+		// The heap keeps the earliest time on top, the captures in their
+		// order for the same time
+		struct Entry
+		{
+			boost::int64_t time; // nanoseconds since the earliest start
+			std::size_t stream;
+
+			bool operator<(const Entry &other) const
+				{ return time > other.time || (time == other.time && stream > other.stream); }
+		};
+
+		virtual void Begin();
+		virtual void Describe(std::ostream &out);
+
+		void Push(std::size_t stream); // reads the next record of the stream into the heap, if it is in the range
+		Clock::time_point Due(boost::int64_t time) const;
+
+		void Next(const boost::system::error_code &ec);
+
+		const Options options_;
+
+		std::vector<Stream> streams_; // on the strand
+		std::vector<Entry> heap_;
+		boost::int64_t first_, last_; // the range in nanoseconds
+		boost::uint64_t late_;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <boost/chrono.hpp>
+
+RateLimiter::RateLimiter(double rate, double burst, std::size_t capacity,
+	unsigned int shards, unsigned int idleSeconds)
+	: rate_(rate), burst_(burst), idleUs_(boost::uint64_t(idleSeconds) * 1000000),
+	shardCount_(shards ? shards : 1), shards_(new Shard[shards ? shards : 1]), nextSweep_(0)
+{
+	// The entries of a shard are a power of two, at least one probe window
+	std::size_t perShard = ProbeWindow;
+	while (perShard * shardCount_ < capacity) perShard *= 2;
+	shardMask_ = perShard - 1;
+
+	const Entry empty = { 0, 0, 0 };
+	for (unsigned int i = 0; i < shardCount_; ++i)
+		shards_[i].entries.assign(perShard, empty);
+}
+
+boost::uint64_t RateLimiter::Hash(boost::uint64_t key)
+{
+	// The finaliser of splitmix64, the addresses of clients are far from random
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+	return key ^ (key >> 31);
+}
+
+boost::uint64_t RateLimiter::Key(const boost::asio::ip::address &source)
+{
+	if (source.is_v4())
+		return source.to_v4().to_uint();
+
+	const boost::asio::ip::address_v6::bytes_type bytes = source.to_v6().to_bytes();
+	boost::uint64_t key = 0x100000000ULL; // never equal to an IPv4 key
+	for (std::size_t i = 0; i < bytes.size(); ++i)
+		key = Hash(key ^ bytes[i]);
+	return key;
+}
+
+bool RateLimiter::Admit(const boost::asio::ip::address &source)
+{
+	const boost::uint64_t now = boost::chrono::duration_cast<boost::chrono::microseconds>(
+		boost::chrono::steady_clock::now().time_since_epoch()).count();
+	return Admit(Key(source), now ? now : 1);
+}
+
+bool RateLimiter::Admit(boost::uint64_t key, boost::uint64_t nowUs)
+{
+	if (rate_ <= 0)
+		return true; // the admission control is off
+
+	const boost::uint64_t hash = Hash(key);
+	Shard &shard = shards_[(hash >> 32) % shardCount_];
+
+	boost::mutex::scoped_lock lock(shard.mutex);
+
+	// Look for the source in the probe window, remembering
+	// the first reusable entry and the least recently used one. The
+	// time was taken before the lock, another thread may have stored
+	// a later one since, so an entry is idle only if it is older
+	Entry *found = 0, *reusable = 0, *oldest = 0;
+	for (std::size_t i = 0; i < ProbeWindow; ++i)
+	{
+		Entry &e = shard.entries[(hash + i) & shardMask_];
+		if (e.last != 0 && e.key == key) { found = &e; break; }
+
+		if (!reusable && (e.last == 0 || (nowUs > e.last && nowUs - e.last > idleUs_))) reusable = &e;
+		if (!oldest || e.last < oldest->last) oldest = &e;
+	}
+
+	if (!found) { // a new source starts with a full bucket
+		if (!reusable) ++shard.counters.evicted;
+		found = reusable ? reusable : oldest;
+		found->key = key;
+		found->last = nowUs;
+		found->tokens = float(burst_);
+	}
+
+	const double elapsed = (nowUs > found->last) ? double(nowUs - found->last) : 0;
+	const double tokens = std::min(burst_, found->tokens + elapsed * rate_ / 1000000);
+	found->last = std::max(found->last, nowUs);
+
+	if (tokens >= 1) {
+		found->tokens = float(tokens - 1);
+		++shard.counters.admitted;
+		return true;
+	}
+
+	found->tokens = float(tokens);
+	++shard.counters.dropped;
+	return false;
+}
+
+std::size_t RateLimiter::Sweep()
+{
+	const boost::uint64_t now = boost::chrono::duration_cast<boost::chrono::microseconds>(
+		boost::chrono::steady_clock::now().time_since_epoch()).count();
+
+	Shard &shard = shards_[nextSweep_++ % shardCount_];
+	boost::mutex::scoped_lock lock(shard.mutex);
+
+	std::size_t cleared = 0;
+	for (std::vector<Entry>::iterator e = shard.entries.begin(); e != shard.entries.end(); ++e)
+		if (e->last != 0 && now > e->last && now - e->last > idleUs_) { e->last = 0; ++cleared; }
+
+	return cleared;
+}
+
+RateLimiter::Counters RateLimiter::GetCounters()
+{
+	Counters total;
+	for (unsigned int i = 0; i < shardCount_; ++i)
+	{
+		boost::mutex::scoped_lock lock(shards_[i].mutex);
+		total.admitted += shards_[i].counters.admitted;
+		total.dropped += shards_[i].counters.dropped;
+		total.evicted += shards_[i].counters.evicted;
+	}
+
+	return total;
+}
@@ -0,0 +1,69 @@
+#ifndef __RATELIMITER_H__
+#define __RATELIMITER_H__
+
+#include <vector>
+#include <boost/asio/ip/address.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Per-source token buckets for admission control. The buckets live in an
+// open-addressed table split into shards by the hash of the source; every
+// shard has its own small lock, so the threads of an Executor servicing
+// different sources rarely meet. A source is looked up within a short
+// probe window (two cache lines), an idle entry in the window is reused
+// on the spot and the oldest one is evicted when the window is full, so
+// the table never grows and never needs rehashing. Sweep() clears the
+// idle entries of one shard per call, cheap enough to run from a timer
+
+class RateLimiter : private boost::noncopyable
+{
+	public:
+		// rate: requests per second allowed for every source (0 == no limit), burst: the bucket size
+		RateLimiter(double rate, double burst, std::size_t capacity = 65536,
+			unsigned int shards = 16, unsigned int idleSeconds = 60);
+
+		bool Admit(const boost::asio::ip::address &source); // take a token if there is one
+		bool Admit(boost::uint64_t key, boost::uint64_t nowUs);
+
+		std::size_t Sweep(); // clear the idle entries of the next shard, returns their number
+
+		struct Counters
+		{
+			boost::uint64_t admitted, dropped, evicted;
+			Counters() : admitted(0), dropped(0), evicted(0) {}
+		};
+
+		Counters GetCounters(); // the sum over all shards
+
+	private:
+		struct Entry
+		{
+			boost::uint64_t key;
+			boost::uint64_t last; // the time of the last request, us; 0 == empty
+			float tokens;
+		};
+
+		enum { ProbeWindow = 8 };
+
+		struct Shard
+		{
+			boost::mutex mutex;
+			std::vector<Entry> entries;
+			Counters counters;
+			char padding[64]; // keep the locks of the shards on different cache lines
+		};
+
+		static boost::uint64_t Hash(boost::uint64_t key);
+		static boost::uint64_t Key(const boost::asio::ip::address &source);
+
+		const double rate_, burst_;
+		const boost::uint64_t idleUs_;
+		const unsigned int shardCount_;
+		std::size_t shardMask_; // entries per shard - 1
+		boost::scoped_array<Shard> shards_;
+		unsigned int nextSweep_;
+};
+
+#endif
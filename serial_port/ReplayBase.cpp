@@ -0,0 +1,104 @@
+#include "ReplayBase.h"
+#include "Logger.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+ReplayBase::ReplayBase(boost::asio::io_context &ioc, double speed, int report, const std::string &name)
+	: strand_(ioc), timer_(ioc), stopped_(false), finished_(false), speed_(speed), report_(report), name_(name),
+	reportTimer_(ioc), records_(0), bytes_(0), replayed_(0)
+{
+}
+
+void ReplayBase::Start()
+{
+	strand_.post(boost::bind(&ReplayBase::Started, shared_from_this()));
+}
+
+void ReplayBase::Stop()
+{
+	strand_.post(boost::bind(&ReplayBase::Cancel, shared_from_this()));
+}
+
+void ReplayBase::Started()
+{
+	start_ = Clock::now();
+	Begin();
+
+	if (!finished_ && report_ > 0) {
+		reportTimer_.expires_from_now(boost::chrono::seconds(report_));
+		reportTimer_.async_wait(strand_.wrap(boost::bind(&ReplayBase::Report, shared_from_this(), boost::asio::placeholders::error)));
+	}
+}
+
+void ReplayBase::Cancel()
+{
+	stopped_ = true;
+
+	boost::system::error_code ec;
+	timer_.cancel(ec);
+	reportTimer_.cancel(ec);
+}
+
+void ReplayBase::Written(std::size_t bytes, double replayed)
+{
+	++records_;
+	bytes_ += bytes;
+	replayed_ = replayed;
+}
+
+void ReplayBase::Finish()
+{
+	finished_ = true;
+	end_ = Clock::now();
+
+	boost::system::error_code ec;
+	reportTimer_.cancel(ec);
+
+	LogProgress(name_ + " finished");
+}
+
+void ReplayBase::Report(const boost::system::error_code &ec)
+{
+	if (ec || stopped_ || finished_)
+		return;
+
+	LogProgress(name_);
+
+	reportTimer_.expires_at(reportTimer_.expires_at() + boost::chrono::seconds(report_));
+	reportTimer_.async_wait(strand_.wrap(boost::bind(&ReplayBase::Report, shared_from_this(), boost::asio::placeholders::error)));
+}
+
+ReplayBase::Statistics ReplayBase::GetStatistics()
+{
+	Statistics statistics;
+	statistics.records = records_;
+	statistics.bytes = bytes_;
+	statistics.elapsed = boost::chrono::duration<double>((finished_ ? end_ : Clock::now()) - start_).count();
+	statistics.replayed = replayed_;
+	statistics.lag = lag_;
+	statistics.finished = finished_;
+	return statistics;
+}
+
+void ReplayBase::LogProgress(const std::string &what)
+{
+	const Statistics s = GetStatistics();
+	const double elapsed = std::max(s.elapsed, 1e-6);
+
+	// The throughput, and how far the replay is behind the captures or ahead of them
+	std::ostringstream out;
+	out << what << ": " << s.records << " records, " << s.bytes << " bytes in "
+		<< std::fixed << std::setprecision(1) << s.elapsed << " s, "
+		<< std::setprecision(0) << s.bytes / elapsed << " bytes/s, "
+		<< std::setprecision(1) << s.replayed << " s replayed, "
+		<< std::setprecision(2) << s.replayed / elapsed << "x";
+
+	if (speed_ > 0)
+		out << " (" << speed_ << "x asked), late p50 " << s.lag.Percentile(50) << " us, p99 "
+			<< s.lag.Percentile(99) << " us, max " << s.lag.Max() << " us";
+
+	Describe(out);
+	Log(Logger::Info, out.str());
+}
@@ -0,0 +1,76 @@
+#ifndef __REPLAYBASE_H__
+#define __REPLAYBASE_H__
+
+#include "Histogram.h"
+#include <string>
+#include <ostream>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/chrono/chrono.hpp>
+
+// What Replayer and MergedReplayer have in common. A replay runs on one
+// strand, Start() and Stop() are posted to it and the records are written
+// from its timer. The counters of what was written are kept here, and the
+// progress is logged every report seconds and once when the replay is over,
+// the line of the derived class added by Describe(). A derived class starts
+// writing in Begin(), counts every record with Written() and calls Finish()
+// when the last one is sent
+
+class ReplayBase : private boost::noncopyable,
+	public boost::enable_shared_from_this<ReplayBase>
+{
+	public:
+		struct Statistics
+		{
+			boost::uint64_t records, bytes;
+			double elapsed; // seconds since Start()
+			double replayed; // seconds of the captures written
+			Histogram lag; // microseconds behind the schedule, speed > 0 only
+			bool finished;
+		};
+
+		virtual ~ReplayBase() {}
+
+		void Start();
+		void Stop();
+
+		Statistics GetStatistics(); // from a handler of the strand only, or after the io_context is stopped
+
+	protected:
+		typedef boost::chrono::steady_clock Clock;
+
+		// The progress lines start with name, "Replay" => "Replay finished: ..."
+		ReplayBase(boost::asio::io_context &ioc, double speed, int report, const std::string &name);
+
+		virtual void Begin() = 0; // on the strand, start_ is set
+		virtual void Describe(std::ostream &out) = 0; // the end of a progress line
+
+		template <class T> boost::shared_ptr<T> Self() { return boost::static_pointer_cast<T>(shared_from_this()); }
+
+		void Written(std::size_t bytes, double replayed); // replayed: seconds of the captures, so far
+		void Finish();
+
+		boost::asio::io_context::strand strand_; // everything below
+		boost::asio::basic_waitable_timer<Clock> timer_; // of the records
+		bool stopped_, finished_;
+		Clock::time_point start_;
+		Histogram lag_;
+
+	private:
+		void Started();
+		void Cancel();
+		void Report(const boost::system::error_code &ec);
+		void LogProgress(const std::string &what);
+
+		const double speed_;
+		const int report_; // seconds
+		const std::string name_;
+
+		boost::asio::basic_waitable_timer<Clock> reportTimer_;
+		Clock::time_point end_;
+		boost::uint64_t records_, bytes_;
+		double replayed_;
+};
+
+#endif
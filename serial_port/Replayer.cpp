@@ -0,0 +1,143 @@
+#include "Replayer.h"
+#include "Logger.h"
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+Replayer::Replayer(boost::asio::io_context &ioc, const boost::shared_ptr<SerialPort> &port, const Options &options)
+	: ReplayBase(ioc, options.speed, options.report, "Replay"), port_(port), options_(options), reader_(options.file),
+	first_(0), last_(std::numeric_limits<boost::uint64_t>::max()), pending_(false)
+{
+	if (options_.speed < 0)
+		throw std::invalid_argument("the replay speed can't be negative");
+
+	const double ticksPerSecond = reader_.TicksPerSecond();
+	first_ = static_cast<boost::uint64_t>(std::max(0.0, options_.from) * ticksPerSecond);
+	if (options_.to * ticksPerSecond < double(last_))
+		last_ = static_cast<boost::uint64_t>(std::max(0.0, options_.to) * ticksPerSecond);
+
+	reader_.Seek(first_); // the first block of the range is found in the index
+}
+
+void Replayer::Start()
+{
+	// Set before the first write, a completion may come in from another
+	// thread of the io_context as soon as there is one
+	if (options_.speed == 0)
+		port_->SetOnWrite(boost::bind(&Replayer::OnWrite, boost::weak_ptr<Replayer>(Self<Replayer>())));
+
+	ReplayBase::Start();
+}
+
+void Replayer::Begin()
+{
+	ReadNext();
+
+	if (options_.speed > 0)
+		Next(boost::system::error_code());
+	else
+		Fill();
+}
+
+void Replayer::OnWrite(const boost::weak_ptr<Replayer> &replayer)
+{
+	if (const boost::shared_ptr<Replayer> alive = replayer.lock())
+		alive->strand_.post(boost::bind(&Replayer::Fill, alive));
+}
+
+Replayer::Clock::time_point Replayer::Due(const CaptureRecord &record) const
+{
+	const double ns = double(record.time - first_) * 1e9 / reader_.TicksPerSecond() / options_.speed;
+	return start_ + boost::chrono::nanoseconds(static_cast<boost::int64_t>(ns));
+}
+
+bool Replayer::ReadNext()
+{
+	return pending_ = reader_.Read(record_) && record_.time < last_;
+}
+
+void Replayer::WriteRecord()
+{
+	if (!record_.data.empty())
+		port_->Write(record_.data, SerialPort::Bulk);
+
+	Written(record_.data.size(), double(record_.time - first_) / reader_.TicksPerSecond());
+}
+
+bool Replayer::PortClosed()
+{
+	if (port_->IsOpen())
+		return false;
+
+	// Nothing queued is going to be sent, the replay would wait forever
+	std::ostringstream out;
+	out << "Replay stopped, the port is closed";
+	const boost::system::error_code ec = port_->LastError();
+	if (ec)
+		out << " (" << ec.message() << ")";
+	Log(Logger::Warning, out.str());
+
+	Finish();
+	return true;
+}
+
+void Replayer::Next(const boost::system::error_code &ec)
+{
+	if (ec || stopped_ || PortClosed())
+		return;
+
+	// Every record that is due is written now, the late ones
+	// are not spread over the time that is left. One record at
+	// most is waited for busy, then the port gets the thread to
+	// send it, the timer expires at once for the next one
+	bool spun = false;
+	while (pending_) {
+		const Clock::time_point due = Due(record_);
+		Clock::time_point now = Clock::now();
+		if (due > now) {
+			if (spun || due - now > boost::chrono::microseconds(options_.spin))
+				break;
+			while ((now = Clock::now()) < due) {} // closer than the timer wakes up
+			spun = true;
+		}
+
+		lag_.Record(boost::chrono::duration_cast<boost::chrono::microseconds>(now - due).count());
+		WriteRecord();
+		ReadNext();
+	}
+
+	if (!pending_) {
+		Finish();
+		return;
+	}
+
+	timer_.expires_at(Due(record_) - boost::chrono::microseconds(options_.spin));
+	timer_.async_wait(strand_.wrap(boost::bind(&Replayer::Next, Self<Replayer>(), boost::asio::placeholders::error)));
+}
+
+void Replayer::Fill()
+{
+	if (stopped_ || finished_ || PortClosed())
+		return;
+
+	// Every write completion calls Fill() again, so the port never runs dry
+	while (pending_ && port_->Queued() < options_.window) {
+		WriteRecord();
+		ReadNext();
+	}
+
+	if (!pending_ && port_->Queued() == 0)
+		Finish(); // sent, not only queued
+}
+
+void Replayer::Describe(std::ostream &out)
+{
+	// The writes the port has coalesced, and what waiting for them cost
+	const SerialPort::WriteStatistics w = port_->GetWriteStatistics();
+	out << "; " << w.writes << " writes in " << w.portWrites << " port writes (" << w.writes - w.portWrites
+		<< " saved), held p50 " << w.delay.Percentile(50) << " us, p99 " << w.delay.Percentile(99) << " us, max "
+		<< w.delay.Max() << " us, p99 of the lanes " << w.laneDelay[SerialPort::Control].Percentile(99) << "/"
+		<< w.laneDelay[SerialPort::Normal].Percentile(99) << "/" << w.laneDelay[SerialPort::Bulk].Percentile(99)
+		<< " us, " << w.starved << " starved";
+}
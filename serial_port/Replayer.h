@@ -0,0 +1,74 @@
+#ifndef __REPLAYER_H__
+#define __REPLAYER_H__
+
+#include "ReplayBase.h"
+#include "SerialPort.h"
+#include "Capture.h"
+#include <limits>
+#include <boost/weak_ptr.hpp>
+
+// Writes a capture to a serial port. At the speed 1 the records are written
+// with the offsets they were recorded with, at 10 ten times faster, at 0.5
+// at half the speed. The times are counted from the start of the replay, so
+// a late record doesn't delay the ones after it, and the records found late
+// are written at once, each one adding its delay to the lag histogram. The
+// schedule is kept at nanoseconds on a monotonic clock, so the microseconds
+// or nanoseconds of a capture are kept. The timer may wake up later than
+// that, a record due in less than Options::spin microseconds is waited for
+// on the clock, busy. At the speed 0 the records are written back to back,
+// as fast as the port sends them: at most Options::window bytes are kept
+// queued in the port and the queue is topped up from its write completions.
+// The capture is read as it is replayed, with the read-ahead of
+// CaptureReader, and written in the Bulk lane of the port, behind the
+// messages of the other lanes. Progress is logged every Options::report
+// seconds and when the replay is over. A port that is closed, by Close()
+// or by an error it doesn't reconnect from, ends the replay with a warning
+
+class Replayer : public ReplayBase
+{
+	public:
+		struct Options
+		{
+			std::string file;
+			double from, to; // seconds since the start of the capture
+			double speed; // 0 == as fast as possible
+			size_t window; // bytes queued in the port at the speed 0
+			unsigned int spin; // microseconds, 0 == the timer only
+			int report; // seconds
+
+			Options() : from(0), to(std::numeric_limits<double>::infinity()),
+				speed(1), window(4096), spin(0), report(5) {}
+		};
+
+		// The capture is opened at once, throws if it can't be read. The
+		// write handler of the port is taken by Start() at the speed 0
+		Replayer(boost::asio::io_context &ioc, const boost::shared_ptr<SerialPort> &port, const Options &options);
+
+		void Start(); // takes the write handler of the port first
+
+	private:
+		virtual void Begin();
+		virtual void Describe(std::ostream &out);
+
+		// The port keeps its write handler for its whole life, a weak
+		// pointer doesn't keep the replayer alive with it
+		static void OnWrite(const boost::weak_ptr<Replayer> &replayer);
+
+		Clock::time_point Due(const CaptureRecord &record) const;
+		bool ReadNext();
+		void WriteRecord();
+
+		bool PortClosed(); // finishes the replay if it is
+		void Next(const boost::system::error_code &ec); // timed replay
+		void Fill(); // the speed 0
+
+		const boost::shared_ptr<SerialPort> port_;
+		const Options options_;
+
+		CaptureReader reader_; // on the strand
+		boost::uint64_t first_, last_; // the range in ticks
+		CaptureRecord record_; // the next one to write
+		bool pending_;
+};
+
+#endif
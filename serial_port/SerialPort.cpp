@@ -1,6 +1,19 @@
 #include "SerialPort.h"
+#include <sstream>
+#include <algorithm>
 #include <boost/bind.hpp>
 
+#if defined(__linux__)
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
 // The Flush() method can be useful to clear all characters pending on the serial port,
 // especially when communication is first begun or upon an error condition. This does not
 // appear to be provided by Asio, but can be implemented, as was inspired by
@@ -32,31 +45,86 @@ void SerialPort::SetErrorCode(const boost::system::error_code &ec)
 	}
 }
 
-void SerialPort::ReadBegin()
+void SerialPort::ReadBegin(unsigned int generation)
 {
+	boost::mutex::scoped_lock lock(stateMutex_);
+	if (!connected_ || generation != generation_)
+		return; // closed, or down, or opened again: Reopen() starts the reads
+
 	serialPort_.async_read_some(boost::asio::buffer(readBuffer_),
 		boost::bind(&SerialPort::ReadComplete, shared_from_this(),
-		boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred, generation_));
 }
 
-void SerialPort::ReadComplete(const boost::system::error_code &ec, size_t bytesTransferred)
+void SerialPort::ReadComplete(const boost::system::error_code &ec, size_t bytesTransferred, unsigned int generation)
 {
+	readTime_ = boost::chrono::steady_clock::now(); // first, for the timestamps of the handler
+
 	if (!ec) {
+		{
+			// A read of a handle that has been closed and opened again since,
+			// Reopen() has started the reads of the new one into the buffer
+			boost::mutex::scoped_lock lock(stateMutex_);
+			if (generation != generation_)
+				return;
+		}
+
 		if (onRead_ && (bytesTransferred > 0))
 			// callback executes before any additional reads are queued,
 			// so access to the buffer is guaranteed as the buffer won't be overwritten
 			onRead_(boost::ref(serialPort_.get_io_context()), boost::cref(readBuffer_), bytesTransferred);
 
-		ReadBegin();  // queue another read
+		ReadBegin(generation);  // queue another read
 	}
-	else { Close(); SetErrorCode(ec); }
+	else Failed(ec, generation);
 }
 
-void SerialPort::Write(const unsigned char *buffer, size_t bufferLength)
+void SerialPort::Write(const unsigned char *buffer, size_t bufferLength, Lane lane)
 {
+	if (bufferLength == 0)
+		return; // an empty message would never be written
+
+	size_t queueLimit = 0;
+	{
+		boost::mutex::scoped_lock lock(stateMutex_);
+		if (reconnectOn_ && isOpen_ && !connected_)
+			queueLimit = reconnect_.queueLimit;
+	}
+
 	{ // Obtain a lock on the write queue and copy data
 		boost::mutex::scoped_lock lock(writeQueueMutex_);
-		writeQueue_.insert(writeQueue_.end(), buffer, buffer + bufferLength);
+		WriteLane &queue = lanes_[lane];
+		queue.bytes.insert(queue.bytes.end(), buffer, buffer + bufferLength);
+		const Message message = { bufferLength, boost::chrono::steady_clock::now() };
+		queue.messages.push_back(message);
+		queued_ += bufferLength;
+		++writeStatistics_.writes;
+		writeStatistics_.bytes += bufferLength;
+
+		// While the port is down, the oldest messages of the lowest lane
+		// make room, the message just written too, if it is over the limit
+		for (int i = LaneCount - 1; queueLimit > 0 && i >= 0; --i) {
+			WriteLane &oldest = lanes_[i];
+			while (queued_ > queueLimit && !oldest.messages.empty()) {
+				const size_t size = oldest.messages.front().size;
+				oldest.bytes.erase(oldest.bytes.begin(), oldest.bytes.begin() + size);
+				oldest.messages.pop_front();
+				queued_ -= size;
+				dropped_ += size;
+			}
+		}
+
+		// Coalesced, the bytes wait for the timer unless there are enough
+		// of them; the timer is armed by the first Write() of a batch
+		if (lane != Control && coalesceDelay_ > 0 && queued_ < coalesceBytes_) {
+			if (!coalesceArmed_) {
+				coalesceArmed_ = true;
+				coalesceTimer_.expires_from_now(boost::chrono::microseconds(coalesceDelay_));
+				coalesceTimer_.async_wait(boost::bind(&SerialPort::CoalesceExpired, shared_from_this(),
+					boost::asio::placeholders::error));
+			}
+			return;
+		}
 	}
 
 	// Invoke WriteBegin() asynchronously by posting
@@ -75,42 +143,361 @@ void SerialPort::WriteBegin()
 		return;  // a write is in progress, so don't start another
 
 	boost::mutex::scoped_lock writeQueuelock(writeQueueMutex_);
-	if (writeQueue_.size() == 0)
+	if (queued_ == 0)
 		return;  // nothing to write
 
-	// allocate a larger buffer if needed
-	const std::vector<unsigned char>::size_type writeQueueSize = writeQueue_.size();
-	if (writeQueueSize > writeBuffer_.size()) writeBuffer_.resize(writeQueueSize);
-	// resize, not reserve, as copy can't create elements - only copy over existing ones
+	boost::mutex::scoped_lock stateLock(stateMutex_);
+	if (!connected_)
+		return; // the messages wait for the port to be opened again
+
+	// The lane passed over the most times goes first, if it has reached
+	// the starvation limit, then the lanes by their priority
+	int starved = -1;
+	for (int i = 0; starvation_ > 0 && i < LaneCount; ++i)
+		if (lanes_[i].passed >= starvation_ && (starved < 0 || lanes_[i].passed > lanes_[starved].passed))
+			starved = i;
+	if (starved >= 0)
+		++writeStatistics_.starved;
+
+	const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+	bool served[LaneCount] = {};
+	size_t writeSize = 0;
+	for (int k = -1; k < LaneCount; ++k) {
+		const int i = k < 0 ? starved : k;
+		if (i < 0 || (k >= 0 && i == starved))
+			continue;
+
+		// Whole messages up to the limit, the first one even if it is longer
+		WriteLane &lane = lanes_[i];
+		while (!lane.messages.empty() && (writeSize == 0 || writeLimit_ == 0 || writeSize + lane.messages.front().size <= writeLimit_)) {
+			const Message &message = lane.messages.front();
+
+			// resize, not reserve, as copy can't create elements - only copy over existing ones
+			writeBuffer_.resize(writeSize + message.size);
+			std::copy(lane.bytes.begin(), lane.bytes.begin() + message.size, writeBuffer_.begin() + writeSize);
+			lane.bytes.erase(lane.bytes.begin(), lane.bytes.begin() + message.size);
 
-	// copy the queued bytes to the write buffer, and clear the queued bytes
-	std::copy(writeQueue_.begin(), writeQueue_.end(), writeBuffer_.begin());
-	writeQueue_.clear();
+			const boost::uint64_t delay = boost::chrono::duration_cast<boost::chrono::microseconds>(now - message.time).count();
+			writeStatistics_.delay.Record(delay);
+			writeStatistics_.laneDelay[i].Record(delay);
 
-	boost::asio::async_write(serialPort_, boost::asio::buffer(writeBuffer_, writeQueueSize),
-		boost::bind(&SerialPort::WriteComplete, shared_from_this(), boost::asio::placeholders::error));
+			writeSize += message.size;
+			queued_ -= message.size;
+			served[i] = true;
+			lane.messages.pop_front();
+		}
+	}
+
+	for (int i = 0; i < LaneCount; ++i)
+		lanes_[i].passed = served[i] || lanes_[i].messages.empty() ? 0 : lanes_[i].passed + 1;
+	++writeStatistics_.portWrites;
+
+	writeSent_ = 0;
+	WriteSome();
 }
 
-void SerialPort::WriteComplete(const boost::system::error_code &ec)
+void SerialPort::WriteSome()
 {
-	if (!ec) {
-		{
-			// everything in the buffer was sent, so set the length to
-			// 0 so WriteBegin knows a write is no longer in progress
-			boost::mutex::scoped_lock lock(writeBufferMutex_);
-			writeBuffer_.clear();
+	// Not async_write: it would start the next parts from its own handlers,
+	// outside the lock, and Failed() or Close() could close the handle
+	// under them. Every part is started here, under stateMutex_
+	serialPort_.async_write_some(boost::asio::buffer(&writeBuffer_[writeSent_], writeBuffer_.size() - writeSent_),
+		boost::bind(&SerialPort::WriteComplete, shared_from_this(),
+		boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred, generation_));
+}
+
+void SerialPort::WriteComplete(const boost::system::error_code &ec, size_t bytesTransferred, unsigned int generation)
+{
+	size_t sent = 0;
+	onwrite_handler onWrite;
+	{
+		boost::mutex::scoped_lock writeBufferlock(writeBufferMutex_);
+		writeSent_ += bytesTransferred;
+
+		bool aborted = false;
+		if (!ec && writeSent_ < writeBuffer_.size()) {
+			boost::mutex::scoped_lock stateLock(stateMutex_);
+			if (connected_ && generation == generation_) {
+				WriteSome(); // the rest of it
+				return;
+			}
+			aborted = true; // the handle was closed, or opened again, since
+		}
+
+		// Sent, or given up: the rest of the buffer is lost, the messages
+		// still queued wait for the port. Either way the length is set to
+		// 0 so WriteBegin knows a write is no longer in progress
+		if (ec || aborted)
+			lost_ += writeBuffer_.size() - writeSent_;
+		else {
+			sent = writeSent_;
+			onWrite = onWrite_;
+		}
+		writeBuffer_.clear();
+		writeSent_ = 0;
+	}
+
+	if (ec)
+		Failed(ec, generation); // the one that closed the handle has done it otherwise
+
+	// more bytes to send may have arrived while the write was
+	WriteBegin(); // in progress, or the port may be open again already
+
+	if (onWrite)
+		onWrite(sent);
+}
+
+void SerialPort::Failed(const boost::system::error_code &ec, unsigned int generation)
+{
+	boost::mutex::scoped_lock lock(stateMutex_);
+	if (generation != generation_)
+		return; // of a handle closed and opened again since
+
+	if (!reconnectOn_ || !isOpen_) {
+		lock.unlock();
+		SetErrorCode(ec); Close(); // the error is set before the write handler hears of the close
+		return;
+	}
+
+	if (!connected_)
+		return; // the other operation failed first
+
+	// The other operation completes as aborted and is ignored
+	boost::system::error_code error;
+	serialPort_.cancel(error);
+	serialPort_.close(error);
+
+	connected_ = false;
+	downSince_ = boost::chrono::steady_clock::now();
+	++failures_;
+
+	reconnectDelay_ = std::min(reconnect_.delay, reconnect_.maxDelay);
+	reconnectTimer_.expires_from_now(boost::chrono::milliseconds(reconnectDelay_));
+	reconnectTimer_.async_wait(boost::bind(&SerialPort::Reopen, shared_from_this(), boost::asio::placeholders::error));
+
+	lock.unlock();
+	SetErrorCode(ec);
+}
+
+void SerialPort::Reopen(const boost::system::error_code &ec)
+{
+	if (ec)
+		return; // cancelled by Close()
+
+	boost::mutex::scoped_lock lock(stateMutex_);
+	if (!isOpen_)
+		return;
+
+	++attempts_;
+	boost::system::error_code error;
+	serialPort_.open(portName_, error);
+	if (!error)
+		error = SetOptions();
+
+	if (error) {
+		boost::system::error_code ignored;
+		serialPort_.close(ignored);
+
+		reconnectDelay_ = reconnectDelay_ > reconnect_.maxDelay / 2 ? reconnect_.maxDelay : reconnectDelay_ * 2;
+		reconnectTimer_.expires_from_now(boost::chrono::milliseconds(reconnectDelay_));
+		reconnectTimer_.async_wait(boost::bind(&SerialPort::Reopen, shared_from_this(), boost::asio::placeholders::error));
+
+		lock.unlock();
+		SetErrorCode(error);
+		return;
+	}
+
+	if (lowLatencySet_)
+		ApplyLowLatency(lowLatency_); // what the driver supports, as at first
+	error = Flush(); // as Open() does
+
+	const boost::chrono::steady_clock::duration down = boost::chrono::steady_clock::now() - downSince_;
+	downtime_ += down;
+	longestDowntime_ = std::max(longestDowntime_, down);
+
+	connected_ = true;
+	const unsigned int generation = ++generation_;
+	lock.unlock();
+	SetErrorCode(error);
+
+	if (onRead_)
+		ReadBegin(generation);
+	WriteBegin(); // what was written while the port was down
+}
+
+void SerialPort::CoalesceExpired(const boost::system::error_code &ec)
+{
+	{
+		boost::mutex::scoped_lock lock(writeQueueMutex_);
+		coalesceArmed_ = false;
+	}
+
+	if (!ec) // the queue may be empty, if enough bytes came before the timer
+		WriteBegin();
+}
+
+void SerialPort::SetOnWrite(const onwrite_handler &onWrite)
+{
+	boost::mutex::scoped_lock lock(writeBufferMutex_);
+	onWrite_ = onWrite;
+}
+
+bool SerialPort::IsOpen()
+{
+	boost::mutex::scoped_lock lock(stateMutex_);
+	return isOpen_;
+}
+
+boost::system::error_code SerialPort::LastError()
+{
+	boost::mutex::scoped_lock lock(errorCodeMutex_);
+	return errorCode_;
+}
+
+void SerialPort::SetLanes(size_t writeLimit, unsigned int starvation)
+{
+	boost::mutex::scoped_lock lock(writeQueueMutex_);
+	writeLimit_ = writeLimit;
+	starvation_ = starvation;
+}
+
+void SerialPort::SetCoalescing(unsigned int delay, size_t bytes)
+{
+	boost::mutex::scoped_lock lock(writeQueueMutex_);
+	coalesceDelay_ = delay;
+	coalesceBytes_ = bytes;
+}
+
+std::string SerialPort::SetLowLatency(const LowLatency &settings)
+{
+	// Under the lock, Reopen() and Failed() can't swap the handle meanwhile
+	boost::mutex::scoped_lock lock(stateMutex_);
+	lowLatency_ = settings;
+	lowLatencySet_ = true;
+
+	if (!isOpen_)
+		return "the port is closed";
+	if (!connected_)
+		return "the port is down, set when it is reopened";
+	return ApplyLowLatency(settings);
+}
+
+std::string SerialPort::ApplyLowLatency(const LowLatency &settings)
+{
+	std::ostringstream report;
+
+#if defined(__linux__)
+	const int fd = serialPort_.native_handle();
+
+	if (settings.asyncLowLatency) {
+		// The drivers without a serial_struct (USB CDC ACM, PTY) refuse it
+		serial_struct serial;
+		if (::ioctl(fd, TIOCGSERIAL, &serial) != 0)
+			report << "ASYNC_LOW_LATENCY not supported (" << std::strerror(errno) << ")";
+		else {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			if (::ioctl(fd, TIOCSSERIAL, &serial) != 0)
+				report << "ASYNC_LOW_LATENCY refused (" << std::strerror(errno) << ")";
+			else if (::ioctl(fd, TIOCGSERIAL, &serial) != 0 || !(serial.flags & ASYNC_LOW_LATENCY))
+				report << "ASYNC_LOW_LATENCY ignored by the driver";
+			else report << "ASYNC_LOW_LATENCY on";
+		}
+	}
+
+	if (settings.vmin >= 0 || settings.vtime >= 0) {
+		// asio reads a non-blocking descriptor, but the poll of the tty
+		// waits for VMIN bytes when VTIME is 0
+		termios tio;
+		bool set = ::tcgetattr(fd, &tio) == 0;
+		if (set) {
+			if (settings.vmin >= 0) tio.c_cc[VMIN] = cc_t(settings.vmin);
+			if (settings.vtime >= 0) tio.c_cc[VTIME] = cc_t(settings.vtime);
+			set = ::tcsetattr(fd, TCSANOW, &tio) == 0 && ::tcgetattr(fd, &tio) == 0;
+		}
+
+		if (report.tellp() > 0) report << ", ";
+		if (!set) report << "VMIN/VTIME refused (" << std::strerror(errno) << ")";
+		else report << "VMIN " << int(tio.c_cc[VMIN]) << " VTIME " << int(tio.c_cc[VTIME]);
+	}
+
+	if (settings.rxTriggerBytes >= 0) {
+		// The 8250 driver has it in sysfs, writable by root, and rounds
+		// it down to a level the UART has
+		if (report.tellp() > 0) report << ", ";
+
+		char path[PATH_MAX];
+		const std::string name = ::realpath(portName_.c_str(), path) ? path : portName_;
+		const std::string file = "/sys/class/tty/" + name.substr(name.rfind('/') + 1) + "/device/rx_trig_bytes";
+
+		std::ofstream(file.c_str()) << settings.rxTriggerBytes << std::flush;
+		std::ifstream in(file.c_str());
+		int level = -1;
+		if (!(in >> level))
+			report << "rx_trig_bytes not supported (no " << file << ")";
+		else if (level != settings.rxTriggerBytes)
+			report << "rx_trig_bytes " << level << " (" << settings.rxTriggerBytes << " asked)";
+		else report << "rx_trig_bytes " << level;
+	}
+#else
+	(void)settings;
+	report << "not supported on this system";
+#endif
+
+	return report.str();
+}
+
+SerialPort::WriteStatistics SerialPort::GetWriteStatistics()
+{
+	boost::mutex::scoped_lock lock(writeQueueMutex_);
+	return writeStatistics_;
+}
+
+void SerialPort::SetReconnect(const Reconnect &reconnect)
+{
+	boost::mutex::scoped_lock lock(stateMutex_);
+	reconnect_ = reconnect;
+	reconnectOn_ = true;
+}
+
+SerialPort::ConnectionStatistics SerialPort::GetConnectionStatistics()
+{
+	ConnectionStatistics statistics;
+	{
+		boost::mutex::scoped_lock lock(stateMutex_);
+		boost::chrono::steady_clock::duration downtime = downtime_, longest = longestDowntime_;
+		if (isOpen_ && !connected_) {
+			const boost::chrono::steady_clock::duration down = boost::chrono::steady_clock::now() - downSince_;
+			downtime += down;
+			longest = std::max(longest, down);
 		}
 
-		// more bytes to send may have arrived while the write
-		WriteBegin();		// was in progress, so check again
+		statistics.connected = connected_;
+		statistics.failures = failures_;
+		statistics.attempts = attempts_;
+		statistics.downtime = boost::chrono::duration<double>(downtime).count();
+		statistics.longestDowntime = boost::chrono::duration<double>(longest).count();
 	}
-	else { Close(); SetErrorCode(ec); }
+	{
+		boost::mutex::scoped_lock lock(writeQueueMutex_);
+		statistics.dropped = dropped_;
+	}
+	{
+		boost::mutex::scoped_lock lock(writeBufferMutex_);
+		statistics.lost = lost_;
+	}
+	return statistics;
 }
 
 SerialPort::SerialPort(boost::asio::io_context &ioService, const std::string& portName) : 
-	serialPort_(ioService, portName), // TODO:    ( )
-	isOpen_(false)
+	serialPort_(ioService, portName), portName_(portName), // TODO:    ( )
+	writeSent_(0), queued_(0), writeLimit_(0), starvation_(0),
+	coalesceTimer_(ioService), coalesceDelay_(0), coalesceBytes_(0), coalesceArmed_(false),
+	dropped_(0), lost_(0), baudRate_(0), lowLatencySet_(false),
+	isOpen_(false), connected_(true), generation_(0), reconnectOn_(false), reconnectDelay_(0),
+	reconnectTimer_(ioService), failures_(0), attempts_(0),
+	downtime_(boost::chrono::steady_clock::duration::zero()), longestDowntime_(boost::chrono::steady_clock::duration::zero())
 {
+	writeStatistics_.writes = writeStatistics_.bytes = writeStatistics_.portWrites = writeStatistics_.starved = 0;
 	readBuffer_.resize(128); // TODO:   
 }
 
@@ -118,47 +505,94 @@ void SerialPort::Open(const onread_handler &onRead, unsigned int baudRate,
 	parity par, flow_control flow, character_size siz, stop_bits bits)
 {
 		onRead_ = onRead;
-		serialPort_.set_option(boost::asio::serial_port_base::baud_rate(baudRate));
-		serialPort_.set_option(siz); serialPort_.set_option(bits);
-		serialPort_.set_option(par); serialPort_.set_option(flow);
+		baudRate_ = baudRate;
+		parity_ = par; flow_ = flow;
+		size_ = siz; stopBits_ = bits;
+
+		boost::system::error_code ec = SetOptions();
+		if (ec)
+			throw boost::system::system_error(ec);
 
-		const boost::system::error_code ec = Flush();
+		ec = Flush();
 		if (ec)
 			SetErrorCode(ec);
 
-		isOpen_ = true;
+		unsigned int generation;
+		{
+			boost::mutex::scoped_lock lock(stateMutex_);
+			isOpen_ = true;
+			generation = generation_;
+		}
 
 		if (onRead_) {
 			// don't start the async reader unless a read callback has been provided
 			// be sure shared_from_this() is only called after object is already managed
 			// in a shared_ptr, so need to fully construct, then call Open() on the ptr
-			serialPort_.get_io_context().post(boost::bind(&SerialPort::ReadBegin, shared_from_this()));
+			serialPort_.get_io_context().post(boost::bind(&SerialPort::ReadBegin, shared_from_this(), generation));
 			// want read to start from a thread in io_context
 		}
 }
 
+boost::system::error_code SerialPort::SetOptions()
+{
+	boost::system::error_code ec;
+	serialPort_.set_option(boost::asio::serial_port_base::baud_rate(baudRate_), ec);
+	if (!ec) serialPort_.set_option(size_, ec);
+	if (!ec) serialPort_.set_option(stopBits_, ec);
+	if (!ec) serialPort_.set_option(parity_, ec);
+	if (!ec) serialPort_.set_option(flow_, ec);
+	return ec;
+}
+
 SerialPort::~SerialPort() { Close(); }
 
 void SerialPort::Close()
 {
-	if (isOpen_) {
+	boost::system::error_code ec;
+	{
+		boost::mutex::scoped_lock lock(stateMutex_);
+		reconnectTimer_.cancel(ec);
+		connected_ = false;
+
+		if (!isOpen_)
+			return;
 		isOpen_ = false;
 
 		// Outstanding requests are cancelled first,
 		// and then the port itself is closed
-		boost::system::error_code ec;
 		serialPort_.cancel(ec);
 		SetErrorCode(ec);
 
 		serialPort_.close(ec);
 		SetErrorCode(ec);
 	}
+
+	{
+		boost::mutex::scoped_lock lock(writeQueueMutex_);
+		coalesceTimer_.cancel(ec);
+	}
+
+	onwrite_handler onWrite;
+	{
+		boost::mutex::scoped_lock lock(writeBufferMutex_);
+		onWrite = onWrite_;
+	}
+
+	if (onWrite)
+		onWrite(0); // nothing more is going to be sent
+}
+
+size_t SerialPort::Queued()
+{ // the write buffer holds exactly the bytes of the write in progress
+	boost::mutex::scoped_lock writeBufferlock(writeBufferMutex_);
+	boost::mutex::scoped_lock writeQueuelock(writeQueueMutex_);
+	return writeBuffer_.size() + queued_;
 }
 
-void SerialPort::Write(const std::vector<unsigned char> &buffer) {
-	Write(&buffer[0], buffer.size());
+void SerialPort::Write(const std::vector<unsigned char> &buffer, Lane lane) {
+	if (!buffer.empty()) Write(&buffer[0], buffer.size(), lane);
 }
 
-void SerialPort::Write(const std::string &buffer) {
-	Write(reinterpret_cast<const unsigned char *>(buffer.c_str()), buffer.size());
+void SerialPort::Write(const std::string &buffer, Lane lane) {
+	Write(reinterpret_cast<const unsigned char *>(buffer.c_str()), buffer.size(), lane);
 }
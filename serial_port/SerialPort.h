@@ -5,6 +5,9 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/function.hpp>
+#include <deque>
+#include <boost/chrono/chrono.hpp>
+#include "Histogram.h"
 
 class SerialPort : private boost::noncopyable,
 	public boost::enable_shared_from_this<SerialPort>
@@ -21,39 +24,196 @@ class SerialPort : private boost::noncopyable,
 		typedef boost::function<void(boost::asio::io_context &,
 			const std::vector<unsigned char> &, size_t)> onread_handler;
 
+		// Called from a thread of the io_context when a write is complete,
+		// with the number of bytes sent; the next write is already started.
+		// Called with 0 when the port is closed, so a writer waiting for the
+		// queue to drain finds out that it won't
+		typedef boost::function<void(size_t)> onwrite_handler;
+
 		void Open(const onread_handler &onRead, unsigned int baudRate, // def = 8N1 without control
 			parity par = parity(parity::none), flow_control flow = flow_control(flow_control::none),
 			character_size siz = character_size(8U), stop_bits bits = stop_bits(stop_bits::one));
 
 		void Close();
 
-		void Write(const unsigned char *buffer, size_t bufferLength);
-		void Write(const std::vector<unsigned char> &buffer);
-		void Write(const std::string &buffer);
+		// False after Close(), or after an error without reconnection; a
+		// port that reconnects stays open while it is down
+		bool IsOpen();
+		boost::system::error_code LastError(); // the last error of the port, if any
+
+		// Settings of the driver that cut the time from the arrival of the
+		// data to the completion of the read, on Linux. -1 == as it is
+		struct LowLatency
+		{
+			bool asyncLowLatency; // ASYNC_LOW_LATENCY, the tty layer passes the data on at once
+			int vmin, vtime; // of termios, a read is ready after vmin bytes or vtime tenths of a second
+			int rxTriggerBytes; // the level of the receive FIFO of the UART that raises an interrupt
+
+			LowLatency() : asyncLowLatency(true), vmin(1), vtime(0), rxTriggerBytes(1) {}
+		};
+
+		// After Open(). Applies the settings that the driver supports and
+		// returns what took effect, one setting after another; what the
+		// driver or the system refuses is reported, not thrown
+		std::string SetLowLatency(const LowLatency &settings);
+
+		// Opt-in reconnection, set before Open(): a port that fails is closed
+		// and opened again, first after delay milliseconds and then after
+		// twice as long every time, up to maxDelay. The options of Open() and
+		// SetLowLatency() are set again and the reads go on. The messages
+		// written while the port is down stay queued, up to queueLimit bytes
+		// (0 == no limit), the oldest of the lowest lane are dropped beyond it
+		struct Reconnect
+		{
+			unsigned int delay, maxDelay; // milliseconds
+			size_t queueLimit;
+
+			Reconnect() : delay(100), maxDelay(10000), queueLimit(1 << 20) {}
+		};
+
+		void SetReconnect(const Reconnect &reconnect);
+
+		struct ConnectionStatistics
+		{
+			bool connected;
+			boost::uint64_t failures; // of the port, every one starts a reconnection
+			boost::uint64_t attempts; // to open it again, the successful ones too
+			double downtime, longestDowntime; // seconds, the current one included
+			boost::uint64_t dropped; // bytes over the queue limit while the port was down
+			boost::uint64_t lost; // bytes of the write in progress not sent when it failed
+		};
+
+		ConnectionStatistics GetConnectionStatistics();
+
+		// The lanes of the write queue. Every Write() is a message, the
+		// messages of a lane go in their order, the lanes by their priority:
+		// a message of a higher lane goes before the messages of the lower
+		// ones that are still queued, but never in the middle of one
+		enum Lane { Control, Normal, Bulk, LaneCount };
+
+		void Write(const unsigned char *buffer, size_t bufferLength, Lane lane = Normal);
+		void Write(const std::vector<unsigned char> &buffer, Lane lane = Normal);
+		void Write(const std::string &buffer, Lane lane = Normal);
+
+		// writeLimit is the most bytes in one write of the port, whole
+		// messages only, so that a Control message waits behind no more than
+		// that (0 == all the queued messages in one write). A lane passed
+		// over for starvation writes goes first in the next one (0 == never)
+		void SetLanes(size_t writeLimit, unsigned int starvation);
+
+		// Lets a writer that produces data faster than the port sends it wait
+		// for the queue to drain instead of growing it; may be set at any time
+		void SetOnWrite(const onwrite_handler &onWrite);
+		size_t Queued(); // bytes given to Write() and not sent yet
+
+		// Opt-in coalescing of small writes: the bytes given to Write() wait
+		// for more until bytes are queued or the first of them has waited
+		// delay microseconds, and then go to the port in one write. Set
+		// before the first Write(), delay 0 == every Write() starts a write.
+		// The Control messages never wait
+		void SetCoalescing(unsigned int delay, size_t bytes);
+
+		struct WriteStatistics
+		{
+			boost::uint64_t writes, bytes; // Write() calls
+			boost::uint64_t portWrites; // writes started on the port, the rest were coalesced
+			boost::uint64_t starved; // writes that a starved lane went first in
+			Histogram delay; // microseconds from Write() to the start of the write that sends it
+			Histogram laneDelay[LaneCount]; // the same, of every lane
+		};
+
+		WriteStatistics GetWriteStatistics();
+
+		// When the read passed to the onread handler completed, taken before
+		// the handler is called; valid in the handler only
+		boost::chrono::steady_clock::time_point ReadTime() const { return readTime_; }
 
 	private:
 		// Clear all characters pending on the serial port
 		boost::system::error_code Flush();
+		boost::system::error_code SetOptions(); // of Open()
+		std::string ApplyLowLatency(const LowLatency &settings); // with stateMutex_ held
 
 		void WriteBegin();
-		void WriteComplete(const boost::system::error_code &ec);
-		void ReadComplete(const boost::system::error_code &ec, size_t bytesTransferred);
-		void ReadBegin();
+		void WriteSome(); // the rest of writeBuffer_, with writeBufferMutex_ and stateMutex_ held
+		void CoalesceExpired(const boost::system::error_code &ec);
+		void WriteComplete(const boost::system::error_code &ec, size_t bytesTransferred, unsigned int generation);
+		void ReadComplete(const boost::system::error_code &ec, size_t bytesTransferred, unsigned int generation);
+		void ReadBegin(unsigned int generation); // of the handle to read, nothing if it is no longer the current one
+
+		// Closes the port, or starts to reconnect it, on an error of a read
+		// or a write of the generation of the handle
+		void Failed(const boost::system::error_code &ec, unsigned int generation);
+		void Reopen(const boost::system::error_code &ec);
 
 		void SetErrorCode(const boost::system::error_code &ec); // Locked by mutex
 
 		boost::asio::serial_port serialPort_;
+		const std::string portName_;
+
+		struct Message
+		{
+			size_t size;
+			boost::chrono::steady_clock::time_point time; // of the Write()
+		};
+
+		struct WriteLane
+		{
+			std::deque<unsigned char> bytes;
+			std::deque<Message> messages;
+			unsigned int passed; // writes that left its messages queued
+
+			WriteLane() : passed(0) {}
+		};
 
 		boost::mutex writeQueueMutex_, writeBufferMutex_;
-		std::vector<unsigned char> writeQueue_, writeBuffer_;
+		std::vector<unsigned char> writeBuffer_;
+		size_t writeSent_; // of writeBuffer_
+		onwrite_handler onWrite_; // locked by writeBufferMutex_
+
+		// Locked by writeQueueMutex_
+		WriteLane lanes_[LaneCount];
+		size_t queued_; // bytes in all the lanes
+		size_t writeLimit_;
+		unsigned int starvation_;
+		boost::asio::basic_waitable_timer<boost::chrono::steady_clock> coalesceTimer_;
+		unsigned int coalesceDelay_; // microseconds
+		size_t coalesceBytes_;
+		bool coalesceArmed_;
+		WriteStatistics writeStatistics_;
+		boost::uint64_t dropped_; // see ConnectionStatistics
+		boost::uint64_t lost_; // locked by writeBufferMutex_
 
 		std::vector<unsigned char> readBuffer_;
+		boost::chrono::steady_clock::time_point readTime_;
 		onread_handler onRead_;
 
 		boost::mutex errorCodeMutex_;
 		boost::system::error_code errorCode_;
 
-		bool isOpen_;
+		// The options of Open() and SetLowLatency(), set again on reopening
+		unsigned int baudRate_;
+		parity parity_;
+		flow_control flow_;
+		character_size size_;
+		stop_bits stopBits_;
+		LowLatency lowLatency_;
+		bool lowLatencySet_;
+
+		// Locked by stateMutex_, taken after the write mutexes, the reads
+		// and the writes are started under it, so the handle is never
+		// closed or opened again in the middle of it
+		boost::mutex stateMutex_;
+		bool isOpen_; // by Open(), until Close()
+		bool connected_; // the handle is open
+		unsigned int generation_; // of the handle, a completion of an older one is of no interest
+		bool reconnectOn_;
+		Reconnect reconnect_;
+		unsigned int reconnectDelay_; // milliseconds
+		boost::asio::basic_waitable_timer<boost::chrono::steady_clock> reconnectTimer_;
+		boost::chrono::steady_clock::time_point downSince_;
+		boost::uint64_t failures_, attempts_;
+		boost::chrono::steady_clock::duration downtime_, longestDowntime_;
 };
 
 #endif
@@ -0,0 +1,247 @@
+// SerialPort_analyze.cpp: Offline statistics of capture files
+//
+// Reads a capture written by SerialPort_rw and reports the offsets between
+// the reads (the inter-arrival times of OnRead()), the sizes of the reads,
+// the bytes per second and the silences longer than --gap. The capture is
+// split into chunks of whole blocks, found in its index, and the chunks are
+// decoded in parallel on the threads of an Executor, each one by a
+// CaptureReader of its own. Every chunk fills statistics of its own, they
+// are merged in the order of the chunks, so the offset across the boundary
+// of two chunks is counted as well. The captures of the older versions have
+// no blocks and are read by one thread
+
+#include "Executor.h"
+#include "Logger.h"
+#include "Capture.h"
+#include "Histogram.h"
+#include <map>
+#include <limits>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace
+{
+	struct Gap
+	{
+		boost::uint64_t start, length; // ticks
+
+		bool operator<(const Gap &other) const { return length > other.length; } // the longest first
+	};
+}
+
+class CaptureStatistics : private boost::noncopyable
+{
+	const unsigned int ticksPerSecond_;
+	const boost::uint64_t gapTicks_;
+
+	void Offset(boost::uint64_t from, boost::uint64_t to)
+	{
+		const boost::uint64_t ticks = to - from;
+		offsets.Record(ConvertTicks(ticks, ticksPerSecond_, 1000000));
+
+		if (ticks >= gapTicks_) {
+			const Gap gap = { from, ticks };
+			gaps.push_back(gap);
+		}
+	}
+
+public:
+	Histogram offsets, sizes; // microseconds, bytes
+	std::map<boost::uint64_t, boost::uint64_t> bytesPerSecond; // second of the capture => bytes
+	std::vector<Gap> gaps;
+	boost::uint64_t records, bytes, first, last; // times in ticks
+
+	CaptureStatistics(unsigned int ticksPerSecond, boost::uint64_t gapTicks)
+		: ticksPerSecond_(ticksPerSecond), gapTicks_(gapTicks), records(0), bytes(0), first(0), last(0) {}
+
+	void Add(boost::uint64_t time, std::size_t size)
+	{
+		if (records > 0) Offset(last, time);
+		else first = time;
+
+		sizes.Record(size);
+		bytesPerSecond[time / ticksPerSecond_] += size;
+
+		++records;
+		bytes += size;
+		last = time;
+	}
+
+	// The statistics of the chunk that follows this one
+	void Merge(const CaptureStatistics &next)
+	{
+		if (next.records == 0) return;
+
+		if (records > 0) Offset(last, next.first);
+		else first = next.first;
+
+		offsets.Merge(next.offsets);
+		sizes.Merge(next.sizes);
+		for (std::map<boost::uint64_t, boost::uint64_t>::const_iterator i = next.bytesPerSecond.begin(); i != next.bytesPerSecond.end(); ++i)
+			bytesPerSecond[i->first] += i->second;
+		gaps.insert(gaps.end(), next.gaps.begin(), next.gaps.end());
+
+		records += next.records;
+		bytes += next.bytes;
+		last = next.last;
+	}
+
+	// The bytes of every second from the first to the last, the silent ones included
+	Histogram Rates() const
+	{
+		Histogram rates;
+		if (records == 0) return rates;
+
+		boost::uint64_t second = first / ticksPerSecond_;
+		for (std::map<boost::uint64_t, boost::uint64_t>::const_iterator i = bytesPerSecond.begin(); i != bytesPerSecond.end(); ++i) {
+			if (i->first > second) rates.Record(0, i->first - second);
+			rates.Record(i->second);
+			second = i->first + 1;
+		}
+		return rates;
+	}
+};
+
+struct CaptureChunk
+{
+	boost::uint64_t from, to; // [from, to) in ticks
+	boost::shared_ptr<CaptureStatistics> statistics;
+	std::string error;
+};
+
+// Run on a thread of the Executor, the readers of the chunks share nothing
+void AnalyzeChunk(const std::string &file, CaptureChunk &chunk)
+{
+	try
+	{
+		CaptureReader reader(file);
+		reader.Seek(chunk.from);
+
+		CaptureRecord record;
+		while (reader.Read(record) && record.time < chunk.to)
+			chunk.statistics->Add(record.time, record.data.size());
+	}
+	catch (const std::exception &e)
+	{
+		chunk.error = e.what();
+	}
+}
+
+void PrintHistogram(const char *name, const Histogram &h)
+{
+	std::cout << std::setw(16) << std::left << name << std::right
+		<< std::setw(12) << h.Min() << std::setw(12) << h.Percentile(50) << std::setw(12) << h.Percentile(90)
+		<< std::setw(12) << h.Percentile(99) << std::setw(12) << h.Percentile(99.9) << std::setw(12) << h.Max()
+		<< std::setw(14) << std::fixed << std::setprecision(1) << h.Mean() << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::string file, logLevel;
+		int threads, chunks, top;
+		double gap;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("file,f", boost::program_options::value<std::string>(&file)->required(), "capture to analyze (required)")
+			("threads,t", boost::program_options::value<int>(&threads)->default_value(-1), "threads of the Executor (-1 == number of CPUs)")
+			("chunks,c", boost::program_options::value<int>(&chunks)->default_value(0), "chunks to split the capture into (0 == 4 per thread)")
+			("gap,g", boost::program_options::value<double>(&gap)->default_value(1), "shortest silence reported, seconds")
+			("top", boost::program_options::value<int>(&top)->default_value(10), "longest silences listed")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << "\n";
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		Logger::Instance().Start(Logger::ParseLevel(logLevel));
+
+		CaptureReader capture(file);
+		const unsigned int ticksPerSecond = capture.TicksPerSecond();
+		const boost::uint64_t gapTicks = static_cast<boost::uint64_t>(gap * ticksPerSecond);
+
+		if (threads <= 0) threads = std::max(1U, boost::thread::hardware_concurrency());
+		if (chunks <= 0) chunks = 4 * threads; // so that a slow chunk doesn't keep the other threads idle
+
+		// Every chunk starts at the first record of one of the blocks
+		const std::vector<boost::uint64_t> blocks = capture.BlockTimes();
+		std::vector<CaptureChunk> parts;
+		const std::size_t n = std::max<std::size_t>(1, std::min<std::size_t>(chunks, blocks.size()));
+		for (std::size_t i = 0; i < n; ++i) {
+			const boost::uint64_t from = i == 0 ? 0 : blocks[i * blocks.size() / n];
+			if (!parts.empty() && from <= parts.back().from) continue; // blocks of the same time
+
+			if (!parts.empty()) parts.back().to = from;
+			CaptureChunk chunk;
+			chunk.from = from;
+			chunk.to = std::numeric_limits<boost::uint64_t>::max();
+			chunk.statistics.reset(new CaptureStatistics(ticksPerSecond, gapTicks));
+			parts.push_back(chunk);
+		}
+
+		Executor e;
+		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(Logger::Error, std::string("Exception (asio): ") + ex.what()); };
+		for (std::size_t i = 0; i < parts.size(); ++i)
+			e.GetIOContext().post(boost::bind(&AnalyzeChunk, boost::cref(file), boost::ref(parts[i])));
+
+		const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+		e.Run(threads); // returns when all the chunks are done
+		const double elapsed = boost::chrono::duration<double>(boost::chrono::steady_clock::now() - start).count();
+
+		CaptureStatistics total(ticksPerSecond, gapTicks);
+		for (std::size_t i = 0; i < parts.size(); ++i) {
+			if (!parts[i].error.empty())
+				Log(Logger::Error, "Chunk " + boost::lexical_cast<std::string>(i) + ": " + parts[i].error);
+			total.Merge(*parts[i].statistics);
+		}
+
+		const double seconds = double(total.last - total.first) / ticksPerSecond;
+		std::cout << file << (capture.IsLegacy() ? " (legacy)" : "") << ": " << total.records << " reads, "
+			<< total.bytes << " bytes in " << std::fixed << std::setprecision(3) << seconds << " s";
+		if (!capture.StartTime().is_not_a_date_time())
+			std::cout << " from " << boost::posix_time::to_simple_string(capture.StartTime() +
+				boost::posix_time::microseconds(static_cast<boost::int64_t>(ConvertTicks(total.first, ticksPerSecond, 1000000))));
+		std::cout << std::endl << blocks.size() << " blocks in " << parts.size() << " chunks on " << threads
+			<< " threads: " << std::setprecision(2) << elapsed << " s, " << std::setprecision(0)
+			<< total.records / std::max(elapsed, 1e-9) << " reads/s, " << std::setprecision(1)
+			<< total.bytes / std::max(elapsed, 1e-9) / 1e6 << " MB/s decoded" << std::endl << std::endl;
+
+		std::cout << "                         min         p50         p90         p99        p999         max          mean" << std::endl;
+		PrintHistogram("offset us", total.offsets);
+		PrintHistogram("read bytes", total.sizes);
+		PrintHistogram("bytes/s", total.Rates());
+
+		std::sort(total.gaps.begin(), total.gaps.end());
+		boost::uint64_t silent = 0;
+		for (std::size_t i = 0; i < total.gaps.size(); ++i) silent += total.gaps[i].length;
+
+		std::cout << std::endl << total.gaps.size() << " silences of " << std::setprecision(3) << gap
+			<< " s or longer, " << double(silent) / ticksPerSecond << " s in all" << std::endl;
+		for (std::size_t i = 0; i < total.gaps.size() && int(i) < top; ++i)
+			std::cout << "  " << std::setw(12) << double(total.gaps[i].length) / ticksPerSecond
+				<< " s after " << std::setw(12) << double(total.gaps[i].start) / ticksPerSecond << " s" << std::endl;
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Unknown exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,376 @@
+// SerialPort_bridge.cpp: Publishes the data read from a serial port to TCP clients
+//
+// Every chunk delivered by the read handler of SerialPort is copied once out
+// of the read buffer (which is reused by the next read) into a reference
+// counted buffer, and that single buffer is queued to every connected client.
+// Every client has a bounded queue of chunks and writes them with one gather
+// write per batch. When a client can't keep up, the new chunks are either
+// dropped for that client or the client is disconnected (--policy), so a slow
+// reader never holds the serial read loop or the other clients
+
+#include "Executor.h"
+#include "SerialPort.h"
+#include "Logger.h"
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+using boost::asio::ip::tcp;
+
+typedef boost::shared_ptr<const std::vector<unsigned char>> Chunk;
+
+enum SlowClientPolicy { DropChunks, Disconnect };
+
+class BridgeServer;
+
+class BridgeClient : private boost::noncopyable,
+	public boost::enable_shared_from_this<BridgeClient>
+{
+	enum { MaxGather = 64 }; // chunks written by one async_write()
+
+	tcp::socket socket_;
+	boost::asio::io_context::strand strand_; // the socket operations
+	BridgeServer &server_;
+	const std::string name_;
+
+	const std::size_t maxChunks_;
+	const SlowClientPolicy policy_;
+
+	boost::mutex queueMutex_; // Deliver() is called from the serial read handler
+	std::deque<Chunk> queue_;
+	bool writing_, closed_;
+
+	std::vector<Chunk> inflight_; // keep the chunks alive while they are written
+	boost::array<char, 64> readBuffer_; // the input of the client is discarded
+
+	boost::uint64_t bytesSent_, dropped_;
+
+	void ReadBegin();
+	void ReadComplete(const boost::system::error_code &ec);
+	void WriteBegin();
+	void WriteComplete(const boost::system::error_code &ec, size_t bytesTransferred);
+	void Close(const std::string &reason);
+
+public:
+	BridgeClient(boost::asio::io_context &ioc, BridgeServer &server,
+		std::size_t maxChunks, SlowClientPolicy policy, const std::string &name)
+		: socket_(ioc), strand_(ioc), server_(server), name_(name), maxChunks_(maxChunks),
+		policy_(policy), writing_(false), closed_(false), bytesSent_(0), dropped_(0) {}
+
+	tcp::socket &Socket() { return socket_; }
+	void Start() { strand_.dispatch(boost::bind(&BridgeClient::ReadBegin, shared_from_this())); }
+
+	// Queue the chunk without blocking, returns false if it was not queued
+	bool Deliver(const Chunk &chunk);
+};
+
+class BridgeServer : private boost::noncopyable
+{
+	boost::asio::io_context &ioc_;
+	tcp::acceptor acceptor_;
+	boost::asio::deadline_timer reportTimer_;
+
+	const std::size_t maxClients_, maxChunks_;
+	const SlowClientPolicy policy_;
+
+	boost::mutex clientsMutex_; // the list and the counters below
+	std::vector<boost::shared_ptr<BridgeClient>> clients_;
+	boost::uint64_t chunks_, bytes_, dropped_, accepted_, disconnected_;
+
+	void StartAccept();
+	void HandleAccept(boost::shared_ptr<BridgeClient> client, const boost::system::error_code &ec);
+	void StartReport();
+	void HandleReport(const boost::system::error_code &ec);
+
+public:
+	BridgeServer(boost::asio::io_context &ioc, unsigned short port,
+		std::size_t maxClients, std::size_t maxChunks, SlowClientPolicy policy);
+
+	// onread_handler of the serial port
+	void Publish(boost::asio::io_context &ioc, const std::vector<unsigned char> &buffer, size_t bytesRead);
+
+	void Remove(const boost::shared_ptr<BridgeClient> &client);
+};
+
+bool BridgeClient::Deliver(const Chunk &chunk)
+{
+	bool disconnect = false;
+	{
+		boost::mutex::scoped_lock lock(queueMutex_);
+		if (closed_)
+			return false;
+
+		if (queue_.size() < maxChunks_) {
+			queue_.push_back(chunk);
+			if (writing_)
+				return true; // WriteComplete() will take it
+
+			writing_ = true;
+		}
+		else {
+			++dropped_;
+			if (policy_ == DropChunks)
+				return false;
+
+			closed_ = disconnect = true; // no more chunks, the client is disconnected below
+		}
+	}
+
+	if (disconnect)
+		strand_.post(boost::bind(&BridgeClient::Close, shared_from_this(), std::string("too slow")));
+	else
+		strand_.post(boost::bind(&BridgeClient::WriteBegin, shared_from_this()));
+
+	return !disconnect;
+}
+
+void BridgeClient::WriteBegin()
+{
+	std::vector<boost::asio::const_buffer> buffers;
+	{
+		boost::mutex::scoped_lock lock(queueMutex_);
+		if (closed_ || queue_.empty()) {
+			writing_ = false;
+			return;
+		}
+
+		// Everything queued so far goes in one write, the chunks of
+		// a serial port are small and a write per chunk is expensive
+		while (!queue_.empty() && inflight_.size() < MaxGather) {
+			inflight_.push_back(queue_.front());
+			queue_.pop_front();
+		}
+	}
+
+	buffers.reserve(inflight_.size());
+	for (std::vector<Chunk>::const_iterator i = inflight_.begin(); i != inflight_.end(); ++i)
+		buffers.push_back(boost::asio::buffer(**i));
+
+	boost::asio::async_write(socket_, buffers, strand_.wrap(boost::bind(&BridgeClient::WriteComplete,
+		shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+}
+
+void BridgeClient::WriteComplete(const boost::system::error_code &ec, size_t bytesTransferred)
+{
+	inflight_.clear(); // the last reference to a chunk frees it
+	bytesSent_ += bytesTransferred;
+
+	if (!ec)
+		WriteBegin(); // more chunks may have arrived while the write was in progress
+	else
+		Close(ec.message());
+}
+
+void BridgeClient::ReadBegin()
+{
+	socket_.async_read_some(boost::asio::buffer(readBuffer_), strand_.wrap(
+		boost::bind(&BridgeClient::ReadComplete, shared_from_this(), boost::asio::placeholders::error)));
+}
+
+void BridgeClient::ReadComplete(const boost::system::error_code &ec)
+{
+	if (!ec)
+		ReadBegin();
+	else
+		Close(ec == boost::asio::error::eof ? std::string("closed by the client") : ec.message());
+}
+
+void BridgeClient::Close(const std::string &reason)
+{
+	boost::uint64_t dropped;
+	{
+		boost::mutex::scoped_lock lock(queueMutex_);
+		closed_ = true;
+		queue_.clear();
+		dropped = dropped_;
+	}
+
+	if (!socket_.is_open())
+		return; // already closed by the other operation
+
+	boost::system::error_code ec;
+	socket_.shutdown(tcp::socket::shutdown_both, ec);
+	socket_.close(ec); // the pending operations complete with operation_aborted
+
+	std::ostringstream ss;
+	ss << name_ << " disconnected (" << reason << "), " << bytesSent_
+		<< " bytes sent, " << dropped << " chunks dropped";
+	Log(Logger::Info, ss.str());
+
+	server_.Remove(shared_from_this());
+}
+
+BridgeServer::BridgeServer(boost::asio::io_context &ioc, unsigned short port,
+	std::size_t maxClients, std::size_t maxChunks, SlowClientPolicy policy)
+	: ioc_(ioc), acceptor_(ioc, tcp::endpoint(tcp::v4(), port)), reportTimer_(ioc),
+	maxClients_(maxClients), maxChunks_(maxChunks ? maxChunks : 1), policy_(policy),
+	chunks_(0), bytes_(0), dropped_(0), accepted_(0), disconnected_(0)
+{
+	StartAccept();
+	StartReport();
+}
+
+void BridgeServer::StartAccept()
+{
+	const boost::shared_ptr<BridgeClient> client(new BridgeClient(ioc_, *this,
+		maxChunks_, policy_, "client " + boost::lexical_cast<std::string>(accepted_ + 1)));
+
+	acceptor_.async_accept(client->Socket(), boost::bind(&BridgeServer::HandleAccept,
+		this, client, boost::asio::placeholders::error));
+}
+
+void BridgeServer::HandleAccept(boost::shared_ptr<BridgeClient> client, const boost::system::error_code &ec)
+{
+	if (!ec) {
+		boost::system::error_code error;
+		const tcp::endpoint remote = client->Socket().remote_endpoint(error);
+		client->Socket().set_option(tcp::no_delay(true), error);
+
+		bool accepted = false;
+		boost::uint64_t number;
+		{
+			boost::mutex::scoped_lock lock(clientsMutex_);
+			number = ++accepted_;
+			if (clients_.size() < maxClients_) {
+				clients_.push_back(client);
+				accepted = true;
+			}
+		}
+
+		if (accepted) {
+			Log(Logger::Info, "client " + boost::lexical_cast<std::string>(number) +
+				" connected from " + boost::lexical_cast<std::string>(remote));
+			client->Start();
+		}
+		else {
+			Log(Logger::Warning, "too many clients, connection from " +
+				boost::lexical_cast<std::string>(remote) + " refused");
+			client->Socket().close(error);
+		}
+	}
+
+	StartAccept();
+}
+
+void BridgeServer::Remove(const boost::shared_ptr<BridgeClient> &client)
+{
+	boost::mutex::scoped_lock lock(clientsMutex_);
+
+	// The order of the clients doesn't matter, swap with the last one and pop
+	for (std::size_t i = 0; i < clients_.size(); ++i)
+		if (clients_[i] == client) {
+			clients_[i] = clients_.back();
+			clients_.pop_back();
+			++disconnected_;
+			break;
+		}
+}
+
+void BridgeServer::Publish(boost::asio::io_context &, const std::vector<unsigned char> &buffer, size_t bytesRead)
+{
+	// The only copy of the data: the read buffer is reused by the next read
+	const Chunk chunk(boost::make_shared<std::vector<unsigned char>>(buffer.begin(), buffer.begin() + bytesRead));
+
+	boost::mutex::scoped_lock lock(clientsMutex_);
+	++chunks_;
+	bytes_ += bytesRead;
+
+	// Deliver() never blocks, it only takes the lock of the client's queue
+	for (std::size_t i = 0; i < clients_.size(); ++i)
+		if (!clients_[i]->Deliver(chunk)) ++dropped_;
+}
+
+void BridgeServer::StartReport()
+{
+	reportTimer_.expires_from_now(boost::posix_time::seconds(10));
+	reportTimer_.async_wait(boost::bind(&BridgeServer::HandleReport, this, boost::asio::placeholders::error));
+}
+
+void BridgeServer::HandleReport(const boost::system::error_code &ec)
+{
+	if (ec) return;
+
+	std::ostringstream ss;
+	{
+		boost::mutex::scoped_lock lock(clientsMutex_);
+		ss << "clients: " << clients_.size() << " (" << accepted_ << " accepted, " << disconnected_
+			<< " disconnected), serial: " << chunks_ << " chunks, " << bytes_ << " bytes, "
+			<< dropped_ << " client deliveries dropped";
+	}
+	Log(Logger::Info, ss.str());
+
+	StartReport();
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::string portName, policy, logLevel;
+		int baudRate;
+		unsigned short listenPort;
+		std::size_t maxClients, maxChunks;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("port,p", boost::program_options::value<std::string>(&portName)->required(), "port name (required)")
+			("baud,b", boost::program_options::value<int>(&baudRate)->required(), "baud rate (required)")
+			("listen", boost::program_options::value<unsigned short>(&listenPort)->default_value(10110), "TCP port to listen on")
+			("clients", boost::program_options::value<std::size_t>(&maxClients)->default_value(64), "maximum number of clients")
+			("queue", boost::program_options::value<std::size_t>(&maxChunks)->default_value(256), "maximum number of chunks queued to a client")
+			("policy", boost::program_options::value<std::string>(&policy)->default_value("drop"),
+				"when the queue of a client is full: drop (the new chunks) or disconnect")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.empty() || vm.count("help")) {
+			std::cout << desc << "\n";
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		if (policy != "drop" && policy != "disconnect")
+			throw std::invalid_argument("unknown policy: " + policy);
+
+		Logger::Instance().Start(Logger::ParseLevel(logLevel));
+
+		Executor e;
+		e.OnWorkerThreadError = [](boost::asio::io_context &, boost::system::error_code ec) { Log(Logger::Error, std::string("Error (asio): ") + boost::lexical_cast<std::string>(ec)); };
+		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(Logger::Error, std::string("Exception (asio): ") + ex.what()); };
+
+		BridgeServer server(e.GetIOContext(), listenPort, maxClients, maxChunks,
+			policy == "drop" ? DropChunks : Disconnect);
+
+		boost::shared_ptr<SerialPort> serialPort;
+		e.OnRun = [&](boost::asio::io_context &ioc) {
+			try
+			{
+				serialPort.reset(new SerialPort(ioc, portName));
+				serialPort->Open(boost::bind(&BridgeServer::Publish, &server, _1, _2, _3), baudRate);
+				Log(Logger::Info, portName + " is bridged to TCP port " + boost::lexical_cast<std::string>(listenPort));
+			}
+			catch (const std::exception &ex)
+			{
+				Log(Logger::Error, ex.what());
+			}
+		};
+
+		e.Run();
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,610 @@
+// SerialPort_mcast.cpp: Distributes the data read from a serial port by UDP multicast
+//
+// The publisher (--mode pub) packs the chunks of the serial read handler into
+// datagrams of up to one MTU. A datagram is sent when it is full or when its
+// first byte has waited for --linger milliseconds. Every datagram carries a
+// header with the session of the publisher, a sequence number and the time
+// it was sent. A datagram is sent once to the group, the network copies it,
+// so the cost of the publisher does not depend on the number of listeners.
+// The receiver (--mode sub) joins the group, puts the datagrams back in order
+// within a small window, gives a gap up when the window is full or when a
+// datagram has waited behind it for --hold milliseconds, counts the gaps and
+// writes the reassembled stream to a file or to the log. A loss at the very
+// end of the stream has nothing behind it and is not seen. --mode bench
+// runs a publisher fed by a generator and a receiver in one process over the
+// loopback interface and reports the sustained throughput, the loss and the
+// latency. The generator does not run ahead of the receiver, so the throughput
+// is the one the receiver keeps up with
+
+#include "Executor.h"
+#include "SerialPort.h"
+#include "Logger.h"
+#include "Histogram.h"
+#include "TimeProtocol.h"
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+using boost::asio::ip::udp;
+
+namespace
+{
+	// The header of a datagram, all fields in network byte order:
+	// magic (4), session (4), sequence (8), time sent (8, see TimeProtocol),
+	// payload length (2), reserved (2)
+	const boost::uint32_t Magic = 0x53455231; // "SER1"
+	enum { HeaderSize = 28, MaxPayload = 1500 - 20 - 8 - HeaderSize }; // Ethernet MTU - IP - UDP
+
+	void Put(unsigned char *p, boost::uint64_t v, int bytes)
+	{
+		for (int i = bytes - 1; i >= 0; --i, v >>= 8) p[i] = (unsigned char)v;
+	}
+
+	boost::uint64_t Get(const unsigned char *p, int bytes)
+	{
+		boost::uint64_t v = 0;
+		for (int i = 0; i < bytes; ++i) v = (v << 8) | p[i];
+		return v;
+	}
+
+	typedef boost::shared_ptr<std::vector<unsigned char>> Datagram;
+}
+
+class McastPublisher : private boost::noncopyable
+{
+	udp::socket socket_;
+	boost::asio::io_context::strand strand_; // the sends
+	const udp::endpoint group_;
+
+	const std::size_t payload_;
+	const boost::posix_time::time_duration linger_;
+
+	boost::mutex mutex_; // the datagram being filled and the linger timer
+	Datagram current_;
+	boost::asio::deadline_timer lingerTimer_;
+	const boost::uint32_t session_;
+	boost::uint64_t sequence_;
+
+	boost::atomic<unsigned int> pending_; // datagrams handed to the strand, not sent yet
+	boost::atomic<boost::uint64_t> datagrams_, bytes_, errors_;
+
+	Datagram Seal(); // called with the mutex locked
+	void Send(Datagram datagram);
+	void HandleSend(Datagram datagram, const boost::system::error_code &ec);
+	void HandleLinger(boost::uint64_t sequence, const boost::system::error_code &ec);
+
+public:
+	McastPublisher(boost::asio::io_context &ioc, const udp::endpoint &group,
+		const boost::asio::ip::address_v4 &iface, int ttl, int lingerMs, std::size_t payload);
+
+	void Append(const unsigned char *data, std::size_t length);
+	void Flush();
+
+	// onread_handler of the serial port
+	void OnRead(boost::asio::io_context &, const std::vector<unsigned char> &buffer, size_t bytesRead) {
+		Append(&buffer[0], bytesRead);
+	}
+
+	unsigned int Pending() const { return pending_; }
+	boost::uint64_t Datagrams() const { return datagrams_; }
+	boost::uint64_t Bytes() const { return bytes_; } // the payload sent
+	boost::uint64_t Errors() const { return errors_; }
+};
+
+McastPublisher::McastPublisher(boost::asio::io_context &ioc, const udp::endpoint &group,
+	const boost::asio::ip::address_v4 &iface, int ttl, int lingerMs, std::size_t payload)
+	: socket_(ioc, udp::v4()), strand_(ioc), group_(group),
+	payload_(std::max<std::size_t>(1, std::min<std::size_t>(payload, MaxPayload))),
+	linger_(boost::posix_time::milliseconds(lingerMs)), lingerTimer_(ioc),
+	session_(boost::uint32_t(TimeProtocol::Now())), sequence_(0),
+	pending_(0), datagrams_(0), bytes_(0), errors_(0)
+{
+	socket_.set_option(boost::asio::ip::multicast::hops(ttl));
+	socket_.set_option(boost::asio::ip::multicast::enable_loopback(true));
+	if (!iface.is_unspecified())
+		socket_.set_option(boost::asio::ip::multicast::outbound_interface(iface));
+}
+
+void McastPublisher::Append(const unsigned char *data, std::size_t length)
+{
+	std::vector<Datagram> sealed;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		while (length > 0) {
+			if (!current_) {
+				current_ = boost::make_shared<std::vector<unsigned char>>();
+				current_->reserve(HeaderSize + payload_);
+				current_->resize(HeaderSize);
+
+				if (linger_ > boost::posix_time::time_duration(0, 0, 0)) {
+					// A new datagram waits for the rest of its payload at most linger_
+					lingerTimer_.expires_from_now(linger_);
+					lingerTimer_.async_wait(boost::bind(&McastPublisher::HandleLinger,
+						this, sequence_, boost::asio::placeholders::error));
+				}
+			}
+
+			const std::size_t n = std::min(length, HeaderSize + payload_ - current_->size());
+			current_->insert(current_->end(), data, data + n);
+			data += n; length -= n;
+
+			if (current_->size() == HeaderSize + payload_ || linger_ == boost::posix_time::time_duration(0, 0, 0))
+				sealed.push_back(Seal());
+		}
+	}
+
+	std::for_each(sealed.begin(), sealed.end(), boost::bind(&McastPublisher::Send, this, _1));
+}
+
+void McastPublisher::Flush()
+{
+	Datagram datagram;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (current_) datagram = Seal();
+	}
+
+	if (datagram) Send(datagram);
+}
+
+Datagram McastPublisher::Seal()
+{
+	Datagram datagram;
+	datagram.swap(current_);
+
+	unsigned char *p = &(*datagram)[0];
+	Put(p, Magic, 4); Put(p + 4, session_, 4);
+	Put(p + 8, sequence_++, 8);
+	Put(p + 16, TimeProtocol::Now(), 8);
+	Put(p + 24, datagram->size() - HeaderSize, 2); Put(p + 26, 0, 2);
+
+	return datagram;
+}
+
+void McastPublisher::HandleLinger(boost::uint64_t sequence, const boost::system::error_code &ec)
+{
+	if (ec) return; // re-armed for the next datagram
+
+	Datagram datagram;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (current_ && sequence_ == sequence)
+			datagram = Seal(); // still the datagram the timer was armed for
+	}
+
+	if (datagram) Send(datagram);
+}
+
+void McastPublisher::Send(Datagram datagram)
+{
+	++pending_;
+	// The socket is not safe for concurrent initiations, all sends go through the strand
+	strand_.post([this, datagram] {
+		socket_.async_send_to(boost::asio::buffer(*datagram), group_, strand_.wrap(boost::bind(
+			&McastPublisher::HandleSend, this, datagram, boost::asio::placeholders::error)));
+	});
+}
+
+void McastPublisher::HandleSend(Datagram datagram, const boost::system::error_code &ec)
+{
+	--pending_;
+	if (!ec) {
+		++datagrams_;
+		bytes_ += datagram->size() - HeaderSize;
+	}
+	else ++errors_;
+}
+
+class McastSubscriber : private boost::noncopyable
+{
+	udp::socket socket_;
+	boost::asio::io_context::strand strand_; // the receive chain, the flush of the window and the report
+	boost::asio::deadline_timer timer_; // the flush of the window and the report
+	const int reportSeconds_;
+	boost::posix_time::ptime nextReport_;
+
+	boost::array<unsigned char, 65536> buffer_;
+	udp::endpoint sender_;
+	std::ostream *out_; // the reassembled stream, the log if 0
+
+	// Datagrams received ahead of a gap, waiting for the missing ones
+	const std::size_t window_;
+	std::map<boost::uint64_t, std::vector<unsigned char>> pending_;
+	const boost::posix_time::time_duration hold_; // the longest wait behind a gap, 0 == until the window is full
+	boost::posix_time::ptime heldSince_; // the first datagram behind the gap arrived
+	boost::uint64_t expected_;
+	boost::uint32_t session_;
+	bool synchronised_;
+
+	boost::uint64_t bytes_, gaps_, late_, invalid_, sessions_;
+	boost::atomic<boost::uint64_t> datagrams_, lost_; // read by the generator of the benchmark
+	Histogram latency_; // microseconds, from the time in the header
+
+	void StartReceive();
+	void HandleReceive(const boost::system::error_code &ec, std::size_t length);
+	void Deliver(const unsigned char *data, std::size_t length);
+	void DeliverPending(); // the datagrams that follow the expected one
+	void SkipGap(); // the missing datagrams are not coming
+	void StartTimer();
+	void HandleTimer(const boost::system::error_code &ec);
+
+public:
+	McastSubscriber(boost::asio::io_context &ioc, const udp::endpoint &group,
+		const boost::asio::ip::address_v4 &iface, std::size_t window, int holdMs,
+		std::ostream *out, int reportSeconds = 10);
+
+	void Report(); // call through the strand, or when the io_context is stopped
+	void Stop() { strand_.post(boost::bind(&McastSubscriber::Report, this)); }
+
+	boost::uint64_t Datagrams() const { return datagrams_; }
+	boost::uint64_t Bytes() const { return bytes_; }
+	boost::uint64_t Lost() const { return lost_; }
+	const Histogram &Latency() const { return latency_; }
+};
+
+McastSubscriber::McastSubscriber(boost::asio::io_context &ioc, const udp::endpoint &group,
+	const boost::asio::ip::address_v4 &iface, std::size_t window, int holdMs, std::ostream *out, int reportSeconds)
+	: socket_(ioc), strand_(ioc), timer_(ioc), reportSeconds_(reportSeconds), out_(out),
+	window_(window ? window : 1), hold_(boost::posix_time::milliseconds(std::max(0, holdMs))),
+	expected_(0), session_(0), synchronised_(false),
+	bytes_(0), gaps_(0), late_(0), invalid_(0), sessions_(0), datagrams_(0), lost_(0)
+{
+	// Several receivers on one host share the port of the group
+	socket_.open(udp::v4());
+	socket_.set_option(udp::socket::reuse_address(true));
+	socket_.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+	socket_.bind(udp::endpoint(boost::asio::ip::address_v4::any(), group.port()));
+	socket_.set_option(boost::asio::ip::multicast::join_group(group.address().to_v4(), iface));
+
+	strand_.dispatch(boost::bind(&McastSubscriber::StartReceive, this));
+
+	nextReport_ = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(reportSeconds_);
+	if (reportSeconds_ > 0 || !hold_.is_zero()) StartTimer();
+}
+
+void McastSubscriber::StartReceive()
+{
+	socket_.async_receive_from(boost::asio::buffer(buffer_), sender_, strand_.wrap(
+		boost::bind(&McastSubscriber::HandleReceive, this,
+		boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+}
+
+void McastSubscriber::HandleReceive(const boost::system::error_code &ec, std::size_t length)
+{
+	if (ec == boost::asio::error::operation_aborted)
+		return;
+
+	if (!ec) {
+		const boost::uint64_t now = TimeProtocol::Now();
+		const unsigned char *p = buffer_.data();
+
+		if (length < HeaderSize || Get(p, 4) != Magic || Get(p + 24, 2) != length - HeaderSize) {
+			++invalid_;
+		}
+		else {
+			const boost::uint32_t session = boost::uint32_t(Get(p + 4, 4));
+			const boost::uint64_t sequence = Get(p + 8, 8);
+			const double latency = TimeProtocol::Difference(now, Get(p + 16, 8));
+			latency_.Record(boost::uint64_t(std::max(0.0, latency) * 1e6));
+
+			if (!synchronised_ || session != session_) {
+				// The first datagram, or the publisher has been restarted
+				if (synchronised_) {
+					Log(Logger::Warning, "the publisher has been restarted, "
+						+ boost::lexical_cast<std::string>(pending_.size()) + " datagrams discarded");
+					pending_.clear();
+				}
+
+				synchronised_ = true;
+				session_ = session;
+				expected_ = sequence;
+				++sessions_;
+			}
+
+			++datagrams_;
+			if (sequence == expected_) {
+				Deliver(p + HeaderSize, length - HeaderSize);
+				++expected_;
+				DeliverPending();
+			}
+			else if (sequence > expected_) {
+				if (pending_.empty())
+					heldSince_ = boost::posix_time::microsec_clock::universal_time();
+				pending_[sequence].assign(p + HeaderSize, p + length);
+
+				if (pending_.size() > window_)
+					SkipGap();
+			}
+			else ++late_; // a duplicate, or too late to be put in order
+		}
+	}
+
+	StartReceive();
+}
+
+void McastSubscriber::DeliverPending()
+{
+	bool delivered = false;
+	std::map<boost::uint64_t, std::vector<unsigned char>>::iterator i;
+	while (!pending_.empty() && (i = pending_.begin())->first == expected_) {
+		Deliver(i->second.data(), i->second.size());
+		pending_.erase(i);
+		++expected_;
+		delivered = true;
+	}
+
+	// The datagrams still held wait behind the next gap from now on
+	if (delivered && !pending_.empty())
+		heldSince_ = boost::posix_time::microsec_clock::universal_time();
+}
+
+void McastSubscriber::SkipGap()
+{
+	// Skip to the first received datagram
+	const boost::uint64_t missing = pending_.begin()->first - expected_;
+	lost_ += missing; ++gaps_;
+	Log(Logger::Debug, "gap of " + boost::lexical_cast<std::string>(missing) +
+		" datagrams at " + boost::lexical_cast<std::string>(expected_));
+
+	expected_ = pending_.begin()->first;
+	DeliverPending();
+}
+
+void McastSubscriber::Deliver(const unsigned char *data, std::size_t length)
+{
+	bytes_ += length;
+	if (out_)
+		out_->write(reinterpret_cast<const char *>(data), length);
+	else
+		Logger::Instance().WriteRaw(Logger::Info, data, length);
+}
+
+void McastSubscriber::StartTimer()
+{
+	// Twice per hold, so a datagram is held no longer than one and a half of it
+	const boost::posix_time::time_duration period = hold_.is_zero() ? boost::posix_time::seconds(reportSeconds_) :
+		std::max(hold_ / 2, boost::posix_time::time_duration(boost::posix_time::milliseconds(1)));
+
+	timer_.expires_from_now(period);
+	timer_.async_wait(strand_.wrap(boost::bind(&McastSubscriber::HandleTimer,
+		this, boost::asio::placeholders::error)));
+}
+
+void McastSubscriber::HandleTimer(const boost::system::error_code &ec)
+{
+	if (ec) return;
+
+	// A quiet publisher sends nothing that would push a gap out of the
+	// window, the end of a burst would be held until the next one
+	const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if (!hold_.is_zero() && !pending_.empty() && now - heldSince_ >= hold_)
+		SkipGap();
+
+	if (reportSeconds_ > 0 && now >= nextReport_) {
+		Report();
+		nextReport_ += boost::posix_time::seconds(reportSeconds_);
+	}
+
+	StartTimer();
+}
+
+void McastSubscriber::Report()
+{
+	std::ostringstream ss;
+	ss << "received: " << datagrams_ << " datagrams, " << bytes_ << " bytes, lost: " << lost_
+		<< " in " << gaps_ << " gaps, late: " << late_ << ", invalid: " << invalid_
+		<< ", latency, us: p50 " << latency_.Percentile(50) << ", p99 " << latency_.Percentile(99)
+		<< ", max " << latency_.Max();
+	Log(Logger::Info, ss.str());
+}
+
+// Feeds the publisher with chunks of the size of a serial read as fast
+// as the receiver keeps up, or at the given rate, for the benchmark. The
+// generator waits while more than MaxBehind datagrams sent are neither
+// received nor counted lost, fewer than the receive buffer holds, so the
+// sustained throughput is the one of the receiver, not of the sends
+class Generator : private boost::noncopyable
+{
+	enum { ChunkSize = 128, ChunksPerRound = 64, MaxPending = 256, MaxBehind = 64, MaxStallMs = 1000 };
+
+	boost::asio::io_context &ioc_;
+	McastPublisher &publisher_;
+	const McastSubscriber &subscriber_;
+	boost::asio::deadline_timer timer_;
+	const double rate_; // bytes per second, 0 == unlimited
+
+	std::vector<unsigned char> chunk_;
+	boost::chrono::steady_clock::time_point start_, stalledSince_;
+	boost::uint64_t generated_;
+	boost::uint64_t writtenOff_; // datagrams the receiver did not get and could not count lost
+	bool stalled_;
+	boost::atomic<bool> stopped_;
+
+	bool ReceiverBehind(boost::chrono::steady_clock::time_point now)
+	{
+		const boost::uint64_t sent = publisher_.Datagrams(), seen = subscriber_.Datagrams() + subscriber_.Lost() + writtenOff_;
+		if (sent <= seen + MaxBehind) {
+			stalled_ = false;
+			return false;
+		}
+
+		// A loss with nothing sent behind it is not counted by the receiver
+		if (!stalled_) {
+			stalled_ = true;
+			stalledSince_ = now;
+		}
+		else if (now - stalledSince_ > boost::chrono::milliseconds(MaxStallMs)) {
+			writtenOff_ += sent - seen;
+			stalled_ = false;
+			return false;
+		}
+
+		return true;
+	}
+
+	void Round()
+	{
+		if (stopped_) return;
+
+		const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+		if (publisher_.Pending() < MaxPending && !ReceiverBehind(now)) {
+			const double elapsed = boost::chrono::duration<double>(now - start_).count();
+			if (rate_ <= 0 || generated_ < rate_ * elapsed) {
+				for (int i = 0; i < ChunksPerRound; ++i) {
+					chunk_[0] = (unsigned char)(generated_ / ChunkSize);
+					publisher_.Append(&chunk_[0], chunk_.size());
+					generated_ += ChunkSize;
+				}
+
+				ioc_.post(boost::bind(&Generator::Round, this));
+				return;
+			}
+		}
+
+		// Ahead of the rate, of the sends or of the receiver, wait a little
+		timer_.expires_from_now(boost::posix_time::microseconds(200));
+		timer_.async_wait(boost::bind(&Generator::Round, this));
+	}
+
+public:
+	Generator(boost::asio::io_context &ioc, McastPublisher &publisher, const McastSubscriber &subscriber, double rate)
+		: ioc_(ioc), publisher_(publisher), subscriber_(subscriber), timer_(ioc), rate_(rate),
+		chunk_(ChunkSize, 0x55), generated_(0), writtenOff_(0), stalled_(false), stopped_(false)
+	{
+		start_ = boost::chrono::steady_clock::now();
+		ioc_.post(boost::bind(&Generator::Round, this));
+	}
+
+	void Stop() { stopped_ = true; }
+};
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::string mode, portName, groupName, ifaceName, file, logLevel;
+		int baudRate, ttl, linger, seconds;
+		unsigned short groupPort;
+		std::size_t payload, window;
+		int hold;
+		double rate;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("mode,m", boost::program_options::value<std::string>(&mode)->default_value("pub"), "pub, sub or bench")
+			("port,p", boost::program_options::value<std::string>(&portName), "serial port name (pub)")
+			("baud,b", boost::program_options::value<int>(&baudRate)->default_value(9600), "baud rate (pub)")
+			("group,g", boost::program_options::value<std::string>(&groupName)->default_value("239.255.0.1"), "multicast group")
+			("group-port", boost::program_options::value<unsigned short>(&groupPort)->default_value(30001), "UDP port of the group")
+			("interface,i", boost::program_options::value<std::string>(&ifaceName)->default_value("0.0.0.0"), "address of the interface to use")
+			("ttl", boost::program_options::value<int>(&ttl)->default_value(1), "multicast TTL (pub)")
+			("linger", boost::program_options::value<int>(&linger)->default_value(2), "maximum wait for a datagram to fill, milliseconds (pub)")
+			("payload", boost::program_options::value<std::size_t>(&payload)->default_value(MaxPayload), "maximum payload of a datagram (pub)")
+			("window", boost::program_options::value<std::size_t>(&window)->default_value(32), "datagrams held to put the stream in order (sub)")
+			("hold", boost::program_options::value<int>(&hold)->default_value(50),
+				"longest wait of a datagram behind a gap, milliseconds, 0 == until the window is full (sub)")
+			("file,f", boost::program_options::value<std::string>(&file), "file to write the stream to (sub)")
+			("seconds", boost::program_options::value<int>(&seconds)->default_value(10), "duration (bench)")
+			("rate", boost::program_options::value<double>(&rate)->default_value(0),
+				"Mbit/s generated, 0 == as fast as the receiver keeps up (bench)")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << "\n";
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		if (mode == "pub" && portName.empty())
+			throw std::invalid_argument("the serial port is required to publish");
+		if (mode != "pub" && mode != "sub" && mode != "bench")
+			throw std::invalid_argument("unknown mode: " + mode);
+
+		Logger::Instance().Start(Logger::ParseLevel(logLevel));
+
+		const udp::endpoint group(boost::asio::ip::make_address_v4(groupName), groupPort);
+		const boost::asio::ip::address_v4 iface(boost::asio::ip::make_address_v4( // the benchmark is local
+			(mode == "bench" && vm["interface"].defaulted()) ? std::string("127.0.0.1") : ifaceName));
+
+		Executor e;
+		e.OnWorkerThreadError = [](boost::asio::io_context &, boost::system::error_code ec) { Log(Logger::Error, std::string("Error (asio): ") + boost::lexical_cast<std::string>(ec)); };
+		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(Logger::Error, std::string("Exception (asio): ") + ex.what()); };
+
+		if (mode == "pub") {
+			McastPublisher publisher(e.GetIOContext(), group, iface, ttl, linger, payload);
+
+			boost::shared_ptr<SerialPort> serialPort;
+			e.OnRun = [&](boost::asio::io_context &ioc) {
+				try
+				{
+					serialPort.reset(new SerialPort(ioc, portName));
+					serialPort->Open(boost::bind(&McastPublisher::OnRead, &publisher, _1, _2, _3), baudRate);
+					Log(Logger::Info, portName + " is published to " + boost::lexical_cast<std::string>(group));
+				}
+				catch (const std::exception &ex)
+				{
+					Log(Logger::Error, ex.what());
+				}
+			};
+
+			e.Run();
+		}
+		else if (mode == "sub") {
+			const boost::scoped_ptr<std::ofstream> out(file.empty() ? 0 :
+				new std::ofstream(file.c_str(), std::ios::binary));
+			McastSubscriber subscriber(e.GetIOContext(), group, iface, window, hold, out.get());
+			e.Run();
+		}
+		else {
+			// Both ends in one process, the stream is written to a
+			// file that is not open, so it is discarded
+			std::ofstream sink;
+			McastPublisher publisher(e.GetIOContext(), group, iface, ttl, linger, payload);
+			McastSubscriber subscriber(e.GetIOContext(), group, iface, window, hold, &sink, 0);
+			Generator generator(e.GetIOContext(), publisher, subscriber, rate * 1e6 / 8);
+
+			boost::asio::deadline_timer stop(e.GetIOContext(), boost::posix_time::seconds(seconds));
+			stop.async_wait([&](const boost::system::error_code &) {
+				generator.Stop();
+				publisher.Flush();
+				// Give the last datagrams some time to arrive
+				stop.expires_from_now(boost::posix_time::milliseconds(200));
+				stop.async_wait([&](const boost::system::error_code &) { e.GetIOContext().stop(); });
+			});
+
+			const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+			e.Run();
+			const double elapsed = boost::chrono::duration<double>(boost::chrono::steady_clock::now() - start).count();
+
+			std::ostringstream ss;
+			ss << "sent: " << publisher.Datagrams() << " datagrams, " << publisher.Bytes() * 8 / elapsed / 1e6
+				<< " Mbit/s, " << publisher.Errors() << " send errors" << std::endl
+				<< "received: " << subscriber.Datagrams() << " datagrams, " << subscriber.Bytes() * 8 / elapsed / 1e6
+				<< " Mbit/s, lost: " << subscriber.Lost() << std::endl
+				<< "latency, us: p50 " << subscriber.Latency().Percentile(50) << ", p99 "
+				<< subscriber.Latency().Percentile(99) << ", max " << subscriber.Latency().Max();
+			std::cout << ss.str() << std::endl;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+// SerialPort_merge.cpp: Replays the captures of several receivers together
+//
+// Every --map <capture>=<port> writes one capture to one serial port. The
+// captures are put on one time line by the wall clock times of their
+// starts and replayed by one MergedReplayer, so a record of one receiver
+// comes out before a record of another one if it was read before it. The
+// writes due within --tolerance microseconds of each other are issued
+// together, in the order they were read in. The ports are opened for
+// writing only, the program ends when everything is written
+
+#include "Executor.h"
+#include "SerialPort.h"
+#include "Logger.h"
+#include "MergedReplayer.h"
+#include <map>
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::vector<std::string> maps;
+		std::string logLevel;
+		int baudRate;
+		MergedReplayer::Options options;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("map,m", boost::program_options::value<std::vector<std::string> >(&maps)->required(),
+				"capture=port, one for every capture (required)")
+			("baud,b", boost::program_options::value<int>(&baudRate)->default_value(9600), "baud rate of all the ports")
+			("from", boost::program_options::value<double>(&options.from)->default_value(0), "replay from, seconds since the earliest start")
+			("to", boost::program_options::value<double>(&options.to), "replay up to, seconds since the earliest start")
+			("speed", boost::program_options::value<double>(&options.speed)->default_value(1), "replay speed, 2 == twice as fast as recorded")
+			("tolerance", boost::program_options::value<unsigned int>(&options.tolerance)->default_value(1000),
+				"microseconds within which the writes to the ports are issued together")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << "\n";
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		Logger::Instance().Start(Logger::ParseLevel(logLevel));
+
+		Executor e;
+		e.OnWorkerThreadError = [](boost::asio::io_context &, boost::system::error_code ec) { Log(Logger::Error, std::string("Error (asio): ") + boost::lexical_cast<std::string>(ec)); };
+		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(Logger::Error, std::string("Exception (asio): ") + ex.what()); };
+
+		// A port named by several maps is opened once
+		std::map<std::string, boost::shared_ptr<SerialPort> > ports;
+		std::vector<MergedReplayer::Source> sources;
+		for (std::size_t i = 0; i < maps.size(); ++i) {
+			const std::string::size_type eq = maps[i].rfind('=');
+			if (eq == std::string::npos || eq == 0 || eq + 1 == maps[i].size())
+				throw std::invalid_argument("--map " + maps[i] + ": capture=port expected");
+
+			const std::string portName = maps[i].substr(eq + 1);
+			boost::shared_ptr<SerialPort> &port = ports[portName];
+			if (!port) {
+				port.reset(new SerialPort(e.GetIOContext(), portName));
+				port->Open(SerialPort::onread_handler(), baudRate); // no reads, the ports only send
+			}
+
+			MergedReplayer::Source source;
+			source.file = maps[i].substr(0, eq);
+			source.port = port;
+			sources.push_back(source);
+		}
+
+		const boost::shared_ptr<MergedReplayer> replayer(new MergedReplayer(e.GetIOContext(), sources, options));
+		replayer->Start();
+
+		e.Run(); // returns when the replay is over and the ports have sent everything
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
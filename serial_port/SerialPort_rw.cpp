@@ -1,164 +1,239 @@
-#include "Executor.h"
-#include "SerialPort.h"
-#include <boost/thread.hpp>
-#include <boost/date_time.hpp>
-#include <boost/program_options.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/serialization/vector.hpp>
-
-boost::mutex cout_lock;
-void Log(const std::string &msg) {
-	boost::mutex::scoped_lock lock(cout_lock);
-	std::cout << "[" << boost::this_thread::get_id() << "] " << msg << std::endl;
-}
-
-typedef boost::tuple<
-	boost::posix_time::time_duration::tick_type,
-	std::vector<unsigned char>> WriteBufferElement;
-
-class SerialReader : private boost::noncopyable,
-	public boost::enable_shared_from_this<SerialReader>
-{
-	boost::shared_ptr<SerialPort> serialPort_;
-
-	std::string portName_;
-	unsigned int baudRate_;
-	const boost::scoped_ptr<boost::archive::text_oarchive> &oa_;
-
-	boost::posix_time::ptime lastRead_;
-
-	std::vector<WriteBufferElement> writeBuffer_;
-
-	void OnRead(boost::asio::io_context &ioc, const std::vector<unsigned char> &buffer, size_t bytesRead);
-	
-public:
-	SerialReader(const std::string &portName, int baudRate,
-		const boost::scoped_ptr<boost::archive::text_oarchive> &oa,
-		const std::vector<WriteBufferElement> &writeBuffer) : portName_(portName),
-		baudRate_(baudRate), oa_(oa), writeBuffer_(writeBuffer) {}
-
-	void Create(boost::asio::io_context &ioc)
-	{
-		try
-		{
-			serialPort_.reset(new SerialPort(ioc,  portName_));  
-			serialPort_->Open(boost::bind(&SerialReader::OnRead, shared_from_this(), _1, _2, _3), baudRate_);
-
-			ioc.post([=, &ioc] {
-				uint64_t startTime = 0;
-
-				std::for_each(writeBuffer_.begin(), writeBuffer_.end(),
-					[&](const WriteBufferElement &e) {
-					startTime += e.get<0>();
-					const boost::shared_ptr<boost::asio::deadline_timer>
-						timer(new boost::asio::deadline_timer(ioc));
-
-					timer->expires_from_now(boost::posix_time::milliseconds(startTime));
-					timer->async_wait([=](const boost::system::error_code &ec) {
-						boost::shared_ptr<boost::asio::deadline_timer> t(timer);
-						// keep the timer object alive by shared_ptr
-						serialPort_->Write(e.get<1>());	}
-					); // async_wait([..])
-				}); // for_each(.., [&])
-			}); // post([..])
-		}
-		catch (const std::exception &e)
-		{
-			std::cout << e.what() << std::endl;		
-		}
-	}
-};
-
-void SerialReader::OnRead(boost::asio::io_context &, const std::vector<unsigned char> &buffer, size_t bytesRead)
-{
-	const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
-
-	if (lastRead_ == boost::posix_time::not_a_date_time) lastRead_ = now;
-
-	const std::vector<unsigned char> v(buffer.begin(), buffer.begin()+bytesRead);
-
-	if (oa_) { 		
-		const uint64_t offset = (now-lastRead_).total_milliseconds();
-		*oa_ << offset << v;
-	}
-
-	lastRead_ = now;
-
-	std::copy(v.begin(), v.end(), std::ostream_iterator<unsigned char>(std::cout, ""));
-}
-
-int main(int argc, char *argv[])
-{
-	try
-	{
-		std::string portName, file;
-		int baudRate;
-		boost::program_options::options_description desc("Options");
-
-		desc.add_options()
-			("help,h", "help")
-			("port,p", boost::program_options::value<std::string>(&portName)->required(), "port name (required)")
-			("baud,b", boost::program_options::value<int>(&baudRate)->required(), "baud rate (required)")
-			("file,f", boost::program_options::value<std::string>(&file), "file to save to");
-
-		boost::program_options::variables_map vm;
-		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
-
-		if (vm.empty() || vm.count("help"))
-		{
-			std::cout << desc << "\n";
-
-			portName = "\\\\.\\COM1";
-			baudRate = 9600; // TODO:     
-			// return -1;
-		}
-		else boost::program_options::notify(vm);
-		// don't call notify() until ready to process errors so help alone doesn't cause an error on missing required parameters
-		// http://stackoverflow.com/questions/5395503/required-and-optional-arguments-using-boost-library-program-options
-
-		const boost::scoped_ptr<std::ostream> out(file.empty() ? 0 : new std::ofstream(file.c_str()));
-		const boost::scoped_ptr<boost::archive::text_oarchive> archive(file.empty() ? 0 : new boost::archive::text_oarchive(*out));
-
-		Executor e;
-		e.OnWorkerThreadError = [](boost::asio::io_context &, boost::system::error_code ec) { Log(std::string("Error (asio): ") + boost::lexical_cast<std::string>(ec)); };
-		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(std::string("Exception (asio): ") + ex.what()); };
-
-		e.OnWorkerThreadStart = [](boost::asio::io_context &) { Log(std::string("Start new thread (executor)")); };
-		e.OnWorkerThreadStop = [](boost::asio::io_context &) { Log(std::string("Stop the thread (executor)")); };
-
-		std::vector<WriteBufferElement> writeBuffer;
-		std::ifstream in("gps_2013-01-15_0106");
-		boost::archive::text_iarchive ia(in);
-
-		while (true)
-		{
-			try
-			{
-				WriteBufferElement e;
-				uint64_t us;
-				ia >> us >> e.get<1>();
-				e.get<0>() = us;
-				writeBuffer.push_back(e);
-			}
-			catch (const std::exception &)
-			{
-				break; // end of archive - ignore exception
-			}
-		}
-
-		const boost::shared_ptr<SerialReader> sp(new SerialReader(portName, baudRate, archive, writeBuffer));
-		// for shared_from_this() to work inside of Reader, Reader must already be managed by a smart pointer
-		e.OnRun = boost::bind(&SerialReader::Create, sp, _1);
-
-		// e.AddCtrlCHandling(); // TODO:   !!!    + 
-		e.Run(); // TODO: Ctrl-break causes an exception
-	}
-	catch (const std::exception &e)
-	{
-		std::cout << "Unknown exception (main): " << e.what() << std::endl;
-		return -1;
-	}
-
-	return 0;
-}
+#include "Executor.h"
+#include "SerialPort.h"
+#include "Logger.h"
+#include "Capture.h"
+#include "ShmRing.h"
+#include "Replayer.h"
+#include <sstream>
+#include <iomanip>
+#include <boost/thread.hpp>
+#include <boost/date_time.hpp>
+#include <boost/program_options.hpp>
+
+class SerialReader : private boost::noncopyable,
+	public boost::enable_shared_from_this<SerialReader>
+{
+	boost::shared_ptr<SerialPort> serialPort_;
+
+	std::string portName_;
+	unsigned int baudRate_;
+	const boost::scoped_ptr<CaptureWriter> &capture_;
+	const boost::scoped_ptr<ShmRingWriter> &ring_;
+
+	const Replayer::Options replay_;
+	const unsigned int coalesceDelay_;
+	const size_t coalesceBytes_;
+	const size_t writeLimit_;
+	const unsigned int starvation_;
+	const bool lowLatency_;
+	const bool reconnectOn_;
+	const SerialPort::Reconnect reconnect_;
+	boost::uint64_t failures_; // seen by the last report
+	boost::shared_ptr<Replayer> replayer_;
+
+	void OnRead(boost::asio::io_context &ioc, const std::vector<unsigned char> &buffer, size_t bytesRead);
+
+	// The writer closes a block only when the next record comes, a quiet
+	// port would keep the last records in memory until the program ends.
+	// On a thread of the io_context, so the block is only handed to the
+	// compressor, Flush() would wait for the zlib work of the queue
+	void FlushCapture(const boost::shared_ptr<boost::asio::deadline_timer> &timer)
+	{
+		try {
+			capture_->CloseBlock();
+		}
+		catch (const std::exception &e) { // the compressor has stopped, so do the flushes
+			Log(Logger::Error, std::string("Capture: ") + e.what());
+			return;
+		}
+
+		timer->expires_at(timer->expires_at() + boost::posix_time::seconds(10));
+		timer->async_wait(boost::bind(&SerialReader::FlushCapture, shared_from_this(), timer));
+	}
+
+	// Every 10 seconds the port has failed since the last one, or is down
+	void ReportConnection(const boost::shared_ptr<boost::asio::deadline_timer> &timer)
+	{
+		const SerialPort::ConnectionStatistics s = serialPort_->GetConnectionStatistics();
+		if (s.failures != failures_ || !s.connected) {
+			failures_ = s.failures;
+			std::ostringstream out;
+			out << "Port " << (s.connected ? "connected" : "down") << ": " << s.failures << " failures, "
+				<< s.attempts << " attempts to reopen, down " << std::fixed << std::setprecision(1) << s.downtime
+				<< " s, the longest " << s.longestDowntime << " s, " << s.dropped << " bytes dropped from the queue, "
+				<< s.lost << " bytes lost in the writes";
+			Log(s.connected ? Logger::Info : Logger::Warning, out.str());
+		}
+
+		timer->expires_at(timer->expires_at() + boost::posix_time::seconds(10));
+		timer->async_wait(boost::bind(&SerialReader::ReportConnection, shared_from_this(), timer));
+	}
+
+public:
+	SerialReader(const std::string &portName, int baudRate,
+		const boost::scoped_ptr<CaptureWriter> &capture,
+		const boost::scoped_ptr<ShmRingWriter> &ring,
+		const Replayer::Options &replay, unsigned int coalesceDelay, size_t coalesceBytes,
+		size_t writeLimit, unsigned int starvation, bool lowLatency,
+		bool reconnectOn, const SerialPort::Reconnect &reconnect) : portName_(portName),
+		baudRate_(baudRate), capture_(capture), ring_(ring), replay_(replay),
+		coalesceDelay_(coalesceDelay), coalesceBytes_(coalesceBytes),
+		writeLimit_(writeLimit), starvation_(starvation), lowLatency_(lowLatency),
+		reconnectOn_(reconnectOn), reconnect_(reconnect), failures_(0) {}
+
+	void Create(boost::asio::io_context &ioc)
+	{
+		try
+		{
+			serialPort_.reset(new SerialPort(ioc,  portName_));  
+			if (reconnectOn_)
+				serialPort_->SetReconnect(reconnect_);
+			serialPort_->Open(boost::bind(&SerialReader::OnRead, shared_from_this(), _1, _2, _3), baudRate_);
+			serialPort_->SetCoalescing(coalesceDelay_, coalesceBytes_);
+			serialPort_->SetLanes(writeLimit_, starvation_);
+			if (lowLatency_)
+				Log(Logger::Info, "Low latency: " + serialPort_->SetLowLatency(SerialPort::LowLatency()));
+
+			if (reconnectOn_) {
+				const boost::shared_ptr<boost::asio::deadline_timer>
+					timer(new boost::asio::deadline_timer(ioc, boost::posix_time::seconds(10)));
+				timer->async_wait(boost::bind(&SerialReader::ReportConnection, shared_from_this(), timer));
+			}
+
+			if (capture_) {
+				const boost::shared_ptr<boost::asio::deadline_timer>
+					timer(new boost::asio::deadline_timer(ioc, boost::posix_time::seconds(10)));
+				timer->async_wait(boost::bind(&SerialReader::FlushCapture, shared_from_this(), timer));
+			}
+
+			if (!replay_.file.empty()) {
+				// The capture is read while it is written to the port, only the
+				// blocks of the range are read
+				replayer_.reset(new Replayer(ioc, serialPort_, replay_));
+				replayer_->Start();
+			}
+		}
+		catch (const std::exception &e)
+		{
+			Log(Logger::Error, e.what());
+		}
+	}
+};
+
+void SerialReader::OnRead(boost::asio::io_context &, const std::vector<unsigned char> &buffer, size_t bytesRead)
+{
+	const std::vector<unsigned char> v(buffer.begin(), buffer.begin()+bytesRead);
+
+	if (capture_) // stamped with the time the read completed, not the time of this call
+		capture_->Write(capture_->Ticks(serialPort_->ReadTime()), v);
+
+	if (ring_) // the reads are chained, one writer at a time
+		ring_->Write(serialPort_->ReadTime(), v);
+
+	Logger::Instance().WriteRaw(Logger::Info, &v[0], v.size());
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::string portName, file, logLevel;
+		int baudRate;
+		Replayer::Options replay;
+		CaptureWriter::Options captureOptions;
+		unsigned int rotateMb = 0, rotateMinutes = 0;
+		bool nanoseconds = false;
+		std::string shmName;
+		std::size_t shmKb;
+		unsigned int coalesceDelay;
+		std::size_t coalesceBytes;
+		std::size_t writeLimit;
+		unsigned int starvation;
+		bool lowLatency = false;
+		bool reconnectOn = false;
+		SerialPort::Reconnect reconnect;
+		std::size_t reconnectQueueKb;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("port,p", boost::program_options::value<std::string>(&portName)->required(), "port name (required)")
+			("baud,b", boost::program_options::value<int>(&baudRate)->required(), "baud rate (required)")
+			("file,f", boost::program_options::value<std::string>(&file), "file to save to")
+			("rotate-mb", boost::program_options::value<unsigned int>(&rotateMb), "start a new segment of the capture after so many megabytes, preallocated")
+			("rotate-minutes", boost::program_options::value<unsigned int>(&rotateMinutes), "start a new segment of the capture after so many minutes")
+			("direct", boost::program_options::bool_switch(&captureOptions.direct), "write the capture past the page cache")
+			("ns", boost::program_options::bool_switch(&nanoseconds), "capture times in nanoseconds instead of microseconds")
+			("shm", boost::program_options::value<std::string>(&shmName), "shared memory ring to publish the data to (see SerialPort_shm)")
+			("shm-kb", boost::program_options::value<std::size_t>(&shmKb)->default_value(1024), "size of the shared memory ring, KiB")
+			("replay,r", boost::program_options::value<std::string>(&replay.file), "capture to write to the port")
+			("from", boost::program_options::value<double>(&replay.from)->default_value(0), "replay from, seconds since the start of the capture")
+			("to", boost::program_options::value<double>(&replay.to), "replay up to, seconds since the start of the capture")
+			("speed", boost::program_options::value<double>(&replay.speed)->default_value(1),
+				"replay speed, 2 == twice as fast as recorded, 0 == as fast as the port sends")
+			("window", boost::program_options::value<size_t>(&replay.window)->default_value(4096), "bytes queued in the port at the speed 0")
+			("spin", boost::program_options::value<unsigned int>(&replay.spin)->default_value(0),
+				"microseconds before a record is due that the replay waits for it busy, not on the timer")
+			("coalesce-us", boost::program_options::value<unsigned int>(&coalesceDelay)->default_value(0),
+				"longest wait of a write for more to send with it, microseconds (0 == no coalescing)")
+			("coalesce-bytes", boost::program_options::value<std::size_t>(&coalesceBytes)->default_value(256), "bytes that are written without waiting longer")
+			("write-limit", boost::program_options::value<std::size_t>(&writeLimit)->default_value(0),
+				"most bytes in one write to the port, so that the urgent writes wait less (0 == no limit)")
+			("starvation", boost::program_options::value<unsigned int>(&starvation)->default_value(0),
+				"writes a lower priority lane may be passed over before it goes first (0 == never)")
+			("low-latency", boost::program_options::bool_switch(&lowLatency), "low latency settings of the driver, where it has them")
+			("reconnect", boost::program_options::bool_switch(&reconnectOn), "open the port again when it fails, the writes wait for it")
+			("reconnect-ms", boost::program_options::value<unsigned int>(&reconnect.delay)->default_value(100),
+				"first wait before the port is opened again, milliseconds, doubled after every failed attempt")
+			("reconnect-max-ms", boost::program_options::value<unsigned int>(&reconnect.maxDelay)->default_value(10000), "longest wait between the attempts, milliseconds")
+			("reconnect-queue-kb", boost::program_options::value<std::size_t>(&reconnectQueueKb)->default_value(1024),
+				"most KiB of writes queued while the port is down, the oldest are dropped (0 == no limit)")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.empty() || vm.count("help"))
+		{
+			std::cout << desc << "\n";
+
+			portName = "\\\\.\\COM1";
+			baudRate = 9600; // TODO:     
+			// return -1;
+		}
+		else boost::program_options::notify(vm);
+		// don't call notify() until ready to process errors so help alone doesn't cause an error on missing required parameters
+		// http://stackoverflow.com/questions/5395503/required-and-optional-arguments-using-boost-library-program-options
+
+		Logger::Instance().Start(logLevel.empty() ? Logger::Info : Logger::ParseLevel(logLevel));
+
+		captureOptions.rotateBytes = captureOptions.preallocateBytes = boost::uint64_t(rotateMb) << 20;
+		captureOptions.rotateSeconds = rotateMinutes * 60;
+		if (nanoseconds) captureOptions.ticksPerSecond = 1000000000;
+		reconnect.queueLimit = reconnectQueueKb << 10;
+		const boost::scoped_ptr<CaptureWriter> capture(file.empty() ? 0 : new CaptureWriter(file, captureOptions));
+		const boost::scoped_ptr<ShmRingWriter> ring(shmName.empty() ? 0 : new ShmRingWriter(shmName, shmKb << 10));
+
+		Executor e;
+		e.OnWorkerThreadError = [](boost::asio::io_context &, boost::system::error_code ec) { Log(Logger::Error, std::string("Error (asio): ") + boost::lexical_cast<std::string>(ec)); };
+		e.OnWorkerThreadException = [](boost::asio::io_context &, const std::exception &ex) { Log(Logger::Error, std::string("Exception (asio): ") + ex.what()); };
+
+		e.OnWorkerThreadStart = [](boost::asio::io_context &) { Log(Logger::Info, std::string("Start new thread (executor)")); };
+		e.OnWorkerThreadStop = [](boost::asio::io_context &) { Log(Logger::Info, std::string("Stop the thread (executor)")); };
+
+		const boost::shared_ptr<SerialReader> sp(new SerialReader(portName, baudRate, capture, ring, replay, coalesceDelay, coalesceBytes, writeLimit, starvation, lowLatency, reconnectOn, reconnect));
+		// for shared_from_this() to work inside of Reader, Reader must already be managed by a smart pointer
+		e.OnRun = boost::bind(&SerialReader::Create, sp, _1);
+
+		// e.AddCtrlCHandling(); // TODO:   !!!    + 
+		e.Run(); // TODO: Ctrl-break causes an exception
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Unknown exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+// SerialPort_shm.cpp: Follows the data of a serial port from another process
+//
+// SerialPort_rw --shm <name> publishes every chunk of its read handler to a
+// ring in shared memory (see ShmRing.h). This program opens the ring and
+// tails it: the records are copied out of the mapped memory, without a
+// system call, and written to a file or to the log. When the ring is empty
+// the reader sleeps for --sleep microseconds, or spins if it is 0. The
+// records lost because the reader fell behind the writer are counted and
+// logged, and so is the latency, the time from the completion of the read
+// in the writer to the copy here
+
+#include "Logger.h"
+#include "Histogram.h"
+#include "ShmRing.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::string name, file, logLevel;
+		bool oldest = false;
+		unsigned int sleep;
+		int report;
+		boost::program_options::options_description desc("Options");
+
+		desc.add_options()
+			("help,h", "help")
+			("name,n", boost::program_options::value<std::string>(&name)->required(), "name of the ring (required)")
+			("oldest", boost::program_options::bool_switch(&oldest), "start at the oldest record in the ring, not at the next one")
+			("sleep", boost::program_options::value<unsigned int>(&sleep)->default_value(100), "microseconds to sleep when the ring is empty, 0 == spin")
+			("file,f", boost::program_options::value<std::string>(&file), "file to write the data to, instead of the log")
+			("report", boost::program_options::value<int>(&report)->default_value(5), "seconds between the statistics, 0 == never")
+			("log,l", boost::program_options::value<std::string>(&logLevel)->default_value("info"),
+				"log level (trace, debug, info, warning, error, off)");
+
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << "\n";
+			return 0;
+		}
+		boost::program_options::notify(vm);
+
+		Logger::Instance().Start(Logger::ParseLevel(logLevel));
+
+		std::ofstream out;
+		if (!file.empty()) {
+			out.open(file.c_str(), std::ios::binary);
+			if (!out) throw std::runtime_error("Can't create " + file);
+		}
+
+		ShmRingReader ring(name, oldest);
+		Log(Logger::Info, "Reading " + name + ", " + boost::lexical_cast<std::string>(ring.Capacity()) + " bytes");
+
+		ShmRecord record;
+		Histogram latency; // microseconds
+		boost::uint64_t records = 0, bytes = 0, lost = 0;
+		typedef boost::chrono::steady_clock Clock;
+		Clock::time_point next = Clock::now() + boost::chrono::seconds(report);
+
+		for (;;) {
+			// The writer closes the ring after its last record, so
+			// nothing is left if the ring is empty after the flag is seen
+			const bool closed = ring.Closed();
+			const bool read = ring.Read(record);
+
+			if (ring.Lost() != lost) {
+				Log(Logger::Warning, "Fell behind the writer, " + boost::lexical_cast<std::string>(ring.Lost() - lost) + " bytes lost");
+				lost = ring.Lost();
+			}
+
+			const Clock::time_point now = Clock::now();
+			if (report > 0 && now >= next) {
+				std::ostringstream ss;
+				ss << records << " records, " << bytes << " bytes, " << ring.Lost() << " bytes lost in "
+					<< ring.Overruns() << " overruns, latency us: p50 " << latency.Percentile(50) << ", p99 "
+					<< latency.Percentile(99) << ", max " << latency.Max();
+				Log(Logger::Info, ss.str());
+				next += boost::chrono::seconds(report);
+			}
+
+			if (read) {
+				const boost::uint64_t ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(now.time_since_epoch()).count();
+				latency.Record(ns > record.time ? (ns - record.time) / 1000 : 0);
+				++records;
+				bytes += record.data.size();
+
+				if (record.data.empty()) continue;
+				if (out.is_open()) out.write(reinterpret_cast<const char *>(&record.data[0]), record.data.size());
+				else Logger::Instance().WriteRaw(Logger::Info, &record.data[0], record.data.size());
+				continue;
+			}
+			if (closed) break;
+
+			if (sleep > 0) boost::this_thread::sleep_for(boost::chrono::microseconds(sleep));
+		}
+
+		Log(Logger::Info, "The writer has closed the ring, " + boost::lexical_cast<std::string>(records) + " records, "
+			+ boost::lexical_cast<std::string>(ring.Lost()) + " bytes lost");
+	}
+	catch (const std::exception &e)
+	{
+		std::cout << "Exception (main): " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
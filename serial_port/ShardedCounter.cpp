@@ -0,0 +1,45 @@
+#include "ShardedCounter.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <algorithm>
+
+namespace
+{
+	void KeepIndex(unsigned int *) {} // the index is stored in the pointer itself
+
+	// thread_local is not available to all the compilers of the project
+	boost::thread_specific_ptr<unsigned int> threadIndex(KeepIndex);
+	boost::atomic<unsigned int> nextIndex(0);
+}
+
+ShardedCounter::ShardedCounter(unsigned int shards)
+	: shardCount_(shards ? shards : 2 * std::max(1U, boost::thread::hardware_concurrency())),
+	shards_(new Shard[shardCount_])
+{
+}
+
+unsigned int ShardedCounter::ThreadIndex()
+{
+	// The pointer holds index + 1, as a null pointer means no index yet
+	unsigned int *index = threadIndex.get();
+	if (!index) {
+		index = reinterpret_cast<unsigned int *>(static_cast<std::size_t>(nextIndex++) + 1);
+		threadIndex.reset(index);
+	}
+
+	return static_cast<unsigned int>(reinterpret_cast<std::size_t>(index) - 1);
+}
+
+boost::uint64_t ShardedCounter::Load() const
+{
+	boost::uint64_t sum = 0;
+	for (unsigned int i = 0; i < shardCount_; ++i)
+		sum += shards_[i].value.load(boost::memory_order_relaxed);
+	return sum;
+}
+
+void ShardedCounter::Reset()
+{
+	for (unsigned int i = 0; i < shardCount_; ++i)
+		shards_[i].value.store(0, boost::memory_order_relaxed);
+}
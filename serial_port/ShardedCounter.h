@@ -0,0 +1,43 @@
+#ifndef __SHARDEDCOUNTER_H__
+#define __SHARDEDCOUNTER_H__
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+// A counter updated by many threads without a strand or a lock. Every
+// thread adds to its own shard, each on a cache line of its own, so the
+// threads don't fight over the line; the shards are summed on read, which
+// is rare and cheap by comparison. A thread is given its shard the first
+// time it counts, threads beyond the number of shards share them, the
+// atomic add keeps the result exact anyway
+
+class ShardedCounter : private boost::noncopyable
+{
+	public:
+		explicit ShardedCounter(unsigned int shards = 0); // 0 == twice the number of CPUs
+
+		void Add(boost::uint64_t n = 1) {
+			shards_[ThreadIndex() % shardCount_].value.fetch_add(n, boost::memory_order_relaxed);
+		}
+
+		boost::uint64_t Load() const; // the sum of the shards, not a snapshot
+		void Reset();
+
+		// The number of the calling thread, given in the order of the first call
+		static unsigned int ThreadIndex();
+
+	private:
+		struct Shard
+		{
+			boost::atomic<boost::uint64_t> value;
+			char padding[64 - sizeof(boost::atomic<boost::uint64_t>)];
+			Shard() : value(0) {}
+		};
+
+		unsigned int shardCount_;
+		boost::scoped_array<Shard> shards_;
+};
+
+#endif
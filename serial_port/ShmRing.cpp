@@ -0,0 +1,196 @@
+#include "ShmRing.h"
+#include <new>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// The atomics are shared by processes, they mustn't hide a lock
+BOOST_STATIC_ASSERT(BOOST_ATOMIC_INT64_LOCK_FREE == 2 && BOOST_ATOMIC_INT32_LOCK_FREE == 2);
+
+struct ShmRingHeader
+{
+	boost::atomic<boost::uint32_t> magic; // set last, when the ring is ready
+	boost::uint32_t version;
+	boost::uint64_t capacity; // bytes of data, a power of 2
+	boost::int64_t startWall; // microseconds since 1970 at startClock
+	boost::uint64_t startClock; // nanoseconds of the steady clock
+
+	// Bytes written since the ring was created: the end of the last record
+	// and the start of the oldest one that is still whole
+	boost::atomic<boost::uint64_t> head, tail;
+	boost::atomic<boost::uint32_t> closed;
+};
+
+namespace
+{
+	const boost::uint32_t Magic = 0x53484D31; // "SHM1"
+	const boost::uint32_t Version = 1;
+	enum { DataOffset = 128 }; // the header takes two cache lines
+
+	BOOST_STATIC_ASSERT(sizeof(ShmRingHeader) <= DataOffset);
+
+	// In front of the data of every record, the records are 8-byte aligned
+	struct RecordHeader
+	{
+		boost::uint32_t length, reserved;
+		boost::uint64_t time;
+	};
+
+	std::size_t RecordSize(std::size_t length)
+	{
+		return (sizeof(RecordHeader) + length + 7) & ~std::size_t(7);
+	}
+
+	// The ring wraps in the middle of a record
+	void CopyTo(unsigned char *ring, std::size_t capacity, boost::uint64_t position, const void *data, std::size_t length)
+	{
+		const std::size_t offset = std::size_t(position & (capacity - 1));
+		const std::size_t first = std::min(length, capacity - offset);
+		std::memcpy(ring + offset, data, first);
+		std::memcpy(ring, static_cast<const unsigned char *>(data) + first, length - first);
+	}
+
+	void CopyFrom(const unsigned char *ring, std::size_t capacity, boost::uint64_t position, void *data, std::size_t length)
+	{
+		const std::size_t offset = std::size_t(position & (capacity - 1));
+		const std::size_t first = std::min(length, capacity - offset);
+		std::memcpy(data, ring + offset, first);
+		std::memcpy(static_cast<unsigned char *>(data) + first, ring, length - first);
+	}
+
+	boost::uint64_t Nanoseconds(boost::chrono::steady_clock::time_point time)
+	{
+		return boost::chrono::duration_cast<boost::chrono::nanoseconds>(time.time_since_epoch()).count();
+	}
+}
+
+ShmRingWriter::ShmRingWriter(const std::string &name, std::size_t capacity)
+	: name_(name), header_(0), data_(0), capacity_(sizeof(RecordHeader)), head_(0), tail_(0)
+{
+	while (capacity_ < capacity)
+		capacity_ <<= 1;
+
+	boost::interprocess::shared_memory_object::remove(name_.c_str());
+	boost::interprocess::shared_memory_object(boost::interprocess::create_only,
+		name_.c_str(), boost::interprocess::read_write).swap(memory_);
+	memory_.truncate(DataOffset + capacity_);
+	boost::interprocess::mapped_region(memory_, boost::interprocess::read_write).swap(region_);
+
+	header_ = new (region_.get_address()) ShmRingHeader;
+	data_ = static_cast<unsigned char *>(region_.get_address()) + DataOffset;
+
+	const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	header_->version = Version;
+	header_->capacity = capacity_;
+	header_->startWall = (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+	header_->startClock = Nanoseconds(Clock::now());
+	header_->head.store(0, boost::memory_order_relaxed);
+	header_->tail.store(0, boost::memory_order_relaxed);
+	header_->closed.store(0, boost::memory_order_relaxed);
+	header_->magic.store(Magic, boost::memory_order_release);
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+	header_->closed.store(1, boost::memory_order_release);
+	boost::interprocess::shared_memory_object::remove(name_.c_str());
+}
+
+void ShmRingWriter::Write(Clock::time_point time, const unsigned char *data, std::size_t length)
+{
+	const std::size_t size = RecordSize(length);
+	if (size > capacity_)
+		throw std::invalid_argument("The record is larger than the shared memory ring");
+
+	// The oldest records are given up first, the readers see the tail
+	// move past them before their bytes change
+	boost::uint64_t tail = tail_;
+	while (head_ + size - tail > capacity_) {
+		RecordHeader oldest;
+		CopyFrom(data_, capacity_, tail, &oldest, sizeof(oldest));
+		tail += RecordSize(oldest.length);
+	}
+	if (tail != tail_) {
+		tail_ = tail;
+		header_->tail.store(tail_, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_release);
+	}
+
+	const RecordHeader record = { boost::uint32_t(length), 0, Nanoseconds(time) };
+	CopyTo(data_, capacity_, head_, &record, sizeof(record));
+	CopyTo(data_, capacity_, head_ + sizeof(record), data, length);
+
+	head_ += size;
+	header_->head.store(head_, boost::memory_order_release);
+}
+
+ShmRingReader::ShmRingReader(const std::string &name, bool fromOldest)
+	: header_(0), data_(0), capacity_(0), position_(0), lost_(0), overruns_(0)
+{
+	// read_write, as a 64-bit atomic load may be a compare-exchange on 32-bit x86
+	boost::interprocess::shared_memory_object(boost::interprocess::open_only,
+		name.c_str(), boost::interprocess::read_write).swap(memory_);
+	boost::interprocess::mapped_region(memory_, boost::interprocess::read_write).swap(region_);
+
+	if (region_.get_size() < DataOffset)
+		throw std::runtime_error("Not a shared memory ring: " + name);
+
+	header_ = static_cast<const ShmRingHeader *>(region_.get_address());
+	if (header_->magic.load(boost::memory_order_acquire) != Magic || header_->version != Version
+		|| header_->capacity == 0 || DataOffset + header_->capacity > region_.get_size())
+		throw std::runtime_error("Not a shared memory ring, or not ready: " + name);
+
+	data_ = static_cast<const unsigned char *>(region_.get_address()) + DataOffset;
+	capacity_ = std::size_t(header_->capacity);
+	position_ = fromOldest ? header_->tail.load(boost::memory_order_acquire) : header_->head.load(boost::memory_order_acquire);
+}
+
+bool ShmRingReader::Read(ShmRecord &record)
+{
+	for (;;) {
+		if (position_ == header_->head.load(boost::memory_order_acquire))
+			return false;
+
+		// The record may be overwritten while it is copied, it is checked
+		// after the copy, so its length can't be trusted yet
+		RecordHeader next;
+		CopyFrom(data_, capacity_, position_, &next, sizeof(next));
+		const bool whole = RecordSize(next.length) <= capacity_;
+		if (whole) {
+			record.data.resize(next.length);
+			if (next.length > 0)
+				CopyFrom(data_, capacity_, position_ + sizeof(next), &record.data[0], next.length);
+		}
+
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		const boost::uint64_t tail = header_->tail.load(boost::memory_order_relaxed);
+		if (tail > position_) {
+			lost_ += tail - position_;
+			++overruns_;
+			position_ = tail;
+			continue;
+		}
+
+		if (!whole)
+			throw std::runtime_error("The shared memory ring is corrupt");
+
+		record.time = next.time;
+		position_ += RecordSize(next.length);
+		return true;
+	}
+}
+
+bool ShmRingReader::Closed() const
+{
+	return header_->closed.load(boost::memory_order_acquire) != 0;
+}
+
+boost::posix_time::ptime ShmRingReader::WallTime(boost::uint64_t time) const
+{
+	const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return epoch + boost::posix_time::microseconds(header_->startWall +
+		(boost::int64_t(time) - boost::int64_t(header_->startClock)) / 1000);
+}
@@ -0,0 +1,97 @@
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// The data read from a serial port, published to the other processes of
+// the machine through a ring in shared memory. One writer appends the
+// records (the time and the data of one read) one after the other, any
+// number of readers follow it, each one at its own position. Nothing is
+// locked: the writer publishes the end of the data (head) after the data,
+// and before it overwrites the oldest records it moves the start of the
+// data (tail) past them. A reader copies a record and then checks that the
+// tail hasn't passed it meanwhile, so a reader that is too slow sees the
+// records it has lost, as a count, and never a record the writer has begun
+// to overwrite. Reading is a copy from the mapped memory, no system calls.
+//
+// The times are nanoseconds of boost::chrono::steady_clock, which all the
+// processes of the machine share, so a reader can tell how long ago a
+// record was read from the port
+
+struct ShmRingHeader;
+
+struct ShmRecord
+{
+	boost::uint64_t time; // nanoseconds of the steady clock
+	std::vector<unsigned char> data;
+
+	ShmRecord() : time(0) {}
+};
+
+class ShmRingWriter : private boost::noncopyable
+{
+	public:
+		typedef boost::chrono::steady_clock Clock;
+
+		// Creates the ring of at least capacity bytes, rounded up to a power
+		// of 2. A ring of the same name left by a writer that has died is
+		// replaced. Throws boost::interprocess::interprocess_exception
+		ShmRingWriter(const std::string &name, std::size_t capacity);
+		~ShmRingWriter(); // the ring is closed and its name removed, the readers keep it mapped
+
+		// From one thread at a time. Throws std::invalid_argument if the
+		// record doesn't fit in the ring
+		void Write(Clock::time_point time, const unsigned char *data, std::size_t length);
+		void Write(Clock::time_point time, const std::vector<unsigned char> &data)
+			{ Write(time, data.empty() ? 0 : &data[0], data.size()); }
+
+		std::size_t Capacity() const { return capacity_; }
+
+	private:
+		const std::string name_;
+		boost::interprocess::shared_memory_object memory_;
+		boost::interprocess::mapped_region region_;
+		ShmRingHeader *header_;
+		unsigned char *data_;
+		std::size_t capacity_;
+		boost::uint64_t head_, tail_; // the writer's copies
+};
+
+class ShmRingReader : private boost::noncopyable
+{
+	public:
+		// Opens the ring of a running writer, throws
+		// boost::interprocess::interprocess_exception if there is none and
+		// std::runtime_error if it isn't a ring. The reader starts at the
+		// oldest record in the ring or at the next one to be written
+		explicit ShmRingReader(const std::string &name, bool fromOldest = false);
+
+		// False if there is no new record. The records overwritten before
+		// they were read are skipped and counted
+		bool Read(ShmRecord &record);
+
+		boost::uint64_t Lost() const { return lost_; } // bytes of the skipped records
+		boost::uint64_t Overruns() const { return overruns_; } // times the reader fell behind
+		bool Closed() const; // the writer is gone, nothing comes after the last record
+		std::size_t Capacity() const { return capacity_; }
+
+		// The time of a record on the wall clock of the writer
+		boost::posix_time::ptime WallTime(boost::uint64_t time) const;
+
+	private:
+		boost::interprocess::shared_memory_object memory_;
+		boost::interprocess::mapped_region region_;
+		const ShmRingHeader *header_;
+		const unsigned char *data_;
+		std::size_t capacity_;
+		boost::uint64_t position_, lost_, overruns_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "TimeProtocol.h"
+#include <cstring>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#if defined(__linux__)
+#include <time.h>
+#include <sys/socket.h>
+#endif
+
+namespace TimeProtocol
+{
+	static const boost::uint64_t Epoch1970 = 2208988800ULL; // 1900 to 1970 in seconds
+
+	static boost::uint64_t FromParts(boost::uint64_t seconds, boost::uint64_t nanoseconds)
+	{
+		return ((seconds + Epoch1970) << 32) | ((nanoseconds << 32) / 1000000000ULL);
+	}
+
+	boost::uint64_t Now()
+	{
+#if defined(__linux__)
+		timespec ts;
+		::clock_gettime(CLOCK_REALTIME, &ts);
+		return FromParts(ts.tv_sec, ts.tv_nsec);
+#else
+		using namespace boost::posix_time;
+		const time_duration d = microsec_clock::universal_time() - ptime(boost::gregorian::date(1970, 1, 1));
+		return FromParts(d.total_seconds(), d.fractional_seconds() *
+			(1000000000 / time_duration::ticks_per_second()));
+#endif
+	}
+
+	double Difference(boost::uint64_t a, boost::uint64_t b)
+	{
+		// The wrap-around of the unsigned difference gives the signed result
+		return static_cast<boost::int64_t>(a - b) / 4294967296.0;
+	}
+
+	double Offset(boost::uint64_t t1, boost::uint64_t t2, boost::uint64_t t3, boost::uint64_t t4)
+	{
+		return (Difference(t2, t1) + Difference(t3, t4)) / 2;
+	}
+
+	double Delay(boost::uint64_t t1, boost::uint64_t t2, boost::uint64_t t3, boost::uint64_t t4)
+	{
+		return Difference(t4, t1) - Difference(t3, t2);
+	}
+
+	static void Put32(unsigned char *p, boost::uint32_t v)
+	{
+		p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+		p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+	}
+
+	static boost::uint32_t Get32(const unsigned char *p)
+	{
+		return (boost::uint32_t(p[0]) << 24) | (boost::uint32_t(p[1]) << 16) |
+			(boost::uint32_t(p[2]) << 8) | p[3];
+	}
+
+	void Encode(const Packet &packet, void *data)
+	{
+		unsigned char *p = static_cast<unsigned char *>(data);
+		Put32(p, packet.magic); Put32(p + 4, packet.flags);
+		Put32(p + 8, boost::uint32_t(packet.originate >> 32)); Put32(p + 12, boost::uint32_t(packet.originate));
+		Put32(p + 16, boost::uint32_t(packet.receive >> 32)); Put32(p + 20, boost::uint32_t(packet.receive));
+		Put32(p + 24, boost::uint32_t(packet.transmit >> 32)); Put32(p + 28, boost::uint32_t(packet.transmit));
+	}
+
+	bool Decode(const void *data, std::size_t length, Packet &packet)
+	{
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		if (length != PacketSize || Get32(p) != Magic)
+			return false;
+
+		packet.magic = Get32(p); packet.flags = Get32(p + 4);
+		packet.originate = (boost::uint64_t(Get32(p + 8)) << 32) | Get32(p + 12);
+		packet.receive = (boost::uint64_t(Get32(p + 16)) << 32) | Get32(p + 20);
+		packet.transmit = (boost::uint64_t(Get32(p + 24)) << 32) | Get32(p + 28);
+		return true;
+	}
+
+	bool EnableRxTimestamps(boost::asio::ip::udp::socket &socket)
+	{
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+		const int on = 1;
+		return ::setsockopt(socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0;
+#else
+		(void)socket;
+		return false;
+#endif
+	}
+
+	std::size_t ReceiveFrom(boost::asio::ip::udp::socket &socket,
+		const boost::asio::mutable_buffer &buffer, boost::asio::ip::udp::endpoint &sender,
+		boost::uint64_t &rxTime, bool &kernelTime, boost::system::error_code &ec)
+	{
+		kernelTime = false;
+
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+		// recvmsg() is used instead of receive_from() to get the control
+		// message with the time the datagram was received by the kernel
+		iovec iov;
+		iov.iov_base = buffer.data();
+		iov.iov_len = buffer.size();
+
+		union { char buf[CMSG_SPACE(sizeof(timespec))]; cmsghdr align; } control;
+
+		msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_name = sender.data();
+		msg.msg_namelen = sender.capacity();
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		const ssize_t n = ::recvmsg(socket.native_handle(), &msg, 0);
+		rxTime = Now();
+
+		if (n < 0) {
+			ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+			if (errno == EAGAIN || errno == EWOULDBLOCK) ec = boost::asio::error::would_block;
+			return 0;
+		}
+
+		sender.resize(msg.msg_namelen);
+		ec = (msg.msg_flags & MSG_TRUNC) ? boost::asio::error::message_size : boost::system::error_code();
+
+		for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+				timespec ts;
+				std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+				rxTime = FromParts(ts.tv_sec, ts.tv_nsec);
+				kernelTime = true;
+			}
+
+		return std::size_t(n);
+#else
+		const std::size_t n = socket.receive_from(boost::asio::buffer(buffer), sender, 0, ec);
+		rxTime = Now(); // a software timestamp
+		return n;
+#endif
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef __TIMEPROTOCOL_H__
+#define __TIMEPROTOCOL_H__
+
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+
+// Binary request/response mode of the UDP daytime servers. The times are
+// 64-bit fixed point numbers like in NTP: seconds since 1900 in the high
+// 32 bits and the fraction of a second in the low 32 bits. The client
+// sends its transmit time (t1), the server answers with t1 echoed, the
+// time the request was received (t2, a kernel timestamp where available)
+// and the time the response was sent (t3). With the client's receive
+// time t4 the offset and the round-trip delay are computed as in NTP
+
+namespace TimeProtocol
+{
+	const boost::uint32_t Magic = 0x54494D31; // "TIM1"
+
+	struct Packet // all fields in network byte order on the wire
+	{
+		boost::uint32_t magic;
+		boost::uint32_t flags;
+		boost::uint64_t originate; // t1
+		boost::uint64_t receive; // t2
+		boost::uint64_t transmit; // t3
+	};
+
+	enum { PacketSize = 32 };
+	enum Flags { KernelRxTimestamp = 1 }; // t2 was taken by the kernel
+
+	boost::uint64_t Now(); // the current UTC time as a fixed point number
+
+	// Signed difference of two fixed point times, in seconds
+	double Difference(boost::uint64_t a, boost::uint64_t b);
+
+	// (t2 - t1 + t3 - t4) / 2 and (t4 - t1) - (t3 - t2), in seconds
+	double Offset(boost::uint64_t t1, boost::uint64_t t2, boost::uint64_t t3, boost::uint64_t t4);
+	double Delay(boost::uint64_t t1, boost::uint64_t t2, boost::uint64_t t3, boost::uint64_t t4);
+
+	// Converts between the host and the wire representation,
+	// Decode() returns false if the data is not a packet
+	void Encode(const Packet &packet, void *data);
+	bool Decode(const void *data, std::size_t length, Packet &packet);
+
+	// Ask the kernel to timestamp the received datagrams (SO_TIMESTAMPNS on
+	// Linux); returns false if not supported, software timestamps are used then
+	bool EnableRxTimestamps(boost::asio::ip::udp::socket &socket);
+
+	// receive_from() that also returns the receive time of the datagram. On a
+	// non-blocking socket it fails with would_block when there is nothing to read
+	std::size_t ReceiveFrom(boost::asio::ip::udp::socket &socket,
+		const boost::asio::mutable_buffer &buffer, boost::asio::ip::udp::endpoint &sender,
+		boost::uint64_t &rxTime, bool &kernelTime, boost::system::error_code &ec);
+}
+
+#endif
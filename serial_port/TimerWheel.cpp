@@ -0,0 +1,310 @@
+#include "TimerWheel.h"
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+struct TimerWheel::Completions
+{
+	struct Completion
+	{
+		WheelTimer::handler_type handler;
+		boost::system::error_code ec;
+	};
+
+	boost::mutex mutex;
+	std::deque<Completion> queue; // a deque, so the handlers are never copied
+};
+
+TimerWheel::TimerWheel(boost::asio::io_context &ioc, const boost::posix_time::time_duration &resolution)
+	: ioc_(ioc), tick_(ioc),
+	resolution_(resolution.total_microseconds() > 0 ? resolution : boost::posix_time::microseconds(1)),
+	start_(boost::chrono::steady_clock::now()), completions_(boost::make_shared<Completions>()),
+	current_(0), size_(0), ticking_(false)
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+	std::vector<WheelTimer::handler_type> handlers;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		std::vector<Node *> slots;
+		for (unsigned int i = 0; i < Slots0; ++i) slots.push_back(&wheel0_[i]);
+		for (unsigned int level = 0; level < Levels - 1; ++level)
+			for (unsigned int i = 0; i < Slots; ++i) slots.push_back(&wheels_[level][i]);
+
+		for (std::size_t i = 0; i < slots.size(); ++i)
+			while (slots[i]->IsLinked()) {
+				Node *node = slots[i]->next;
+				Unlink(node);
+				handlers.push_back(WheelTimer::handler_type());
+				handlers.back().swap(node->timer->handler_);
+			}
+
+		size_ = 0;
+		boost::system::error_code ec;
+		tick_.cancel(ec);
+	}
+
+	for (std::size_t i = 0; i < handlers.size(); ++i)
+		Post(handlers[i], boost::asio::error::operation_aborted);
+}
+
+void TimerWheel::Post(WheelTimer::handler_type &handler, const boost::system::error_code &ec)
+{
+	bool first;
+	{
+		boost::mutex::scoped_lock lock(completions_->mutex);
+		first = completions_->queue.empty();
+
+		completions_->queue.push_back(Completions::Completion());
+		completions_->queue.back().handler.swap(handler);
+		completions_->queue.back().ec = ec;
+	}
+
+	if (first) // the queue is being run otherwise
+		ioc_.post(boost::bind(&TimerWheel::RunCompletions, completions_));
+}
+
+void TimerWheel::RunCompletions(boost::shared_ptr<Completions> completions)
+{
+	std::deque<Completions::Completion> batch;
+	{
+		boost::mutex::scoped_lock lock(completions->mutex);
+		batch.swap(completions->queue);
+	}
+
+	// The handlers queued while the batch runs start the next batch
+	for (std::deque<Completions::Completion>::iterator i = batch.begin(); i != batch.end(); ++i)
+		if (i->handler) i->handler(i->ec);
+}
+
+boost::uint64_t TimerWheel::Now() const
+{
+	const boost::int64_t us = boost::chrono::duration_cast<boost::chrono::microseconds>(
+		boost::chrono::steady_clock::now() - start_).count();
+	return us > 0 ? boost::uint64_t(us) / resolution_.total_microseconds() : 0;
+}
+
+boost::uint64_t TimerWheel::Due(const boost::posix_time::time_duration &d) const
+{
+	// Never early: a tick is processed when its time has come, so the due
+	// time is rounded up to the next tick, the timer is late by less than one
+	const boost::int64_t us = boost::chrono::duration_cast<boost::chrono::microseconds>(
+		boost::chrono::steady_clock::now() - start_).count() + std::max<boost::int64_t>(0, d.total_microseconds());
+	const boost::int64_t r = resolution_.total_microseconds();
+	return boost::uint64_t((us + r - 1) / r);
+}
+
+void TimerWheel::Link(Node *timer)
+{
+	// The wheel is chosen by the distance to the due time, the slot by
+	// the due time itself, so a slot of an outer wheel is cascaded at
+	// the tick its range starts, never later than the due time
+	const boost::uint64_t delta = timer->due - current_;
+
+	Node *slot;
+	if (delta < Slots0)
+		slot = &wheel0_[timer->due & (Slots0 - 1)];
+	else if (delta < (1ULL << (Bits0 + Bits)))
+		slot = &wheels_[0][(timer->due >> Bits0) & (Slots - 1)];
+	else if (delta < (1ULL << (Bits0 + 2 * Bits)))
+		slot = &wheels_[1][(timer->due >> (Bits0 + Bits)) & (Slots - 1)];
+	else {
+		// The farthest timers go around the outer wheel until they are due
+		const boost::uint64_t limit = (1ULL << (Bits0 + 3 * Bits)) - 1;
+		slot = &wheels_[2][((current_ + (delta < limit ? delta : limit)) >> (Bits0 + 2 * Bits)) & (Slots - 1)];
+	}
+
+	timer->prev = slot->prev;
+	timer->next = slot;
+	slot->prev->next = timer;
+	slot->prev = timer;
+}
+
+void TimerWheel::Unlink(Node *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = timer;
+}
+
+void TimerWheel::Cascade(Node &slot)
+{
+	// Take the whole list first, a timer may be linked back into the same slot
+	Node list;
+	if (!slot.IsLinked()) return;
+
+	list.next = slot.next; list.prev = slot.prev;
+	list.next->prev = list.prev->next = &list;
+	slot.prev = slot.next = &slot;
+
+	while (list.IsLinked()) {
+		Node *timer = list.next;
+		Unlink(timer);
+		Link(timer);
+		++counters_.cascaded;
+	}
+}
+
+void TimerWheel::Advance(boost::uint64_t tick, Node &expired)
+{
+	if (size_ == 0 && tick > current_)
+		current_ = tick; // nothing to walk through
+
+	while (current_ < tick) {
+		++current_;
+		++counters_.ticks;
+
+		// When the inner wheel wraps, the next slot of an outer wheel is
+		// moved inwards; the outermost first, as its timers may go to the
+		// slot of the next wheel which is cascaded right after
+		if ((current_ & (Slots0 - 1)) == 0)
+			for (int level = Levels - 2; level >= 0; --level) {
+				const unsigned int shift = Bits0 + level * Bits;
+				if ((current_ & ((1ULL << shift) - 1)) == 0)
+					Cascade(wheels_[level][(current_ >> shift) & (Slots - 1)]);
+			}
+
+		Node &slot = wheel0_[current_ & (Slots0 - 1)];
+		while (slot.IsLinked()) {
+			Node *timer = slot.next;
+			Unlink(timer);
+
+			timer->prev = expired.prev; // append to the expired list
+			timer->next = &expired;
+			expired.prev->next = timer;
+			expired.prev = timer;
+		}
+	}
+}
+
+void TimerWheel::StartTicking()
+{
+	ticking_ = true;
+
+	// The wheel runs on the steady clock, deadline_timer on the wall clock,
+	// so the next tick is given relative to now
+	const boost::chrono::steady_clock::time_point tick = start_ +
+		boost::chrono::microseconds(static_cast<boost::int64_t>(current_ + 1) * resolution_.total_microseconds());
+	const boost::int64_t us = boost::chrono::duration_cast<boost::chrono::microseconds>(
+		tick - boost::chrono::steady_clock::now()).count();
+
+	tick_.expires_from_now(boost::posix_time::microseconds(us > 0 ? us : 0));
+	tick_.async_wait(boost::bind(&TimerWheel::HandleTick, this, boost::asio::placeholders::error));
+}
+
+void TimerWheel::HandleTick(const boost::system::error_code &ec)
+{
+	if (ec == boost::asio::error::operation_aborted)
+		return; // the wheel is being destroyed
+
+	std::vector<WheelTimer::handler_type> handlers;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		Node expired;
+		Advance(Now(), expired);
+
+		while (expired.IsLinked()) {
+			Node *node = expired.next;
+			Unlink(node);
+			handlers.push_back(WheelTimer::handler_type());
+			handlers.back().swap(node->timer->handler_);
+		}
+
+		size_ -= handlers.size();
+		counters_.expired += handlers.size();
+
+		if (size_ > 0) StartTicking();
+		else ticking_ = false; // the kernel timer sleeps until the next Arm()
+	}
+
+	// The handlers run outside of the lock, they may arm their timers again
+	for (std::size_t i = 0; i < handlers.size(); ++i)
+		Post(handlers[i], boost::system::error_code());
+}
+
+void TimerWheel::Arm(WheelTimer &timer, WheelTimer::handler_type &handler)
+{
+	WheelTimer::handler_type previous;
+	bool cancelled;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		cancelled = Unarm(timer, previous); // one wait at a time
+
+		if (size_ == 0 && !ticking_) {
+			const boost::uint64_t now = Now();
+			if (now > current_) current_ = now; // the wheel has been idle
+		}
+
+		timer.handler_.swap(handler);
+		timer.node_.due = timer.expiry_ > current_ ? timer.expiry_ : current_ + 1;
+		Link(&timer.node_);
+
+		++size_;
+		++counters_.armed;
+
+		if (!ticking_) StartTicking();
+	}
+
+	if (cancelled) Post(previous, boost::asio::error::operation_aborted);
+}
+
+bool TimerWheel::Unarm(WheelTimer &timer, WheelTimer::handler_type &handler)
+{
+	if (!timer.node_.IsLinked())
+		return false; // not waiting, or the handler is already posted
+
+	Unlink(&timer.node_);
+	handler.swap(timer.handler_);
+	--size_;
+	++counters_.cancelled;
+	return true;
+}
+
+bool TimerWheel::Cancel(WheelTimer &timer)
+{
+	WheelTimer::handler_type handler;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!Unarm(timer, handler))
+			return false;
+	}
+
+	Post(handler, boost::asio::error::operation_aborted);
+	return true;
+}
+
+std::size_t TimerWheel::Size()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return size_;
+}
+
+TimerWheel::Counters TimerWheel::GetCounters()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return counters_;
+}
+
+std::size_t WheelTimer::expires_from_now(const boost::posix_time::time_duration &expiry)
+{
+	const std::size_t cancelled = cancel();
+	expiry_ = wheel_.Due(expiry);
+	return cancelled;
+}
+
+void WheelTimer::async_wait(handler_type handler)
+{
+	wheel_.Arm(*this, handler);
+}
+
+std::size_t WheelTimer::cancel()
+{
+	return wheel_.Cancel(*this) ? 1 : 0;
+}
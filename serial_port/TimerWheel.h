@@ -0,0 +1,128 @@
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Hierarchical timer wheel for very large numbers of timeouts. The timers
+// are kept in intrusive lists hung on four wheels (256 slots of one tick,
+// then 64 slots of 256, 16384 and 1048576 ticks), so arming and cancelling
+// a timer is O(1) and nothing is allocated except the handler. A single
+// deadline_timer ticks the wheel while there are timers, a timer on an outer
+// wheel is moved inwards when the inner wheel wraps. The expiry is rounded
+// up to the tick (1 ms by default), the price of the constant cost.
+// One TimerWheel is created per io_context and shared by its WheelTimers
+
+class WheelTimer;
+
+class TimerWheel : private boost::noncopyable
+{
+	public:
+		TimerWheel(boost::asio::io_context &ioc,
+			const boost::posix_time::time_duration &resolution = boost::posix_time::milliseconds(1));
+		~TimerWheel(); // the timers still armed are cancelled
+
+		boost::asio::io_context &GetIOContext() { return ioc_; }
+		boost::posix_time::time_duration GetResolution() const { return resolution_; }
+
+		std::size_t Size(); // the number of armed timers
+
+		struct Counters
+		{
+			boost::uint64_t armed, expired, cancelled, cascaded, ticks;
+			Counters() : armed(0), expired(0), cancelled(0), cascaded(0), ticks(0) {}
+		};
+
+		Counters GetCounters();
+
+	private:
+		friend class WheelTimer;
+
+		struct Node // a list head of a slot, or a timer
+		{
+			Node *prev, *next;
+			boost::uint64_t due; // in ticks since the start of the wheel
+			WheelTimer *timer; // 0 for a list head
+
+			Node() : prev(this), next(this), due(0), timer(0) {}
+			bool IsLinked() const { return next != this; }
+		};
+
+		enum { Bits0 = 8, Bits = 6, Levels = 4, Slots0 = 1 << Bits0, Slots = 1 << Bits };
+
+		boost::uint64_t Now() const; // the current tick, rounded down
+		boost::uint64_t Due(const boost::posix_time::time_duration &d) const; // the tick of now + d, rounded up
+
+		// Called with the mutex locked
+		void Link(Node *timer);
+		static void Unlink(Node *timer);
+		void Advance(boost::uint64_t tick, Node &expired);
+		void Cascade(Node &slot);
+		void StartTicking();
+
+		void Arm(WheelTimer &timer, boost::function<void(const boost::system::error_code &)> &handler);
+		bool Cancel(WheelTimer &timer);
+		bool Unarm(WheelTimer &timer, boost::function<void(const boost::system::error_code &)> &handler);
+		void Post(boost::function<void(const boost::system::error_code &)> &handler,
+			const boost::system::error_code &ec);
+
+		// The handlers of the expired and the cancelled timers are queued here
+		// and run by a single post() per batch, a post() per handler costs more
+		// than the rest of the work. The queue outlives the wheel if it has to
+		struct Completions;
+		static void RunCompletions(boost::shared_ptr<Completions> completions);
+		void HandleTick(const boost::system::error_code &ec);
+
+		boost::asio::io_context &ioc_;
+		boost::asio::deadline_timer tick_; // the only kernel timer
+		const boost::posix_time::time_duration resolution_;
+		const boost::chrono::steady_clock::time_point start_; // the wall clock may be changed
+
+		const boost::shared_ptr<Completions> completions_;
+
+		boost::mutex mutex_; // everything below
+		Node wheel0_[Slots0];
+		Node wheels_[Levels - 1][Slots];
+		boost::uint64_t current_; // the last tick processed
+		std::size_t size_;
+		bool ticking_;
+		Counters counters_;
+};
+
+// A timer with the interface of deadline_timer, so it can replace one in
+// templates: expires_from_now(), async_wait() and cancel(). The handler is
+// posted to the io_context of the wheel. One wait can be outstanding at a
+// time; async_wait() on a waiting timer cancels the previous wait
+class WheelTimer : private boost::noncopyable
+{
+	public:
+		typedef boost::function<void(const boost::system::error_code &)> handler_type;
+
+		explicit WheelTimer(TimerWheel &wheel) : wheel_(wheel), expiry_(0) { node_.timer = this; }
+		WheelTimer(TimerWheel &wheel, const boost::posix_time::time_duration &expiry)
+			: wheel_(wheel), expiry_(0) { node_.timer = this; expires_from_now(expiry); }
+		~WheelTimer() { cancel(); }
+
+		// Set the expiry time relative to now, any pending wait is cancelled;
+		// returns the number of waits cancelled, like deadline_timer does
+		std::size_t expires_from_now(const boost::posix_time::time_duration &expiry);
+
+		void async_wait(handler_type handler);
+		std::size_t cancel(); // the handler is called with operation_aborted
+
+		TimerWheel &GetWheel() { return wheel_; }
+
+	private:
+		friend class TimerWheel;
+
+		TimerWheel &wheel_;
+		TimerWheel::Node node_; // linked into a slot while waiting
+		boost::uint64_t expiry_; // in ticks of the wheel
+		handler_type handler_;
+};
+
+#endif
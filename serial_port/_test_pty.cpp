@@ -0,0 +1,390 @@
+// _test_pty.cpp: checks of SerialPort on a pseudo terminal, Linux only
+//
+// g++ -std=c++11 -I. _test_pty.cpp SerialPort.cpp CoalescingTimer.cpp Replayer.cpp MergedReplayer.cpp ReplayBase.cpp Capture.cpp Logger.cpp
+//     -lboost_system -lboost_thread -lboost_chrono -lboost_serialization -lboost_iostreams -lpthread -lutil
+//
+// Every check prints OK or FAILED, the exit code is the number of failures
+
+#include "SerialPort.h"
+#include "Replayer.h"
+#include "MergedReplayer.h"
+#include "Logger.h"
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#if defined(__linux__)
+
+#include <pty.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+	int failures = 0;
+
+	void Check(bool ok, const std::string &what)
+	{
+		std::cout << (ok ? "OK     " : "FAILED ") << what << std::endl;
+		if (!ok) ++failures;
+	}
+
+	// A pty in raw mode, the slave is the serial port
+	struct Pty
+	{
+		int master, slave;
+		std::string name;
+
+		Pty() : master(-1), slave(-1)
+		{
+			char path[64];
+			if (::openpty(&master, &slave, path, 0, 0) != 0)
+				throw std::runtime_error("openpty failed");
+			name = path;
+
+			termios tio;
+			::tcgetattr(slave, &tio);
+			::cfmakeraw(&tio);
+			::tcsetattr(slave, TCSANOW, &tio);
+		}
+
+		~Pty() { ::close(master); ::close(slave); }
+	};
+
+	template <class Condition> bool WaitFor(Condition condition, int ms)
+	{
+		for (; ms > 0 && !condition(); ms -= 10)
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+		return condition();
+	}
+
+	// What the other end of the port gets, until it has the bytes or stays quiet for ms
+	std::string ReadMaster(int master, size_t bytes, int ms)
+	{
+		std::string data;
+		pollfd p = { master, POLLIN, 0 };
+		while (data.size() < bytes && ::poll(&p, 1, ms) > 0) {
+			char buffer[256];
+			const ssize_t n = ::read(master, buffer, sizeof buffer);
+			if (n <= 0) break;
+			data.append(buffer, n);
+		}
+		return data;
+	}
+
+	struct Received
+	{
+		boost::mutex mutex;
+		std::string data;
+
+		void OnRead(boost::asio::io_context &, const std::vector<unsigned char> &buffer, size_t size)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			data.append(buffer.begin(), buffer.begin() + size);
+		}
+
+		bool Has(const std::string &text)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			return data.find(text) != std::string::npos;
+		}
+	};
+
+	// SetLowLatency() sets VMIN/VTIME of the tty and says so; the pty has
+	// no serial_struct and no FIFO, that is reported, not thrown
+	void TestLowLatency()
+	{
+		Pty pty;
+		boost::asio::io_context ioc;
+		const boost::shared_ptr<SerialPort> port(new SerialPort(ioc, pty.name));
+		port->Open(SerialPort::onread_handler(), 9600);
+
+		SerialPort::LowLatency settings;
+		settings.vmin = 5;
+		settings.vtime = 2;
+		const std::string report = port->SetLowLatency(settings);
+		std::cout << "        " << report << std::endl;
+
+		termios tio;
+		Check(::tcgetattr(pty.slave, &tio) == 0 && tio.c_cc[VMIN] == 5 && tio.c_cc[VTIME] == 2, "low latency: VMIN 5 VTIME 2 set");
+		Check(report.find("VMIN 5 VTIME 2") != std::string::npos, "low latency: VMIN/VTIME reported");
+		Check(report.find("ASYNC_LOW_LATENCY not supported") != std::string::npos, "low latency: no serial_struct reported");
+		Check(report.find("rx_trig_bytes not supported") != std::string::npos, "low latency: no FIFO level reported");
+
+		settings.vmin = -1;
+		Check(port->SetLowLatency(settings).find("VMIN 5 VTIME 2") != std::string::npos, "low latency: -1 leaves VMIN as it is");
+
+		port->Close();
+		Check(port->SetLowLatency(settings) == "the port is closed", "low latency: a closed port is not touched");
+	}
+
+	// Nobody reads the other end at first, the Bulk messages queue up behind
+	// the full pty; a Control message goes with the next write of the port,
+	// which is no longer than the write limit
+	void TestLanes()
+	{
+		Pty pty;
+		boost::asio::io_context ioc;
+		boost::asio::io_context::work work(ioc);
+		boost::thread thread(boost::bind(&boost::asio::io_context::run, &ioc));
+
+		const boost::shared_ptr<SerialPort> port(new SerialPort(ioc, pty.name));
+		port->SetLanes(512, 0);
+		port->Open(SerialPort::onread_handler(), 9600);
+
+		const std::string bulk(256, 'b');
+		for (int i = 0; i < 1024; ++i)
+			port->Write(bulk, SerialPort::Bulk);
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(100)); // the pty takes what it takes
+		port->Write(std::string("CONTROL"), SerialPort::Control);
+
+		const std::string data = ReadMaster(pty.master, 256 * 1024 + 7, 1000);
+		const size_t at = data.find("CONTROL");
+		std::cout << "        the Control message after " << at << " of " << data.size() - 7 << " Bulk bytes" << std::endl;
+		Check(data.size() == 256 * 1024 + 7, "lanes: everything is written");
+		Check(at != std::string::npos && at % 256 == 0, "lanes: the Control message is not in the middle of a Bulk one");
+		Check(at < 128 * 1024, "lanes: the Control message goes before the queued Bulk ones");
+		Check(port->GetWriteStatistics().laneDelay[SerialPort::Control].Max() < port->GetWriteStatistics().laneDelay[SerialPort::Bulk].Max(),
+			"lanes: the Control message waited less than the Bulk ones");
+
+		port->Close();
+		ioc.stop();
+		thread.join();
+	}
+
+	// At the speed 0 the replay waits for the port to send what it has
+	// queued; the pty goes away in the middle and the replay must end
+	void TestReplayClosed()
+	{
+		char dir[] = "/tmp/_test_pty.XXXXXX";
+		if (!::mkdtemp(dir))
+			throw std::runtime_error("mkdtemp failed");
+		const std::string file = std::string(dir) + "/c.cap";
+
+		{
+			CaptureWriter writer(file);
+			for (int i = 0; i < 5000; ++i)
+				writer.Write(i * 1000, std::vector<unsigned char>(100, 'x'));
+		}
+
+		boost::scoped_ptr<Pty> pty(new Pty);
+		boost::asio::io_context ioc;
+		boost::asio::io_context::work work(ioc);
+		boost::thread thread(boost::bind(&boost::asio::io_context::run, &ioc));
+
+		const boost::shared_ptr<SerialPort> port(new SerialPort(ioc, pty->name));
+		port->Open(SerialPort::onread_handler(), 9600);
+
+		Replayer::Options options;
+		options.file = file;
+		options.speed = 0;
+		const boost::shared_ptr<Replayer> replayer(new Replayer(ioc, port, options));
+		replayer->Start();
+
+		Check(ReadMaster(pty->master, 20000, 1000).size() >= 20000, "replay closed: the replay is under way");
+		pty.reset();
+		Check(WaitFor([&] { return !port->IsOpen(); }, 1000), "replay closed: the port is closed by the error");
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(100)); // the write handler posts to the strand
+
+		ioc.stop();
+		thread.join();
+
+		const Replayer::Statistics s = replayer->GetStatistics();
+		Check(s.finished && s.records < 5000, "replay closed: the replay ends instead of waiting for the port");
+		Check(port->LastError() == boost::system::error_code(EIO, boost::system::system_category()), "replay closed: the error of the port is kept");
+
+		::unlink(file.c_str());
+		::rmdir(dir);
+	}
+
+	// Two captures recorded at the same time, merged to one port: the
+	// records of both come out in the order they were recorded in
+	void TestMergedReplay()
+	{
+		char dir[] = "/tmp/_test_pty.XXXXXX";
+		if (!::mkdtemp(dir))
+			throw std::runtime_error("mkdtemp failed");
+		const std::string a = std::string(dir) + "/a.cap", b = std::string(dir) + "/b.cap";
+
+		{ // b starts a little later than a, its records are 10 ms after those of a
+			CaptureWriter writerA(a), writerB(b);
+			for (int i = 0; i < 50; ++i) {
+				writerA.Write(i * 20000, std::vector<unsigned char>(10, 'a'));
+				writerB.Write(i * 20000 + 10000, std::vector<unsigned char>(10, 'b'));
+			}
+		}
+
+		Pty pty;
+		boost::asio::io_context ioc;
+		boost::asio::io_context::work work(ioc);
+		boost::thread thread(boost::bind(&boost::asio::io_context::run, &ioc));
+
+		const boost::shared_ptr<SerialPort> port(new SerialPort(ioc, pty.name));
+		port->Open(SerialPort::onread_handler(), 9600);
+
+		std::vector<MergedReplayer::Source> sources(2);
+		sources[0].file = a;
+		sources[1].file = b;
+		sources[0].port = sources[1].port = port;
+		MergedReplayer::Options options;
+		options.speed = 2;
+		const boost::shared_ptr<MergedReplayer> replayer(new MergedReplayer(ioc, sources, options));
+		replayer->Start();
+
+		std::string expected;
+		for (int i = 0; i < 50; ++i)
+			expected += std::string(10, 'a') + std::string(10, 'b');
+		Check(ReadMaster(pty.master, expected.size(), 1000) == expected, "merged replay: the records of both captures in their order");
+
+		port->Close();
+		ioc.stop();
+		thread.join();
+
+		const MergedReplayer::Statistics s = replayer->GetStatistics();
+		Check(s.finished && s.records == 100 && s.bytes == 1000, "merged replay: finished, every record counted");
+		Check(s.elapsed > 0.4 && s.elapsed < 1.0, "merged replay: a second of the captures in half a second");
+
+		::unlink(a.c_str());
+		::unlink(b.c_str());
+		::rmdir(dir);
+	}
+
+	// The port is opened through a symbolic link; the pty is removed, as a
+	// USB adapter that is pulled out, and a new one is put behind the link
+	void TestReconnect()
+	{
+		char dir[] = "/tmp/_test_pty.XXXXXX";
+		if (!::mkdtemp(dir))
+			throw std::runtime_error("mkdtemp failed");
+		const std::string link = std::string(dir) + "/tty";
+
+		boost::scoped_ptr<Pty> pty(new Pty);
+		::symlink(pty->name.c_str(), link.c_str());
+
+		boost::asio::io_context ioc;
+		boost::asio::io_context::work work(ioc);
+		boost::thread_group threads; // two, a stale completion may run beside the new reads
+		for (int i = 0; i < 2; ++i)
+			threads.create_thread(boost::bind(&boost::asio::io_context::run, &ioc));
+
+		Received received;
+		const boost::shared_ptr<SerialPort> port(new SerialPort(ioc, link));
+		SerialPort::Reconnect reconnect;
+		reconnect.delay = 20;
+		reconnect.maxDelay = 100;
+		reconnect.queueLimit = 100;
+		port->SetReconnect(reconnect);
+		port->Open(boost::bind(&Received::OnRead, &received, _1, _2, _3), 9600);
+
+		port->Write(std::string("hello"));
+		Check(ReadMaster(pty->master, 5, 1000) == "hello", "reconnect: written before the failure");
+		Check(::write(pty->master, "ping", 4) == 4 && WaitFor([&] { return received.Has("ping"); }, 1000), "reconnect: read before the failure");
+
+		// Gone, and not back until the link is made again
+		::unlink(link.c_str());
+		pty.reset();
+		Check(WaitFor([&] { return !port->GetConnectionStatistics().connected; }, 1000), "reconnect: the failure is seen");
+
+		// 10 messages of 20 bytes, the 5 newest fit in the limit
+		std::string expected;
+		for (int i = 0; i < 10; ++i) {
+			char message[21];
+			std::snprintf(message, sizeof message, "message %02d ---------", i);
+			port->Write(std::string(message));
+			if (i >= 5) expected += message;
+		}
+		Check(port->Queued() == 100, "reconnect: the queue is held at its limit while the port is down");
+		Check(port->GetConnectionStatistics().dropped == 100, "reconnect: the oldest messages are dropped");
+		Check(port->IsOpen(), "reconnect: the port stays open while it is down");
+
+		pty.reset(new Pty);
+		::symlink(pty->name.c_str(), link.c_str());
+		Check(WaitFor([&] { return port->GetConnectionStatistics().connected; }, 2000), "reconnect: opened again");
+
+		Check(ReadMaster(pty->master, expected.size(), 1000) == expected, "reconnect: the queued messages are delivered, in order");
+		Check(::write(pty->master, "pong", 4) == 4 && WaitFor([&] { return received.Has("pong"); }, 1000), "reconnect: the reads go on");
+
+		port->Write(std::string("after"));
+		Check(ReadMaster(pty->master, 5, 1000) == "after", "reconnect: written after the reconnection");
+
+		// More than the pty takes at once, the write goes in several parts
+		std::string large(64 * 1024, 0);
+		for (size_t i = 0; i < large.size(); ++i)
+			large[i] = char('a' + i % 26);
+		port->Write(large);
+		Check(ReadMaster(pty->master, large.size(), 1000) == large, "reconnect: a long write is sent whole, in parts");
+
+		const SerialPort::ConnectionStatistics s = port->GetConnectionStatistics();
+		std::cout << "        " << s.failures << " failures, " << s.attempts << " attempts, down "
+			<< s.downtime << " s, " << s.dropped << " bytes dropped, " << s.lost << " lost" << std::endl;
+		Check(s.failures == 1 && s.lost == 0, "reconnect: one failure, nothing lost");
+
+		// Again and again, every line read once: a read of an old handle
+		// doesn't deliver the buffer of the new one, or start a second read
+		std::string lines;
+		bool ok = true;
+		for (int i = 0; i < 10 && ok; ++i) {
+			::unlink(link.c_str());
+			pty.reset();
+			ok = WaitFor([&] { return !port->GetConnectionStatistics().connected; }, 1000);
+
+			pty.reset(new Pty);
+			::symlink(pty->name.c_str(), link.c_str());
+			ok = ok && WaitFor([&] { return port->GetConnectionStatistics().connected; }, 2000);
+
+			char line[16];
+			std::snprintf(line, sizeof line, "round %02d\n", i);
+			lines += line;
+			ok = ok && ::write(pty->master, line, std::strlen(line)) == ssize_t(std::strlen(line))
+				&& WaitFor([&] { return received.Has(line); }, 1000);
+		}
+		{
+			boost::mutex::scoped_lock lock(received.mutex);
+			ok = ok && received.data == "pingpong" + lines;
+		}
+		Check(ok, "reconnect: every line read once over 10 more reconnections");
+
+		port->Close();
+		ioc.stop();
+		threads.join_all();
+
+		::unlink(link.c_str());
+		::rmdir(dir);
+	}
+}
+
+int main()
+{
+	Logger::Instance().Start(Logger::Warning);
+
+	try {
+		TestLowLatency();
+		TestLanes();
+		TestReconnect();
+		TestReplayClosed();
+		TestMergedReplay();
+	}
+	catch (const std::exception &e) {
+		std::cout << "FAILED " << e.what() << std::endl;
+		++failures;
+	}
+
+	Logger::Instance().Stop();
+	return failures;
+}
+
+#else
+
+int main()
+{
+	std::cout << "the checks need a pseudo terminal of Linux" << std::endl;
+	return 0;
+}
+
+#endif
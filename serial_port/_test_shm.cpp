@@ -0,0 +1,138 @@
+// _test_shm.cpp: checks of the shared memory ring, the writer and a reader in one process
+//
+// g++ -std=c++11 -I. _test_shm.cpp ShmRing.cpp -lboost_system -lboost_thread -lboost_chrono -lpthread -lrt
+//
+// Every check prints OK or FAILED, the exit code is the number of failures
+
+#include "ShmRing.h"
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace
+{
+	const char *const Name = "_test_shm";
+	int failures = 0;
+
+	void Check(bool ok, const std::string &what)
+	{
+		std::cout << (ok ? "OK     " : "FAILED ") << what << std::endl;
+		if (!ok) ++failures;
+	}
+
+	// The sequence number, then as many bytes of its low byte as it says
+	std::vector<unsigned char> Message(boost::uint64_t sequence)
+	{
+		std::vector<unsigned char> data(sizeof(sequence) + sequence % 100, static_cast<unsigned char>(sequence));
+		std::memcpy(&data[0], &sequence, sizeof(sequence));
+		return data;
+	}
+
+	bool Whole(const std::vector<unsigned char> &data, boost::uint64_t &sequence)
+	{
+		if (data.size() < sizeof(sequence))
+			return false;
+		std::memcpy(&sequence, &data[0], sizeof(sequence));
+		return data == Message(sequence);
+	}
+
+	void TestInOrder()
+	{
+		ShmRingWriter writer(Name, 4096);
+		ShmRingReader reader(Name);
+		ShmRecord record;
+		Check(!reader.Read(record), "in order: a new reader has nothing to read");
+
+		const ShmRingWriter::Clock::time_point time = ShmRingWriter::Clock::now();
+		for (boost::uint64_t i = 0; i < 10; ++i)
+			writer.Write(time, Message(i));
+
+		bool ok = true;
+		boost::uint64_t sequence = 0;
+		for (boost::uint64_t i = 0; i < 10; ++i)
+			ok = ok && reader.Read(record) && Whole(record.data, sequence) && sequence == i
+				&& record.time == boost::uint64_t(boost::chrono::duration_cast<boost::chrono::nanoseconds>(time.time_since_epoch()).count());
+		Check(ok, "in order: the records are read whole, with their time");
+		Check(!reader.Read(record) && reader.Lost() == 0, "in order: nothing more, nothing lost");
+	}
+
+	void TestOverrun()
+	{
+		ShmRingWriter writer(Name, 4096);
+		ShmRingReader reader(Name);
+		for (boost::uint64_t i = 0; i < 1000; ++i) // about 70 KiB through 4 KiB
+			writer.Write(ShmRingWriter::Clock::now(), Message(i));
+
+		ShmRecord record;
+		boost::uint64_t first = 0, sequence = 0, next = 0;
+		bool ok = reader.Read(record) && Whole(record.data, first);
+		for (next = first + 1; ok && reader.Read(record); ++next)
+			ok = Whole(record.data, sequence) && sequence == next;
+		Check(ok && next == 1000, "overrun: the newest records are read whole, in order");
+		Check(reader.Overruns() == 1 && reader.Lost() > 0 && first > 0, "overrun: the overwritten ones are counted as lost");
+	}
+
+	// A reader on its own thread, the writer as fast as it can
+	void TestConcurrent()
+	{
+		const boost::uint64_t count = 1000000;
+		boost::scoped_ptr<ShmRingWriter> writer(new ShmRingWriter(Name, 4096));
+		ShmRingReader reader(Name);
+
+		boost::atomic<bool> done(false);
+		boost::uint64_t read = 0, torn = 0, disordered = 0, gaps = 0, unaccounted = 0;
+		boost::thread thread([&] {
+			ShmRecord record;
+			boost::uint64_t sequence = 0, next = 0, lost = 0;
+			for (;;) {
+				const bool finished = done.load();
+				if (!reader.Read(record)) {
+					if (finished) break;
+					continue;
+				}
+
+				++read;
+				if (!Whole(record.data, sequence)) { ++torn; continue; }
+				if (sequence < next) ++disordered;
+				if (sequence > next) {
+					++gaps;
+					if (reader.Lost() == lost) ++unaccounted; // skipped without being counted
+				}
+				next = sequence + 1;
+				lost = reader.Lost();
+			}
+		});
+
+		for (boost::uint64_t i = 0; i < count; ++i)
+			writer->Write(ShmRingWriter::Clock::now(), Message(i));
+		writer.reset();
+		done = true;
+		thread.join();
+
+		std::cout << "        " << read << " of " << count << " records read, " << gaps << " gaps, "
+			<< reader.Overruns() << " overruns, " << reader.Lost() << " bytes lost" << std::endl;
+		Check(torn == 0, "concurrent: no record is read torn");
+		Check(disordered == 0, "concurrent: no record is read out of order");
+		Check(unaccounted == 0, "concurrent: every gap is counted as lost");
+		Check(reader.Closed(), "concurrent: the reader sees the writer gone");
+	}
+}
+
+int main()
+{
+	try {
+		TestInOrder();
+		TestOverrun();
+		TestConcurrent();
+	}
+	catch (const std::exception &e) {
+		std::cout << "FAILED " << e.what() << std::endl;
+		++failures;
+	}
+
+	return failures;
+}